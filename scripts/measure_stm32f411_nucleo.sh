@@ -9,6 +9,8 @@
 
 THIS_SCRIPT_DIR=$(dirname $0)
 ONNX_FILE=$1
+# Any further arguments are passed on to onnx2c, e.g. '-p register_blocking'
+ONNX2C_ARGS="${@:2}"
 SERIAL_PORT=/dev/ttyACM0
 
 GENERATED_C=$(basename $ONNX_FILE .onnx).c
@@ -34,7 +36,7 @@ CROSS_LIBS="-lopencm3_stm32f4 -lc -lgcc -lnosys "
 
 print_usage()
 {
-	echo  Usage: $0 graph_file.onnx
+	echo  Usage: $0 graph_file.onnx [onnx2c options]
 	echo
 	exit 1
 }
@@ -71,7 +73,7 @@ generate_c()
 
 	echo generating c from $ONNX_FILE
 	# Compile the onnx file to C source
-	onnx2c $ONNX_FILE > $GENERATED_C
+	onnx2c $ONNX2C_ARGS $ONNX_FILE > $GENERATED_C
 
 	# Parse the generated C source, and generate a wrapper file that calls the
 	# neural network inference once.
@@ -117,7 +119,7 @@ flash_and_read()
 	cat exec_times.txt
 }
 
-if [[ $# != 1 ]]
+if [[ $# -lt 1 ]]
 then
 	echo $#
 	print_usage
@@ -6,7 +6,9 @@
 #include "options.h"
 
 #include "aixlog.hpp"
+#include <algorithm>
 #include <iostream>
+#include <set>
 
 using namespace toC;
 
@@ -159,12 +161,22 @@ Tensor* Graph::getIoTensor(onnx::ValueInfoProto& vi)
 		// e.g. "N=1" or "batch_size". Seems to be used for variable size batches.
 		// When the dimension is fixed, the variable does not have a name, and param
 		// is the string representation of value (i.e. "1=1").
-		// Onnx2c doesn't allow variable batch sizes, so if no value is given, use 1.
+		// Onnx2c allows a variable size only in the first dimension, and only with the
+		// '-r' option. Otherwise if no value is given, use 1.
 		int dim_size;
 		if (isalpha(d.dim_param()[0])) {
 			if (d.dim_value()) {
 				dim_size = d.dim_value();
 			}
+			else if (options.runtime_dims.count(d.dim_param())) {
+				if (t->data_dim.size() != 0)
+					ERROR("Unimplemented: runtime dimension " << d.dim_param() << " is not the first dimension of graph input " << t->name);
+				dim_size = options.runtime_dims[d.dim_param()];
+				if (dim_size == 0)
+					ERROR("Maximum size of runtime dimension " << d.dim_param() << " is zero");
+				LOG(DEBUG) << "Graph input tensor dimension (" << d.dim_param() << ") is a runtime parameter, at most " << dim_size << std::endl;
+				t->runtime_dim = d.dim_param();
+			}
 			else {
 				uint32_t user_value = options.dim_defines[d.dim_param()];
 				if (user_value == 0) {
@@ -233,6 +245,37 @@ bool Graph::getNodeInputTensors(const onnx::NodeProto& node, toC::Node* onnx2c_n
 	return true;
 }
 
+/* Collect the names of tensors that subgraph g uses, but that are
+ * not defined in it, i.e. that come from the enclosing graphs.
+ * 'defined' are the names defined in the enclosing subgraphs.
+ */
+static void collect_outer_scope_names(const onnx::GraphProto& g, std::set<std::string> defined, std::vector<std::string>& used)
+{
+	for (const auto& i : g.input())
+		defined.insert(i.name());
+	for (const auto& i : g.initializer())
+		defined.insert(i.name());
+	for (const auto& n : g.node())
+		for (const auto& o : n.output())
+			defined.insert(o);
+
+	auto use = [&](const std::string& name) {
+		if (name == "" || defined.count(name))
+			return;
+		if (std::find(used.begin(), used.end(), name) == used.end())
+			used.push_back(name);
+	};
+	for (const auto& n : g.node()) {
+		for (const auto& i : n.input())
+			use(i);
+		for (const auto& a : n.attribute())
+			if (a.has_g())
+				collect_outer_scope_names(a.g(), defined, used);
+	}
+	for (const auto& o : g.output())
+		use(o.name());
+}
+
 /* Make an onnx2c node object out of the onnx::NodeProto object.
  * @return true node is (or was earlier) added to Graph::nodes datastructure.
  *          Return false if Graph::tensors does not yet have all the input tensor for this node.
@@ -250,6 +293,15 @@ bool Graph::tryResolveNode(onnx::NodeProto& onnx_node)
 
 	Node* n = createNode(onnx_node);
 
+	// Nodes with subgraphs (Loop, Scan) get the tensors of this graph
+	// that the subgraphs use as extra inputs, after their own inputs
+	std::vector<std::string> outer_scope_names;
+	for (const auto& a : onnx_node.attribute())
+		if (a.has_g())
+			collect_outer_scope_names(a.g(), {}, outer_scope_names);
+	for (const auto& name : outer_scope_names)
+		onnx_node.add_input(name);
+
 	// TODO: add comment explaining what is going on here...
 	if (getNodeInputTensors(onnx_node, n) == false) {
 		LOG(TRACE) << "getNodeInputTensors() failed. Not adding node!" << std::endl;
@@ -364,6 +416,13 @@ bool Graph::tryResolveNode(onnx::NodeProto& onnx_node)
 	return true;
 }
 
+Tensor* Graph::get_output_tensor(unsigned N) const
+{
+	if ((int)N >= model.graph().output_size())
+		return nullptr;
+	return findTensor(model.graph().output(N).name());
+}
+
 bool Graph::hasUnresolvedNodes(void)
 {
 	return model.graph().node_size() > (int)nodes.size();
@@ -384,6 +443,7 @@ int64_t Graph::onnx_ir_version(void)
 	return version;
 }
 
+#include "nodes/attention.h"
 #include "nodes/averagepool.h"
 #include "nodes/batchnormalization.h"
 #include "nodes/cast.h"
@@ -409,6 +469,7 @@ int64_t Graph::onnx_ir_version(void)
 #include "nodes/identity.h"
 #include "nodes/instancenorm.h"
 #include "nodes/layernorm.h"
+#include "nodes/loop.h"
 #include "nodes/lrn.h"
 #include "nodes/lstm.h"
 #include "nodes/matmul.h"
@@ -454,6 +515,7 @@ Node* Graph::createNode(const onnx::NodeProto& onnx_node)
 	if (opName == "Asinh") return new Elementwise("Asinh");
 	if (opName == "Atan") return new Elementwise("Atan");
 	if (opName == "Atanh") return new Elementwise("Atanh");
+	if (opName == "Attention") return new Attention;
 	if (opName == "AveragePool") return new AveragePool;
 	if (opName == "BatchNormalization") return new BatchNormalization;
 	if (opName == "BitShift") return new Elementwise_2("BitShift");
@@ -481,6 +543,7 @@ Node* Graph::createNode(const onnx::NodeProto& onnx_node)
 	if (opName == "Exp") return new Elementwise("Exp");
 	if (opName == "Expand") return new Expand;
 	if (opName == "Gather") return new Gather;
+	if (opName == "Gelu") return new Elementwise("Gelu");
 	if (opName == "Gemm") return new Gemm;
 	if (opName == "GlobalAveragePool") return new GlobalAveragePool;
 	if (opName == "GlobalMaxPool") return new GlobalMaxPool;
@@ -496,6 +559,7 @@ Node* Graph::createNode(const onnx::NodeProto& onnx_node)
 	if (opName == "LessOrEqual") return new Elementwise_2("LessOrEqual");
 	if (opName == "Log") return new Elementwise("Log");
 	if (opName == "LogSoftmax") return new Softmax("LogSoftmax");
+	if (opName == "Loop") return new Loop("Loop");
 	if (opName == "LRN") return new LRN;
 	if (opName == "LSTM") return new LSTM;
 	if (opName == "MatMul") return new MatMul;
@@ -534,6 +598,7 @@ Node* Graph::createNode(const onnx::NodeProto& onnx_node)
 	if (opName == "Reshape") return new Reshape;
 	if (opName == "Resize") return new Resize;
 	if (opName == "Round") return new Elementwise("Round");
+	if (opName == "Scan") return new Loop("Scan");
 	if (opName == "ScatterND") return new ScatterND;
 	if (opName == "Selu") return new Elementwise("Selu");
 	if (opName == "Shape") return new Shape;
@@ -551,6 +616,7 @@ Node* Graph::createNode(const onnx::NodeProto& onnx_node)
 	if (opName == "Sqrt") return new Elementwise("Sqrt");
 	if (opName == "Sub") return new Elementwise_2("Sub");
 	if (opName == "Sum") return new Elementwise_variadic("Sum");
+	if (opName == "Swish") return new Elementwise("Swish");
 	if (opName == "Tan") return new Elementwise("Tan");
 	if (opName == "Tanh") return new Elementwise("Tanh");
 	if (opName == "Transpose") return new Transpose;
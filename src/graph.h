@@ -9,6 +9,9 @@ extern bool target_avr;
 
 namespace toC {
 
+class Pad;
+class Transpose;
+
 class Graph {
 	public:
 	Graph(
@@ -34,6 +37,10 @@ class Graph {
 	    std::vector<Tensor*> inputs = {});
 	void resolveGraphNodes(onnx::GraphProto& onnx_graph);
 
+	/* Mark the nodes that use tensors with a runtime sized first dimension
+	 * to be called once per element of that dimension. */
+	void resolve_runtime_dims(void);
+
 	/* Optimization step: cluster the buffers of intermediate tensors into
 	 * unions. This make the memory buffers time shared. */
 	void unionize_tensors(void);
@@ -41,6 +48,69 @@ class Graph {
 	/* Optimization step: Fold Cast-nodes to their predecessor. */
 	void fold_casts(void);
 
+	/* Optimization step: merge, cancel and sink Transpose-nodes,
+	 * and fold them into Gemm operand access. */
+	void fold_transposes(void);
+
+	/* Optimization step: fuse bias Adds and flattening Reshapes into MatMul-nodes. */
+	void fuse_linear(void);
+
+	/* Optimization step: replace DequantizeLinear -> node -> QuantizeLinear
+	 * patterns with the QLinear integer nodes. */
+	void lower_qdq(void);
+
+	/* Optimization step: fold Pad-nodes into the padding of the following Conv or pooling node. */
+	void fold_pads(void);
+
+	/* Optimization step: remove nodes that don't change their input,
+	 * e.g. Identity, Dropout, Mul by one and Reshape round trips. */
+	void simplify(void);
+
+	/* Optimization step: fuse sibling Gemm, MatMul and Conv-nodes that read
+	 * the same input into one node with concatenated weights. */
+	void fuse_siblings(void);
+
+	/* Optimization step: replace the MatMul -> Softmax -> MatMul subgraphs
+	 * of scaled dot product attention with Attention-nodes. */
+	void fuse_attention(void);
+
+	/* Optimization step: replace the subgraphs that older opsets export
+	 * GELU, SiLU and LayerNormalization as with a single node. */
+	void fuse_decomposed(void);
+
+	/* Optimization step: fuse Relu and Clip-nodes into the Conv-node before them,
+	 * so the Conv clamps its outputs as it writes them. */
+	void fuse_conv_activation(void);
+
+	/* Optimization step: fuse pooling and spatial ReduceMean-nodes into the Conv-node
+	 * before them, so the full resolution Conv output is not stored. */
+	void fuse_conv_pool(void);
+
+	/* Optimization step: convert Conv and pooling-nodes to channels last (NHWC)
+	 * layout, with Transposes only on the borders of the converted regions. */
+	void channels_last(void);
+
+	/* Optimization step: propagate value ranges through the graph, to remove
+	 * redundant Relu and Clip-nodes and to narrow integer types. */
+	void range_analysis(void);
+
+	/* Optimization step: calculate 3x3 stride 1 Conv-nodes with Winograd
+	 * F(2x2,3x3), with the weights transformed at compile time. */
+	void winograd(void);
+
+	/* Optimization step: lower Conv-nodes to packing the input patches (im2col)
+	 * and a blocked GEMM, when the packed patches are reused enough. */
+	void im2col(void);
+
+	/* Optimization step: calculate Conv-nodes in tiles of output channels and
+	 * outputs kept in local accumulators, without scratch memory. */
+	void register_blocking(void);
+
+	/* Optimization step: calculate Gemm- and MatMul-nodes as a GEMM on packed,
+	 * cache sized blocks of the operands, in register tiles, or as a GEMV
+	 * that reads B in storage order when A is a single row. */
+	void blocked_gemm(void);
+
 	/* Set print options */
 	void set_no_globals(bool ng) { no_globals = ng; }
 
@@ -56,7 +126,13 @@ class Graph {
 
 	int64_t onnx_ir_version(void);
 
+	/* The tensor of the Nth graph output */
+	Tensor* get_output_tensor(unsigned N) const;
+
 	private:
+	// Temporarily set the size of the runtime dimension of node n's tensors
+	void set_runtime_dim_size(Node* n, int size);
+
 	// The top-level onnx object.
 	onnx::ModelProto& model;
 
@@ -103,6 +179,95 @@ class Graph {
 	uint32_t add_to_free_union(Tensor* t);
 	void mark_union_unoccupied(uint32_t);
 
+	// Helpers for the optimization passes to edit the graph.
+	// See optimization_passes/graph_edit.cpp
+	Node* findProducer(const Tensor* t) const;
+	void replaceTensorUsers(Tensor* old, Tensor* replacement);
+	void replaceNodeInput(Node* n, Tensor* old, Tensor* replacement);
+	void removeNode(Node* n);
+	void removeNodes(std::vector<Node*> ns);
+	void dropTensor(Tensor* t);
+	void moveNodeAfter(Node* n, Node* position);
+	Node* insertNode(onnx::NodeProto& onnx_node, Node* position);
+	static void addIntAttribute(onnx::NodeProto& onnx_node, const std::string& name, int64_t val);
+	static void addIntsAttribute(onnx::NodeProto& onnx_node, const std::string& name, const std::vector<int64_t>& vals);
+	static void addFloatAttribute(onnx::NodeProto& onnx_node, const std::string& name, float val);
+	void takeOverOutput(Node* n, unsigned output_no, Tensor* t);
+	Tensor* addConstTensor(const std::string& name_base, onnx::TensorProto_DataType type, const std::vector<int>& dims);
+	bool scratchAllowed(const std::string& pass_name) const;
+	Tensor* addScratchTensor(Node* n, const std::string& param, const std::string& name_suffix,
+	                         onnx::TensorProto_DataType type, const std::vector<int>& dims);
+	std::string uniqueName(const std::string& base) const;
+	bool isInitializer(const Tensor* t) const;
+
+	// Helpers for fold_transposes
+	Tensor* transpose_constant(const Tensor* c, const std::vector<int>& perm);
+	bool bypass_transpose(Transpose* t);
+	bool sink_transpose_unary(Transpose* t, Node* e);
+	bool sink_transpose_binary(Transpose* t, Node* e);
+	bool fold_transpose_into_gemm(Transpose* t, Node* consumer);
+
+	// Helpers for fuse_linear
+	bool fuse_matmul_add(Node* matmul);
+	bool fuse_reshape_matmul_reshape(Node* matmul);
+
+	// Helpers for lower_qdq
+	bool get_qparams(Node* n, onnx::TensorProto_DataType type, Tensor*& scale, Tensor*& zero_point);
+	Node* find_dequantizer(const Tensor* t);
+	Tensor* quantize_conv_bias(Tensor* bias, Tensor* x_scale, Tensor* w_scale);
+	bool lower_qdq_node(Node* n);
+	bool cancel_dq_q(Node* dq);
+
+	// Helpers for fold_casts
+	Tensor* cast_constant(const Tensor* c, onnx::TensorProto_DataType type);
+
+	// Helpers for fold_pads
+	bool fold_pad(Pad* pad);
+
+	// Helpers for simplify
+	bool bypass_node(Node* n, Tensor* in);
+
+	// Helpers for fuse_siblings
+	bool can_fuse_sibling(const Node* n) const;
+	Tensor* concat_constants(const std::vector<const Tensor*>& ts, unsigned axis, const std::string& name_base);
+	Tensor* concat_biases(const std::vector<Node*>& siblings, const std::vector<int>& dims);
+	void fuse_sibling_group(const std::vector<Node*>& siblings);
+
+	// Helpers for fuse_attention
+	bool fuse_attention_at(Node* softmax);
+
+	// Helpers for fuse_decomposed
+	void replace_with_elementwise(const std::string& op, Tensor* x, Tensor* y, const std::vector<Node*>& subgraph);
+	bool fuse_gelu(Node* erf);
+	bool fuse_silu(Node* sigmoid);
+	bool fuse_layernorm(Node* mean_node);
+
+	// Helpers for fuse_conv_activation
+	bool fuse_conv_activation_at(Node* n);
+
+	// Helpers for fuse_conv_pool
+	bool fuse_conv_pool_at(Node* conv_node);
+
+	// Helpers for channels_last
+	bool convert_to_channels_last(Node* n);
+
+	// Helpers for range_analysis
+	bool narrow_gather_indices(Node* n);
+
+	// Helpers for blocked_gemm
+	bool lower_to_blocked_gemm(Node* n);
+	void prepack_gemm_b(Node* n, Tensor* b, int K, int N, bool transposed);
+	void transpose_gemm_b(Node* n, Tensor* b, int K, int N);
+
+	// Helpers for im2col
+	bool lower_to_im2col(Node* n);
+
+	// Helpers for register_blocking
+	bool register_block(Node* n);
+
+	// Helpers for winograd
+	bool lower_to_winograd(Node* n);
+
 	// Print options
 	bool no_globals = false;
 };
@@ -7,6 +7,7 @@
 #include "timestamp.h"
 #include "util.h"
 
+#include <algorithm>
 #include <iostream>
 
 using namespace toC;
@@ -149,10 +150,17 @@ void Graph::print_functions(std::ostream& dst)
 		// handle meta-nodes separately
 		if (n->op_name == "graph_io")
 			continue;
+		n->print_subgraphs(dst);
 		dst << "/*" << std::endl;
 		dst << " * Operand:           " << n->op_name << std::endl;
 		dst << " * Name in ONNX file: " << n->onnx_name << std::endl;
+		if (n->runtime_dim != "")
+			dst << " * Called for each element of runtime dimension " << n->runtime_dim << std::endl;
 		dst << " */" << std::endl;
+
+		// The function is generated for one element of the runtime dimension
+		if (n->runtime_dim != "")
+			set_runtime_dim_size(n, 1);
 		dst << "FUNC_PREFIX void ";
 		dst << n->c_name() << "( ";
 		n->print_function_parameters_definition(dst);
@@ -164,6 +172,8 @@ void Graph::print_functions(std::ostream& dst)
 
 		dst << "}" << std::endl
 		    << std::endl;
+		if (n->runtime_dim != "")
+			set_runtime_dim_size(n, options.runtime_dims[n->runtime_dim]);
 	}
 }
 
@@ -200,6 +210,21 @@ void Graph::print_interface_function(std::ostream& dst, bool definition, const s
 	bool isfirst = true;
 	// TODO: take the interface function name from the ONNX file name
 	dst << "void " << func_name << "(";
+	// Runtime dimensions come first, in the order of the inputs that have them
+	std::vector<std::string> runtime_dims;
+	for (auto i : model.graph().input()) {
+		Tensor* t = findTensor(i.name());
+		if (t == nullptr || t->isIO == false || t->runtime_dim == "")
+			continue;
+		if (std::find(runtime_dims.begin(), runtime_dims.end(), t->runtime_dim) != runtime_dims.end())
+			continue;
+		if (!isfirst)
+			dst << ", ";
+		else
+			isfirst = false;
+		dst << "uint32_t " << cify_name(t->runtime_dim);
+		runtime_dims.push_back(t->runtime_dim);
+	}
 	for (auto i : model.graph().input()) {
 		/* TODO: FIXME: separate input tensors that are initialized
 		 * or re-initializable (and therefore count as input), from
@@ -266,6 +291,9 @@ void Graph::print_interface_function(std::ostream& dst, bool definition, const s
 		if (n->op_name == "graph_io")
 			continue;
 
+		if (n->runtime_dim != "")
+			dst << "\tfor( uint32_t r=0; r<" << cify_name(n->runtime_dim) << "; r++ )" << std::endl
+			    << "\t";
 		dst << "\t" << n->c_name() << "( ";
 		n->print_function_parameters_callsite(dst);
 		dst << ");" << std::endl;
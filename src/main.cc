@@ -29,10 +29,44 @@ int main(int argc, const char* argv[])
 
 	std::cout.precision(20);
 	toC::Graph toCgraph(onnx_model);
+	if (options.opt_simplify)
+		toCgraph.simplify();
+	if (options.opt_lower_qdq)
+		toCgraph.lower_qdq();
+	if (options.opt_fold_transposes)
+		toCgraph.fold_transposes();
+	if (options.opt_fuse_decomposed)
+		toCgraph.fuse_decomposed();
+	if (options.opt_fuse_attention)
+		toCgraph.fuse_attention();
+	if (options.opt_fuse_linear)
+		toCgraph.fuse_linear();
+	if (options.opt_fold_pads)
+		toCgraph.fold_pads();
+	if (options.opt_fuse_siblings)
+		toCgraph.fuse_siblings();
+	if (options.opt_fuse_conv_activation)
+		toCgraph.fuse_conv_activation();
+	if (options.opt_fuse_conv_pool)
+		toCgraph.fuse_conv_pool();
+	if (options.opt_channels_last)
+		toCgraph.channels_last();
+	if (options.opt_range_analysis)
+		toCgraph.range_analysis();
+	if (options.opt_winograd)
+		toCgraph.winograd();
+	if (options.opt_im2col)
+		toCgraph.im2col();
+	if (options.opt_register_blocking)
+		toCgraph.register_blocking();
+	if (options.opt_blocked_gemm)
+		toCgraph.blocked_gemm();
 	if (options.opt_fold_casts)
 		toCgraph.fold_casts();
 	if (options.opt_unionize)
 		toCgraph.unionize_tensors();
+	if (options.runtime_dims.size() > 0)
+		toCgraph.resolve_runtime_dims();
 	toCgraph.set_no_globals(options.no_globals);
 
 	if (options.only_init) {
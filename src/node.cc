@@ -78,6 +78,15 @@ void Node::multidirectional_broadcast_size(
 	}
 }
 
+// Nodes called once per element of a runtime dimension get
+// a pointer to the element r of the tensors that have that dimension
+std::string Node::print_callsite_slice(const Tensor* t) const
+{
+	if (runtime_dim != "" && t->runtime_dim == runtime_dim)
+		return "&" + t->print_tensor_callsite() + "[r]";
+	return t->print_tensor_callsite();
+}
+
 void Node::print_parameters(std::ostream& dst, bool not_callsite) const
 {
 	// First create the parameter names as strings (with or without dimensions)
@@ -91,7 +100,7 @@ void Node::print_parameters(std::ostream& dst, bool not_callsite) const
 		if (not_callsite)
 			params.push_back(t->print_tensor_as_const(name));
 		else
-			params.push_back(t->print_tensor_callsite());
+			params.push_back(print_callsite_slice(t));
 	}
 	for (auto o : output_params) {
 		Tensor* t = std::get<0>(o);
@@ -111,7 +120,7 @@ void Node::print_parameters(std::ostream& dst, bool not_callsite) const
 		if (not_callsite)
 			params.push_back(t->print_tensor(name));
 		else
-			params.push_back(t->print_tensor_callsite());
+			params.push_back(print_callsite_slice(t));
 	}
 
 	// Then print the parmeters as comma-separated string
@@ -188,6 +197,21 @@ bool Node::replace_input(Tensor* old, Tensor* replacement)
 	return false;
 }
 
+bool Node::replace_output(Tensor* old, Tensor* replacement)
+{
+
+	for (auto& p : output_params) {
+		if (std::get<0>(p) == old) {
+			LOG(DEBUG) << "Did output replacement" << std::endl;
+			std::get<0>(p) = replacement;
+			return true;
+		}
+	}
+
+	LOG(DEBUG) << "No output replacement" << std::endl;
+	return false;
+}
+
 std::string Node::math_func(std::string name) const
 {
 	switch (math_type) {
@@ -21,6 +21,7 @@ class Node {
 	bool isResolved;       // has this node been visited in current compilation step.
 	std::string onnx_name; //	ONNX name of the individual node
 	std::string op_name;   //	ONNX name of node type
+	std::string runtime_dim; // non-empty: node is called once per element of this runtime dimension
 	static int64_t onnx_ir_version;
 	virtual ~Node() {}
 
@@ -61,6 +62,10 @@ class Node {
 	/* Print the C implmementation of the operator */
 	virtual void print(std::ostream& destination) const = 0;
 
+	/* Print file scope code that the operator's function uses,
+	 * e.g. the compiled subgraphs of Loop and Scan */
+	virtual void print_subgraphs(std::ostream& destination) const {}
+
 	/* Print comma-separated list of function parameters.
 	 * Unused optional tensors skipped. e.g.:
 	 *   "tensior_X, tensor_Y"
@@ -74,6 +79,7 @@ class Node {
 	void print_parameters(std::ostream& destination, bool decorate) const;
 	void print_function_parameters_definition(std::ostream& destination) const;
 	void print_function_parameters_callsite(std::ostream& destination) const;
+	std::string print_callsite_slice(const Tensor* t) const;
 
 	/* Figure out in what format the output is in.
 	 * This fills the node's list of 'outputs' tensors.
@@ -92,6 +98,11 @@ class Node {
 	 */
 	bool replace_input(Tensor* old, Tensor* replacement);
 
+	/* Replace output tensor 'old' with 'replacement'.
+	 * Return false if 'old' is not an output tensor.
+	 */
+	bool replace_output(Tensor* old, Tensor* replacement);
+
 	/* Not all node types have attributes. Override where needed */
 	virtual void parseAttributes(onnx::NodeProto& node)
 	{
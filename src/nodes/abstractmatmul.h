@@ -35,7 +35,7 @@ class AbstractMatMul : public Node {
 	std::vector<int> resolve_shape() const;
 };
 
-std::vector<int> AbstractMatMul::resolve_shape() const
+inline std::vector<int> AbstractMatMul::resolve_shape() const
 {
 	Tensor* a = get_a();
 	Tensor* b = get_b();
@@ -60,11 +60,15 @@ std::vector<int> AbstractMatMul::resolve_shape() const
 			ERROR("Reduction dimension mismatch in MatMul");
 		}
 
-		if (a->data_dim.size() > b->data_dim.size()) {
-			y_dim.insert(y_dim.end(), a->data_dim.begin(), a->data_dim.end() - 2);
-		}
-		else {
-			y_dim.insert(y_dim.end(), b->data_dim.begin(), b->data_dim.end() - 2);
+		// The batch dimensions are broadcast: a dimension of 1, or a missing
+		// dimension, takes the size of the other
+		int a_batch = std::max(0, (int)a->rank() - 2);
+		int b_batch = std::max(0, (int)b->rank() - 2);
+		int y_batch = std::max(a_batch, b_batch);
+		for (int i = 0; i < y_batch; i++) {
+			int a_dim = i < y_batch - a_batch ? 1 : a->data_dim[i - (y_batch - a_batch)];
+			int b_dim = i < y_batch - b_batch ? 1 : b->data_dim[i - (y_batch - b_batch)];
+			y_dim.push_back(std::max(a_dim, b_dim));
 		}
 	}
 
@@ -79,7 +83,7 @@ std::vector<int> AbstractMatMul::resolve_shape() const
 	return y_dim;
 };
 
-void AbstractMatMul::print(std::ostream& dst) const
+inline void AbstractMatMul::print(std::ostream& dst) const
 {
 	INDT_1 << "/* " << op_name << " (AbstractMatMul) */" << std::endl;
 
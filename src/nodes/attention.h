@@ -0,0 +1,177 @@
+/* This file is part of onnx2c.
+ *
+ * Attention node.
+ * Calculates scaled dot product attention:
+ * Y = Softmax( scale * Q*K^T + attn_mask ) * V
+ *
+ * The scores are calculated one query row at a time, with an
+ * "online softmax": the running maximum, sum of exponentials and
+ * weighted sum of V are rescaled whenever a larger score is found.
+ * So the [q_seq x kv_seq] score matrix is never stored, only one
+ * accumulator row of V's width.
+ *
+ * The fuse_attention optimization pass creates these nodes from the
+ * MatMul -> Softmax -> MatMul subgraphs of exported transformers.
+ *
+ * Implemented are 3D (batch, seq, head_size) inputs with one head
+ * and 4D (batch, heads, seq, head_size) inputs with the same number
+ * of heads in Q, K and V. attn_mask is broadcast to the shape of
+ * the scores, (batch, [heads,] q_seq, kv_seq). Past key and value
+ * inputs and the optional outputs are not implemented.
+ */
+
+#include "node.h"
+#include <cmath>
+
+namespace toC {
+
+class Attention : public Node {
+	public:
+	Attention()
+	{
+		op_name = "Attention";
+		scale = 0;
+		is_causal = 0;
+		softcap = 0;
+		q_num_heads = kv_num_heads = 0;
+	}
+
+	// Attributes
+	float scale;
+	int is_causal;
+	float softcap;
+	int q_num_heads;
+	int kv_num_heads;
+
+	virtual void parseAttributes(onnx::NodeProto& node) override;
+	virtual void resolve(void) override;
+	virtual void print(std::ostream& dst) const override;
+};
+
+void Attention::parseAttributes(onnx::NodeProto& node)
+{
+	for (const auto& a : node.attribute()) {
+		LOG(TRACE) << "Parsing attribute " << a.name() << std::endl;
+		if (a.name() == "scale")
+			scale = parse_attribute_float(a);
+		else if (a.name() == "is_causal")
+			is_causal = parse_attribute_int(a);
+		else if (a.name() == "softcap")
+			softcap = parse_attribute_float(a);
+		else if (a.name() == "q_num_heads")
+			q_num_heads = parse_attribute_int(a);
+		else if (a.name() == "kv_num_heads")
+			kv_num_heads = parse_attribute_int(a);
+		else if (a.name() == "qk_matmul_output_mode" || a.name() == "softmax_precision")
+			LOG(WARNING) << "Ignoring attribute " << a.name() << " for node Attention/" << onnx_name << std::endl;
+		else
+			ERROR("Unknown attribute " << a.name());
+	}
+}
+
+void Attention::resolve(void)
+{
+	Tensor* q = get_input_tensor(0);
+	Tensor* k = get_input_tensor(1);
+	Tensor* v = get_input_tensor(2);
+	name_input(0, "Q");
+	name_input(1, "K");
+	name_input(2, "V");
+	if (get_number_of_inputs() > 3 && get_input_tensor(3)->is_used())
+		name_input(3, "attn_mask");
+	if (get_number_of_inputs() > 4)
+		ERROR("Unimplemented - past_key and past_value inputs to Attention");
+	for (unsigned o = 1; o < 4; o++)
+		if (is_output_N_used(o))
+			ERROR("Unimplemented - optional outputs of Attention");
+
+	unsigned rank = q->rank();
+	if (rank != 3 && rank != 4)
+		ERROR("Attention inputs must be 3D or 4D");
+	if (k->rank() != rank || v->rank() != rank)
+		ERROR("Attention inputs Q, K and V must have the same rank");
+	if (rank == 3 && (q_num_heads > 1 || kv_num_heads > 1))
+		ERROR("Unimplemented - several heads in 3D Attention inputs");
+	for (unsigned d = 0; d < rank - 2; d++)
+		if (k->data_dim[d] != q->data_dim[d] || v->data_dim[d] != q->data_dim[d])
+			ERROR("Unimplemented - broadcasting or grouped heads in Attention");
+	if (k->data_dim[rank - 1] != q->data_dim[rank - 1] || v->data_dim[rank - 2] != k->data_dim[rank - 2])
+		ERROR("Attention input dimensions don't match");
+	if (typeConstraint_plainFloatingPoints(q) == false)
+		ERROR("Incorrect input for Attention");
+
+	if (scale == 0)
+		scale = 1.0 / std::sqrt(q->data_dim[rank - 1]);
+
+	Tensor* y = new Tensor;
+	y->data_dim = q->data_dim;
+	y->data_dim[rank - 1] = v->data_dim[rank - 1];
+	y->data_type = q->data_type;
+	register_output(y, "Y");
+
+	set_math_type(q->data_type);
+}
+
+void Attention::print(std::ostream& dst) const
+{
+	const Tensor* q = get_input_tensor(0);
+	const Tensor* k = get_input_tensor(1);
+	const Tensor* v = get_input_tensor(2);
+	const Tensor* mask = nullptr;
+	if (get_number_of_inputs() > 3 && get_input_tensor(3)->is_used())
+		mask = get_input_tensor(3);
+	std::string type = q->data_type_str();
+	unsigned rank = q->rank();
+	std::string q_i = "i" + std::to_string(rank - 2);
+	std::string kv_i = "i" + std::to_string(rank - 1);
+	int head_size = q->data_dim[rank - 1];
+	int v_head_size = v->data_dim[rank - 1];
+
+	INDT_1 << "/* Attention" << std::endl;
+	INDT_1 << " * scale = " << scale << std::endl;
+	INDT_1 << " * is_causal = " << is_causal << std::endl;
+	INDT_1 << " * softcap = " << softcap << std::endl;
+	INDT_1 << " */" << std::endl;
+
+	std::string batch_idx;
+	for (unsigned d = 0; d < rank - 2; d++) {
+		std::string i = "i" + std::to_string(d);
+		INDT_1 << "for( uint32_t " << i << "=0; " << i << "<" << q->data_dim[d] << "; " << i << "++ )" << std::endl;
+		batch_idx += "[" + i + "]";
+	}
+	INDT_1 << "for( uint32_t " << q_i << "=0; " << q_i << "<" << q->data_dim[rank - 2] << "; " << q_i << "++ ) {" << std::endl;
+	INDT_2 << type << " max = -INFINITY;" << std::endl;
+	INDT_2 << type << " sum = 0;" << std::endl;
+	INDT_2 << type << " acc[" << v_head_size << "] = {0};" << std::endl;
+
+	INDT_2 << "for( uint32_t " << kv_i << "=0; " << kv_i << "<" << k->data_dim[rank - 2] << "; " << kv_i << "++ ) {" << std::endl;
+	if (is_causal)
+		INDT_3 << "if( " << kv_i << " > " << q_i << " ) break;" << std::endl;
+	if (mask && mask->data_type == onnx::TensorProto_DataType_BOOL)
+		INDT_3 << "if( !" << broadcast(mask, "attn_mask", rank) << " ) continue;" << std::endl;
+	INDT_3 << type << " s = 0;" << std::endl;
+	INDT_3 << "for( uint32_t d=0; d<" << head_size << "; d++ )" << std::endl;
+	INDT_4 << "s += Q" << batch_idx << "[" << q_i << "][d] * K" << batch_idx << "[" << kv_i << "][d];" << std::endl;
+	INDT_3 << "s *= " << scale << ";" << std::endl;
+	if (mask && mask->data_type != onnx::TensorProto_DataType_BOOL)
+		INDT_3 << "s += " << broadcast(mask, "attn_mask", rank) << ";" << std::endl;
+	if (softcap != 0)
+		INDT_3 << "s = " << softcap << " * " << math_func("tanh") << "(s / " << softcap << ");" << std::endl;
+	INDT_3 << "if( s == -INFINITY ) continue;" << std::endl;
+
+	// Rescale what was accumulated so far, if this score is the new maximum
+	INDT_3 << type << " new_max = max > s ? max : s;" << std::endl;
+	INDT_3 << type << " correction = " << math_func("exp") << "(max - new_max);" << std::endl;
+	INDT_3 << type << " p = " << math_func("exp") << "(s - new_max);" << std::endl;
+	INDT_3 << "sum = sum * correction + p;" << std::endl;
+	INDT_3 << "for( uint32_t d=0; d<" << v_head_size << "; d++ )" << std::endl;
+	INDT_4 << "acc[d] = acc[d] * correction + p * V" << batch_idx << "[" << kv_i << "][d];" << std::endl;
+	INDT_3 << "max = new_max;" << std::endl;
+	INDT_2 << "}" << std::endl;
+
+	INDT_2 << "for( uint32_t d=0; d<" << v_head_size << "; d++ )" << std::endl;
+	INDT_3 << "Y" << batch_idx << "[" << q_i << "][d] = acc[d] / sum;" << std::endl;
+	INDT_1 << "}" << std::endl;
+}
+
+} // namespace toC
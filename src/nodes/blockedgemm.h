@@ -0,0 +1,260 @@
+/* This file is part of onnx2c.
+ *
+ * BlockedGemm
+ * Prints a cache blocked and register tiled matrix multiplication
+ *   Y = alpha*A*B + beta*C
+ * for the Gemm and MatMul nodes lowered by the 'blocked_gemm'
+ * optimization pass.
+ *
+ * B is split into blocks of KC rows and NC columns, and A into blocks
+ * of MC rows and KC columns, small enough to stay in the caches while
+ * they are used. The blocks are packed into panels of NR columns of B
+ * and MR rows of A, so the innermost loops read both with unit stride.
+ * Each MR x NR tile of Y is accumulated in local variables.
+ * The panels are padded with zeros to full MR and NR, so the tiles on
+ * the edges need no special casing, except when they are written out.
+ *
+ * A constant B can be packed at compile time, for all blocks at once.
+ *
+ * BlockedGemv
+ * Prints the same for a single row of A, i.e. a matrix-vector product.
+ * Nothing in B is reused, so the product is bound by reading B. The loops
+ * read B once, in the order it is stored in, several rows at a time.
+ */
+#pragma once
+#include "node.h"
+#include <functional>
+
+namespace toC {
+
+class BlockedGemm {
+	public:
+	// Register tile, and the cache blocks
+	static constexpr int MR = 4, NR = 8;
+	static constexpr int MC = 64, KC = 256, NC = 256;
+
+	// Prints the element of a matrix at the given row and column
+	using Element = std::function<std::string(const std::string& row, const std::string& col)>;
+
+	int M, N, K;
+	std::string type;
+	Element a, b, y;
+	Element c; // optional
+	float alpha = 1;
+	float beta = 1;
+	bool prepacked_b = false; // B is the output of pack_b()
+
+	// Sizes of the scratch buffers for the packed blocks
+	static int packed_a_size(int M, int K)
+	{
+		return (std::min(M, MC) + MR - 1) / MR * MR * std::min(K, KC);
+	}
+	static int packed_b_size(int N, int K)
+	{
+		return (std::min(N, NC) + NR - 1) / NR * NR * std::min(K, KC);
+	}
+
+	// Dimensions of B packed at compile time:
+	// panels of NR columns, each with all K rows
+	static std::vector<int> prepacked_b_dims(int N, int K)
+	{
+		return {(N + NR - 1) / NR, K, NR};
+	}
+	static void pack_b(const float* b, float* bp, int K, int N, bool transposed)
+	{
+		for (int p = 0; p < (N + NR - 1) / NR; p++)
+			for (int k = 0; k < K; k++)
+				for (int j = 0; j < NR; j++) {
+					int col = p * NR + j;
+					float v = 0;
+					if (col < N)
+						v = transposed ? b[col * K + k] : b[k * N + col];
+					bp[(p * K + k) * NR + j] = v;
+				}
+	}
+
+	void print(std::ostream& dst) const
+	{
+		INDT_1 << "/* blocked GEMM: " << MR << "x" << NR << " register tiles, in blocks of "
+		       << MC << " rows of A, " << KC << " rows and " << NC << " columns of B */" << std::endl;
+		INDT_1 << "for( uint32_t n0=0; n0<" << N << "; n0+=" << NC << " )" << std::endl;
+		INDT_1 << "for( uint32_t k0=0; k0<" << K << "; k0+=" << KC << " ) {" << std::endl;
+		INDT_2 << "uint32_t nc = " << N << "-n0 < " << NC << " ? " << N << "-n0 : " << NC << ";" << std::endl;
+		INDT_2 << "uint32_t kc = " << K << "-k0 < " << KC << " ? " << K << "-k0 : " << KC << ";" << std::endl;
+		if (prepacked_b == false) {
+			INDT_2 << "for( uint32_t jp=0; jp<nc; jp+=" << NR << " )" << std::endl;
+			INDT_2 << "for( uint32_t k=0; k<kc; k++ )" << std::endl;
+			INDT_2 << "for( uint32_t j=0; j<" << NR << "; j++ )" << std::endl;
+			INDT_3 << "Bp[(jp*kc + k*" << NR << ") + j] = n0+jp+j < " << N << " ? " << b("k0+k", "n0+jp+j") << " : 0;" << std::endl;
+		}
+
+		INDT_2 << "for( uint32_t m0=0; m0<" << M << "; m0+=" << MC << " ) {" << std::endl;
+		INDT_2 << "uint32_t mc = " << M << "-m0 < " << MC << " ? " << M << "-m0 : " << MC << ";" << std::endl;
+		INDT_2 << "for( uint32_t ip=0; ip<mc; ip+=" << MR << " )" << std::endl;
+		INDT_2 << "for( uint32_t k=0; k<kc; k++ )" << std::endl;
+		INDT_2 << "for( uint32_t i=0; i<" << MR << "; i++ )" << std::endl;
+		INDT_3 << "Ap[(ip*kc + k*" << MR << ") + i] = m0+ip+i < " << M << " ? " << a("m0+ip+i", "k0+k") << " : 0;" << std::endl;
+
+		INDT_2 << "for( uint32_t jp=0; jp<nc; jp+=" << NR << " )" << std::endl;
+		INDT_2 << "for( uint32_t ip=0; ip<mc; ip+=" << MR << " ) {" << std::endl;
+		INDT_3 << "const " << type << " *ap = &Ap[ip*kc];" << std::endl;
+		if (prepacked_b)
+			INDT_3 << "const " << type << " *bp = (const " << type << "*)B + ((n0+jp)*" << K << " + k0*" << NR << ");" << std::endl;
+		else
+			INDT_3 << "const " << type << " *bp = &Bp[jp*kc];" << std::endl;
+		// One accumulator row per row of the tile: the C compilers keep
+		// these in (vector) registers better than a two dimensional array
+		for (int i = 0; i < MR; i++)
+			INDT_3 << type << " acc" << i << "[" << NR << "] = {0};" << std::endl;
+		INDT_3 << "for( uint32_t k=0; k<kc; k++ ) {" << std::endl;
+		for (int i = 0; i < MR; i++)
+			INDT_4 << type << " a" << i << " = ap[k*" << MR << " + " << i << "];" << std::endl;
+		INDT_4 << "for( uint32_t j=0; j<" << NR << "; j++ ) {" << std::endl;
+		INDT_5 << type << " b = bp[k*" << NR << " + j];" << std::endl;
+		for (int i = 0; i < MR; i++)
+			INDT_5 << "acc" << i << "[j] += a" << i << " * b;" << std::endl;
+		INDT_4 << "}" << std::endl;
+		INDT_3 << "}" << std::endl;
+
+		// Write out the tile. Partial sums of the earlier blocks of K are kept in Y.
+		for (int i = 0; i < MR; i++) {
+			INDT_3 << "for( uint32_t j=0; j<" << NR << " && m0+ip+" << i << "<" << M << " && n0+jp+j<" << N << "; j++ ) {" << std::endl;
+			INDT_4 << "uint32_t r = m0+ip+" << i << ", c = n0+jp+j;" << std::endl;
+			INDT_4 << type << " v = acc" << i << "[j];" << std::endl;
+			if (K > KC) {
+				INDT_4 << "if( k0 > 0 ) v += " << y("r", "c") << ";" << std::endl;
+				INDT_4 << "if( k0+" << KC << " < " << K << " ) { " << y("r", "c") << " = v; continue; }" << std::endl;
+			}
+			if (alpha != 1)
+				INDT_4 << "v *= " << alpha << ";" << std::endl;
+			if (c && beta == 1)
+				INDT_4 << "v += " << c("r", "c") << ";" << std::endl;
+			else if (c && beta != 0)
+				INDT_4 << "v += " << c("r", "c") << " * " << beta << ";" << std::endl;
+			INDT_4 << y("r", "c") << " = v;" << std::endl;
+			INDT_3 << "}" << std::endl;
+		}
+		INDT_2 << "} /* tiles */" << std::endl;
+		INDT_2 << "} /* m0 */" << std::endl;
+		INDT_1 << "} /* n0, k0 */" << std::endl;
+	}
+};
+
+class BlockedGemv {
+	public:
+	// Rows of B read at a time, and the partial sums of a dot product
+	static constexpr int ROWS = 4;
+	static constexpr int LANES = 8;
+
+	// Prints the element of a vector at the given index
+	using Element = std::function<std::string(const std::string& idx)>;
+
+	int N, K;
+	std::string type;
+	Element a, y;
+	Element c; // optional
+	BlockedGemm::Element b;
+	float alpha = 1;
+	float beta = 1;
+	bool transposed_b = false; // B is stored as N rows of K
+
+	void print(std::ostream& dst) const
+	{
+		if (transposed_b)
+			print_transposed(dst);
+		else
+			print_rows(dst);
+	}
+
+	private:
+	// Finish the output v of column "c" and store it,
+	// indented by the given number of tabs
+	void print_store(std::ostream& dst, int indent) const
+	{
+		std::string tabs(indent, '\t');
+		if (alpha != 1)
+			dst << tabs << "v *= " << alpha << ";" << std::endl;
+		if (this->c && beta == 1)
+			dst << tabs << "v += " << this->c("c") << ";" << std::endl;
+		else if (this->c && beta != 0)
+			dst << tabs << "v += " << this->c("c") << " * " << beta << ";" << std::endl;
+		dst << tabs << y("c") << " = v;" << std::endl;
+	}
+
+	// B stored as K rows of N: ROWS rows of B are added to Y at a time
+	void print_rows(std::ostream& dst) const
+	{
+		INDT_1 << "/* GEMV: B read " << ROWS << " rows at a time */" << std::endl;
+		INDT_1 << "for( uint32_t c=0; c<" << N << "; c++ )" << std::endl;
+		INDT_2 << y("c") << " = 0;" << std::endl;
+		INDT_1 << "for( uint32_t k=0; k<" << K << "; k+=" << ROWS << " ) {" << std::endl;
+		if (K % ROWS) {
+			// Rows past the end of B are read with zero weight from the last row
+			for (int i = 0; i < ROWS; i++) {
+				INDT_2 << "uint32_t k" << i << " = k+" << i << " < " << K << " ? k+" << i << " : " << K - 1 << ";" << std::endl;
+				INDT_2 << type << " a" << i << " = k+" << i << " < " << K << " ? " << a("k" + std::to_string(i)) << " : 0;" << std::endl;
+			}
+		}
+		else {
+			for (int i = 0; i < ROWS; i++) {
+				INDT_2 << "uint32_t k" << i << " = k+" << i << ";" << std::endl;
+				INDT_2 << type << " a" << i << " = " << a("k" + std::to_string(i)) << ";" << std::endl;
+			}
+		}
+		INDT_2 << "for( uint32_t c=0; c<" << N << "; c++ )" << std::endl;
+		INDT_3 << y("c") << " += ";
+		for (int i = 0; i < ROWS; i++)
+			dst << (i ? " + " : "") << "a" << i << " * " << b("k" + std::to_string(i), "c");
+		dst << ";" << std::endl;
+		INDT_1 << "}" << std::endl;
+		if (alpha != 1 || (this->c && beta != 0)) {
+			INDT_1 << "for( uint32_t c=0; c<" << N << "; c++ ) {" << std::endl;
+			INDT_2 << type << " v = " << y("c") << ";" << std::endl;
+			print_store(dst, 2);
+			INDT_1 << "}" << std::endl;
+		}
+	}
+
+	// B stored as N rows of K: each output is the dot product of a row
+	// of B with A, ROWS rows at a time. The products are summed in LANES
+	// partial sums, so that the C compiler can vectorize the loop
+	// without reordering the sums itself.
+	void print_transposed(std::ostream& dst) const
+	{
+		int k_lanes = K / LANES * LANES;
+		INDT_1 << "/* GEMV: B read " << ROWS << " rows at a time */" << std::endl;
+		INDT_1 << "for( uint32_t n=0; n<" << N << "; n+=" << ROWS << " ) {" << std::endl;
+		// The rows past the end of B are calculated again from the last row
+		for (int i = 0; i < ROWS; i++)
+			INDT_2 << "uint32_t n" << i << " = n+" << i << " < " << N << " ? n+" << i << " : " << N - 1 << ";" << std::endl;
+		for (int i = 0; i < ROWS; i++)
+			INDT_2 << type << " acc" << i << "[" << LANES << "] = {0};" << std::endl;
+		if (k_lanes > 0) {
+			INDT_2 << "for( uint32_t k0=0; k0<" << k_lanes << "; k0+=" << LANES << " )" << std::endl;
+			INDT_2 << "for( uint32_t j=0; j<" << LANES << "; j++ ) {" << std::endl;
+			INDT_3 << "uint32_t k = k0+j;" << std::endl;
+			INDT_3 << type << " a = " << a("k") << ";" << std::endl;
+			for (int i = 0; i < ROWS; i++)
+				INDT_3 << "acc" << i << "[j] += a * " << b("k", "n" + std::to_string(i)) << ";" << std::endl;
+			INDT_2 << "}" << std::endl;
+		}
+		if (k_lanes < K) {
+			INDT_2 << "for( uint32_t k=" << k_lanes << "; k<" << K << "; k++ ) {" << std::endl;
+			INDT_3 << type << " a = " << a("k") << ";" << std::endl;
+			for (int i = 0; i < ROWS; i++)
+				INDT_3 << "acc" << i << "[0] += a * " << b("k", "n" + std::to_string(i)) << ";" << std::endl;
+			INDT_2 << "}" << std::endl;
+		}
+		for (int i = 0; i < ROWS; i++) {
+			INDT_2 << "if( n+" << i << " < " << N << " ) {" << std::endl;
+			INDT_3 << "uint32_t c = n+" << i << ";" << std::endl;
+			INDT_3 << type << " v = 0;" << std::endl;
+			INDT_3 << "for( uint32_t j=0; j<" << LANES << "; j++ )" << std::endl;
+			INDT_4 << "v += acc" << i << "[j];" << std::endl;
+			print_store(dst, 3);
+			INDT_2 << "}" << std::endl;
+		}
+		INDT_1 << "}" << std::endl;
+	}
+};
+} // namespace toC
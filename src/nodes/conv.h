@@ -5,6 +5,10 @@
  */
 
 #include "spatialfilter.h"
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <sstream>
 namespace toC {
 
 class Conv : public SpatialFilter {
@@ -14,9 +18,86 @@ class Conv : public SpatialFilter {
 		op_name = "Conv";
 	}
 
+	// Set by the 'im2col' optimization pass. The input patches of this many
+	// rows of outputs at a time are packed into the columns of a scratch
+	// tensor 'col' (the node's second output), and multiplied with the
+	// weights as a blocked GEMM. Zero for the direct loops.
+	int im2col_rows = 0;
+
+	// Set by the 'winograd' optimization pass. The weights are already
+	// transformed to the Winograd domain, (M x C x 4 x 4), and the node
+	// calculates its 3x3 stride 1 convolution as F(2x2,3x3) tiles.
+	// The transformed input tiles of all channels are kept in a scratch
+	// tensor 'v' (the node's second output).
+	bool winograd = false;
+
+	// Set by the 'register_blocking' optimization pass. The outputs are
+	// calculated in tiles of this many output channels times this many
+	// consecutive outputs along the last data dimension, in local
+	// accumulators. Zero for the untiled loops.
+	int tile_maps = 0;
+	int tile_pixels = 0;
+
+	// Set by the 'fuse_conv_activation' optimization pass: a Relu, or a Clip
+	// with constant limits, after the Conv. The outputs are clamped to
+	// [clip_min, clip_max] when they are written. Either limit may be infinite.
+	bool fused_clip = false;
+	float clip_min = -INFINITY;
+	float clip_max = INFINITY;
+
+	// The expression e with the fused activation applied.
+	// e is evaluated more than once, so it must not have side effects.
+	std::string clipped(std::string e) const
+	{
+		std::ostringstream rv;
+		if (fused_clip == false)
+			return e;
+		// The limits are printed with all the digits needed to read back
+		// the same float, so the outputs match those of the unfused Clip
+		rv << std::scientific << std::setprecision(std::numeric_limits<float>::max_digits10 - 1);
+		if (e.find(' ') != std::string::npos)
+			e = "(" + e + ")"; // the MIN and MAX macros don't parenthesize
+		if (std::isinf(clip_min) == false && std::isinf(clip_max) == false)
+			rv << "MAX( MIN( " << e << ", " << clip_max << "f), " << clip_min << "f)";
+		else if (std::isinf(clip_min) == false)
+			rv << "MAX( " << e << ", " << clip_min << "f)";
+		else if (std::isinf(clip_max) == false)
+			rv << "MIN( " << e << ", " << clip_max << "f)";
+		else
+			rv << e;
+		return rv.str();
+	}
+
+	// Each output channel is filtered from the input channel of the same index
+	// only, so the generic loops would have a single iteration channel loop.
+	bool is_depthwise(void) const
+	{
+		if (pool_op != "" || channels_last || get_numDataDim() != 2)
+			return false;
+		return group > 1 && group == get_channel_dim(get_X()) && group == get_channel_dim(get_Y());
+	}
+
+	// A 1x1 kernel over all of the input, i.e. a product of the weights and
+	// the input channels as a matrix of channels x spatial positions
+	bool is_pointwise(void) const
+	{
+		if (pool_op != "" || channels_last || get_numDataDim() == 0)
+			return false;
+		if (get_X()->data_type != onnx::TensorProto_DataType_FLOAT && get_X()->data_type != onnx::TensorProto_DataType_DOUBLE)
+			return false;
+		for (unsigned i = 0; i < get_numDataDim(); i++)
+			if (kernel_shape[i] != 1 || strides[i] != 1 || pads[i] != 0 || pads[i + get_numDataDim()] != 0)
+				return false;
+		return true;
+	}
+
 	virtual void print_output_cell_init(std::ostream& dst, const std::string& y_idx) const override
 	{
-		INDT_3 << "y" << y_idx << " = ";
+		if (pool_op != "")
+			INDT_3 << get_Y()->data_type_str() << " ";
+		else
+			INDT_3;
+		dst << output_cell(y_idx) << " = ";
 		if (get_number_of_inputs() < 3) // bias is the 3rd input, optional
 			dst << "0;" << std::endl;
 		else
@@ -28,15 +109,443 @@ class Conv : public SpatialFilter {
 	    const std::string& w_idx,
 	    const std::string& y_idx) const override
 	{
-		INDT_4 << "y" << y_idx << " += x" << x_idx << " * w" << w_idx << ";" << std::endl;
+		INDT_4 << output_cell(y_idx) << " += x" << x_idx << " * w" << w_idx << ";" << std::endl;
 	}
 	virtual void print_output_cell_finalize(std::ostream& dst, const std::string& y_idx) const override
 	{
+		if (fused_clip)
+			INDT_3 << output_cell(y_idx) << " = " << clipped(output_cell(y_idx)) << ";" << std::endl;
 	}
 	virtual void print(std::ostream& dst) const override
 	{
 		print_header_info_comment(dst);
-		print_loop_with_padding_checks(dst);
+		if (fused_clip)
+			INDT_1 << "/* fused activation: " << clipped("y") << " */" << std::endl;
+		if (winograd)
+			print_winograd(dst);
+		else if (im2col_rows > 0)
+			print_im2col(dst);
+		else if (tile_maps > 0)
+			print_register_blocked(dst);
+		else if (is_depthwise())
+			print_depthwise(dst);
+		else if (is_pointwise())
+			print_pointwise(dst);
+		else
+			print_loop_with_padding_checks(dst);
+	}
+
+	/* Depthwise convolution: the loop over channels is the outermost one, so
+	 * the kernel and the bias of a channel are loaded once, and the innermost
+	 * loop runs along an output row. In the interior, where the kernel doesn't
+	 * reach the paddings, kernels of up to 5x5 are unrolled into a single
+	 * expression that reads consecutive inputs for consecutive outputs. */
+	void print_depthwise(std::ostream& dst) const
+	{
+		std::string type = get_X()->data_type_str();
+		bool unroll = kernel_shape[0] <= 5 && kernel_shape[1] <= 5;
+
+		INDT_1 << "for( uint32_t b=0; b<" << get_X()->data_dim[0] << "; b++ )" << std::endl;
+		INDT_1 << "for( uint32_t c=0; c<" << group << "; c++ ) {" << std::endl;
+		if (unroll)
+			for (int k0 = 0; k0 < kernel_shape[0]; k0++)
+				for (int k1 = 0; k1 < kernel_shape[1]; k1++)
+					INDT_2 << "const " << type << " w" << k0 << "_" << k1 << " = w[c][0][" << k0 << "][" << k1 << "];" << std::endl;
+		INDT_2 << "const " << type << " bc = " << (get_number_of_inputs() < 3 ? "0" : "bias[c]") << ";" << std::endl;
+		print_regions(dst, [&](const std::vector<int>& begin, const std::vector<int>& end) {
+			print_depthwise_region(dst, begin, end, unroll);
+		});
+		INDT_1 << "} /* c */" << std::endl;
+	}
+
+	void print_depthwise_region(std::ostream& dst, const std::vector<int>& begin, const std::vector<int>& end, bool unroll) const
+	{
+		std::string type = get_X()->data_type_str();
+		std::vector<std::string> conds;
+		for (unsigned i = 0; i < 2; i++) {
+			std::string i_str = std::to_string(i);
+			INDT_2 << "for( int32_t o" << i_str << "=" << begin[i] << ", i" << i_str << "=" << -pads[i] + begin[i] * strides[i] << "; ";
+			dst << "o" << i_str << "<" << end[i] << "; o" << i_str << "++, i" << i_str << "+=" << strides[i] << " )";
+			dst << (i == 1 ? " {" : "") << std::endl;
+
+			int min_ii = -pads[i] + begin[i] * strides[i];
+			int max_ii = -pads[i] + (end[i] - 1) * strides[i] + (kernel_shape[i] - 1) * dilations[i];
+			if (min_ii < 0)
+				conds.push_back("ii" + i_str + " >= 0");
+			if (max_ii >= get_spatial_dim(get_X(), i))
+				conds.push_back("ii" + i_str + " < " + std::to_string(get_spatial_dim(get_X(), i)));
+		}
+
+		INDT_3 << type << " acc = bc";
+		if (conds.size() == 0 && unroll) {
+			for (int k0 = 0; k0 < kernel_shape[0]; k0++)
+				for (int k1 = 0; k1 < kernel_shape[1]; k1++) {
+					int d0 = k0 * dilations[0], d1 = k1 * dilations[1];
+					dst << std::endl;
+					INDT_4 << "+ w" << k0 << "_" << k1 << " * x[b][c][i0";
+					if (d0 > 0)
+						dst << "+" << d0;
+					dst << "][i1";
+					if (d1 > 0)
+						dst << "+" << d1;
+					dst << "]";
+				}
+			dst << ";" << std::endl;
+		}
+		else {
+			dst << ";" << std::endl;
+			INDT_3 << "for( int32_t k0=0; k0<" << kernel_shape[0] << "; k0++ )" << std::endl;
+			INDT_3 << "for( int32_t k1=0; k1<" << kernel_shape[1] << "; k1++ ) {" << std::endl;
+			INDT_4 << "int32_t ii0 = i0 + k0*" << dilations[0] << ";" << std::endl;
+			INDT_4 << "int32_t ii1 = i1 + k1*" << dilations[1] << ";" << std::endl;
+			if (conds.size() > 0) {
+				INDT_4 << "if( ";
+				for (unsigned i = 0; i < conds.size(); i++)
+					dst << (i > 0 ? " && " : "") << conds[i];
+				dst << " )" << std::endl;
+				INDT_5;
+			}
+			else
+				INDT_4;
+			dst << "acc += w[c][0][k0][k1] * x[b][c][ii0][ii1];" << std::endl;
+			INDT_3 << "}" << std::endl;
+		}
+		INDT_3 << "y[b][c][o0][o1] = " << clipped("acc") << ";" << std::endl;
+		INDT_2 << "} /* o */" << std::endl;
+	}
+
+	/* Register blocked direct convolution: a tile of output channels times
+	 * consecutive outputs along the last data dimension is accumulated in
+	 * local variables. Each input value loaded is used for all the channels
+	 * of the tile, and each weight for all the outputs of the tile.
+	 * Partial tiles at the ends are calculated in full, with the weights of
+	 * the last channel and the inputs past the end read as zeros, but only
+	 * the valid outputs are written. */
+	void print_register_blocked(std::ostream& dst) const
+	{
+		unsigned n_data_dims = get_numDataDim();
+		unsigned last = n_data_dims - 1;
+		std::string type = get_X()->data_type_str();
+		int group_maps = get_channel_dim(get_Y()) / group;
+		int group_channels = get_channel_dim(get_X()) / group;
+		int out_last = get_spatial_dim(get_Y(), last);
+		bool partial_maps = group_maps % tile_maps != 0;
+		bool partial_pixels = out_last % tile_pixels != 0;
+
+		std::string m = "m0+i";
+		if (partial_maps)
+			m = "(m0+i < " + std::to_string(group_maps) + " ? m0+i : " + std::to_string(group_maps - 1) + ")";
+		if (group > 1)
+			m = "g*" + std::to_string(group_maps) + " + " + m;
+		std::string c = group > 1 ? "g*" + std::to_string(group_channels) + "+c" : "c";
+		std::string x_idx = "[b][" + c + "]", w_idx = "[m][c]", y_idx = "[b][m]";
+		for (unsigned d = 0; d < last; d++) {
+			x_idx += "[ii" + std::to_string(d) + "]";
+			y_idx += "[o" + std::to_string(d) + "]";
+		}
+		for (unsigned d = 0; d < n_data_dims; d++)
+			w_idx += "[k" + std::to_string(d) + "]";
+		x_idx += "[ii" + std::to_string(last) + "]";
+		y_idx += "[o" + std::to_string(last) + "+j]";
+
+		INDT_1 << "/* register blocked: " << tile_maps << " output channels x " << tile_pixels
+		       << " outputs along the last dimension at a time */" << std::endl;
+		INDT_1 << "for( uint32_t b=0; b<" << get_X()->data_dim[0] << "; b++ )" << std::endl;
+		if (group > 1)
+			INDT_1 << "for( uint32_t g=0; g<" << group << "; g++ )" << std::endl;
+		INDT_1 << "for( uint32_t m0=0; m0<" << group_maps << "; m0+=" << tile_maps << " )" << std::endl;
+		for (unsigned d = 0; d < last; d++) {
+			std::string d_str = std::to_string(d);
+			INDT_1 << "for( int32_t o" << d_str << "=0, i" << d_str << "=" << -pads[d] << "; o" << d_str << "<"
+			       << get_spatial_dim(get_Y(), d) << "; o" << d_str << "++, i" << d_str << "+=" << strides[d] << " )" << std::endl;
+		}
+		INDT_1 << "for( int32_t o" << last << "=0; o" << last << "<" << out_last << "; o" << last << "+=" << tile_pixels << " ) {" << std::endl;
+
+		INDT_2 << type << " acc[" << tile_maps << "][" << tile_pixels << "];" << std::endl;
+		INDT_2 << "for( uint32_t i=0; i<" << tile_maps << "; i++ )" << std::endl;
+		INDT_2 << "for( uint32_t j=0; j<" << tile_pixels << "; j++ )" << std::endl;
+		INDT_3 << "acc[i][j] = " << (get_number_of_inputs() < 3 ? "0" : "bias[" + m + "]") << ";" << std::endl;
+
+		INDT_2 << "for( uint32_t c=0; c<" << group_channels << "; c++ )" << std::endl;
+		for (unsigned d = 0; d < n_data_dims; d++) {
+			std::string d_str = std::to_string(d);
+			INDT_2 << "for( int32_t k" << d_str << "=0; k" << d_str << "<" << kernel_shape[d] << "; k" << d_str << "++ ) {" << std::endl;
+			if (d == last)
+				break;
+			INDT_3 << "int32_t ii" << d_str << " = i" << d_str << " + k" << d_str << "*" << dilations[d] << ";" << std::endl;
+			std::vector<std::string> conds;
+			int max_ii = (get_spatial_dim(get_Y(), d) - 1) * strides[d] - pads[d] + (kernel_shape[d] - 1) * dilations[d];
+			if (pads[d] > 0)
+				conds.push_back("ii" + d_str + " < 0");
+			if (max_ii >= get_spatial_dim(get_X(), d))
+				conds.push_back("ii" + d_str + " >= " + std::to_string(get_spatial_dim(get_X(), d)));
+			if (conds.size() > 0) {
+				INDT_3 << "if( ";
+				for (unsigned i = 0; i < conds.size(); i++)
+					dst << (i > 0 ? " || " : "") << conds[i];
+				dst << " ) continue;" << std::endl;
+			}
+		}
+
+		// Load the inputs under the kernel position for the outputs of the tile
+		std::string l_str = std::to_string(last);
+		int max_ii = ((out_last + tile_pixels - 1) / tile_pixels * tile_pixels - 1) * strides[last] - pads[last]
+		           + (kernel_shape[last] - 1) * dilations[last];
+		std::vector<std::string> conds;
+		if (pads[last] > 0)
+			conds.push_back("ii" + l_str + " >= 0");
+		if (max_ii >= get_spatial_dim(get_X(), last))
+			conds.push_back("ii" + l_str + " < " + std::to_string(get_spatial_dim(get_X(), last)));
+		INDT_3 << type << " xv[" << tile_pixels << "];" << std::endl;
+		INDT_3 << "for( uint32_t j=0; j<" << tile_pixels << "; j++ ) {" << std::endl;
+		INDT_4 << "int32_t ii" << l_str << " = (o" << l_str << "+j)*" << strides[last] << " - " << pads[last]
+		       << " + k" << l_str << "*" << dilations[last] << ";" << std::endl;
+		INDT_4 << "xv[j] = ";
+		for (unsigned i = 0; i < conds.size(); i++)
+			dst << (i > 0 ? " && " : "") << conds[i];
+		dst << (conds.size() > 0 ? " ? x" + x_idx + " : 0;" : "x" + x_idx + ";") << std::endl;
+		INDT_3 << "}" << std::endl;
+
+		INDT_3 << "for( uint32_t i=0; i<" << tile_maps << "; i++ ) {" << std::endl;
+		INDT_4 << "uint32_t m = " << m << ";" << std::endl;
+		INDT_4 << type << " wv = w" << w_idx << ";" << std::endl;
+		INDT_4 << "for( uint32_t j=0; j<" << tile_pixels << "; j++ )" << std::endl;
+		INDT_5 << "acc[i][j] += wv * xv[j];" << std::endl;
+		INDT_3 << "}" << std::endl;
+		for (unsigned d = 0; d < n_data_dims; d++)
+			INDT_2 << "} /* k */" << std::endl;
+
+		INDT_2 << "for( uint32_t i=0; i<" << tile_maps << "; i++ ) {" << std::endl;
+		if (partial_maps)
+			INDT_3 << "if( m0+i >= " << group_maps << " ) break;" << std::endl;
+		INDT_3 << "uint32_t m = " << (group > 1 ? "g*" + std::to_string(group_maps) + " + m0+i" : "m0+i") << ";" << std::endl;
+		INDT_3 << "for( uint32_t j=0; j<" << tile_pixels << "; j++ )" << std::endl;
+		if (partial_pixels) {
+			INDT_4 << "if( o" << l_str << "+j < " << out_last << " )" << std::endl;
+			INDT_5;
+		}
+		else
+			INDT_4;
+		dst << "y" << y_idx << " = " << clipped("acc[i][j]") << ";" << std::endl;
+		INDT_2 << "}" << std::endl;
+		INDT_1 << "} /* tiles */" << std::endl;
+	}
+
+	/* Pointwise convolution: the input of each group already is the
+	 * (input channels x spatial positions) matrix that im2col would pack,
+	 * so the weights are multiplied with it directly. */
+	void print_pointwise(std::ostream& dst) const
+	{
+		std::string type = get_X()->data_type_str();
+		int channels = get_channel_dim(get_X());
+		int group_channels = channels / group;
+		int num_positions = get_X()->data_num_elem() / get_X()->data_dim[0] / channels;
+		std::string c = group > 1 ? "g*" + std::to_string(group_channels) + " + k" : "k";
+
+		INDT_1 << "/* pointwise: a GEMM of the weights and the input channels */" << std::endl;
+		INDT_1 << "const " << type << " *wf = (const " << type << "*)w;" << std::endl;
+		INDT_1 << "const " << type << " *xf = (const " << type << "*)x;" << std::endl;
+		INDT_1 << type << " *yf = (" << type << "*)y;" << std::endl;
+		INDT_1 << "for( uint32_t b=0; b<" << get_X()->data_dim[0] << "; b++ ) {" << std::endl;
+		INDT_1 << "for( uint32_t g=0; g<" << group << "; g++ ) {" << std::endl;
+		print_gemm_blocks(dst, group_channels, std::to_string(num_positions),
+		                  "xf[(b*" + std::to_string(channels) + " + " + c + ")*" + std::to_string(num_positions) + " + p0+j]", "");
+		INDT_1 << "} /* g */" << std::endl;
+		INDT_1 << "} /* b */" << std::endl;
+	}
+
+	void print_winograd(std::ostream& dst) const
+	{
+		std::string type = get_X()->data_type_str();
+		int channels = get_channel_dim(get_X());
+		int height = get_spatial_dim(get_X(), 0), width = get_spatial_dim(get_X(), 1);
+		int out_height = get_spatial_dim(get_Y(), 0), out_width = get_spatial_dim(get_Y(), 1);
+
+		// Only read outside the input on the sides the tiles can reach over
+		std::vector<std::string> conds;
+		if (pads[0] > 0)
+			conds.push_back("ii0 >= 0");
+		if ((out_height + 1) / 2 * 2 + 2 - pads[0] > height)
+			conds.push_back("ii0 < " + std::to_string(height));
+		if (pads[1] > 0)
+			conds.push_back("ii1 >= 0");
+		if ((out_width + 1) / 2 * 2 + 2 - pads[1] > width)
+			conds.push_back("ii1 < " + std::to_string(width));
+
+		INDT_1 << "/* Winograd F(2x2,3x3): the weights were transformed to U = G w G^T at compile time." << std::endl;
+		INDT_1 << " * Each 2x2 tile of outputs is A^T [sum over c of U[m][c] * B^T d[c] B] A," << std::endl;
+		INDT_1 << " * where d[c] is the 4x4 tile of input channel c under it. */" << std::endl;
+		INDT_1 << "for( uint32_t b=0; b<" << get_X()->data_dim[0] << "; b++ )" << std::endl;
+		INDT_1 << "for( int32_t th=0; th<" << (out_height + 1) / 2 << "; th++ )" << std::endl;
+		INDT_1 << "for( int32_t tw=0; tw<" << (out_width + 1) / 2 << "; tw++ ) {" << std::endl;
+
+		INDT_2 << "for( uint32_t c=0; c<" << channels << "; c++ ) {" << std::endl;
+		INDT_3 << type << " d[4][4], t[4][4];" << std::endl;
+		INDT_3 << "for( int32_t r=0; r<4; r++ )" << std::endl;
+		INDT_3 << "for( int32_t s=0; s<4; s++ ) {" << std::endl;
+		INDT_4 << "int32_t ii0 = th*2 + r - " << pads[0] << ";" << std::endl;
+		INDT_4 << "int32_t ii1 = tw*2 + s - " << pads[1] << ";" << std::endl;
+		if (conds.size() > 0) {
+			INDT_4 << "d[r][s] = ";
+			for (unsigned i = 0; i < conds.size(); i++)
+				dst << (i > 0 ? " && " : "") << conds[i];
+			dst << " ? x[b][c][ii0][ii1] : 0;" << std::endl;
+		}
+		else
+			INDT_4 << "d[r][s] = x[b][c][ii0][ii1];" << std::endl;
+		INDT_3 << "}" << std::endl;
+		INDT_3 << "for( int32_t s=0; s<4; s++ ) {" << std::endl;
+		INDT_4 << "t[0][s] = d[0][s] - d[2][s];" << std::endl;
+		INDT_4 << "t[1][s] = d[1][s] + d[2][s];" << std::endl;
+		INDT_4 << "t[2][s] = d[2][s] - d[1][s];" << std::endl;
+		INDT_4 << "t[3][s] = d[1][s] - d[3][s];" << std::endl;
+		INDT_3 << "}" << std::endl;
+		INDT_3 << "for( int32_t r=0; r<4; r++ ) {" << std::endl;
+		INDT_4 << "v[c][r][0] = t[r][0] - t[r][2];" << std::endl;
+		INDT_4 << "v[c][r][1] = t[r][1] + t[r][2];" << std::endl;
+		INDT_4 << "v[c][r][2] = t[r][2] - t[r][1];" << std::endl;
+		INDT_4 << "v[c][r][3] = t[r][1] - t[r][3];" << std::endl;
+		INDT_3 << "}" << std::endl;
+		INDT_2 << "} /* c */" << std::endl;
+
+		INDT_2 << "for( uint32_t m=0; m<" << get_channel_dim(get_Y()) << "; m++ ) {" << std::endl;
+		INDT_3 << type << " acc[4][4] = {{0}};" << std::endl;
+		INDT_3 << type << " t[2][4];" << std::endl;
+		INDT_3 << "for( uint32_t c=0; c<" << channels << "; c++ )" << std::endl;
+		INDT_3 << "for( int32_t r=0; r<4; r++ )" << std::endl;
+		INDT_3 << "for( int32_t s=0; s<4; s++ )" << std::endl;
+		INDT_4 << "acc[r][s] += w[m][c][r][s] * v[c][r][s];" << std::endl;
+		INDT_3 << "for( int32_t s=0; s<4; s++ ) {" << std::endl;
+		INDT_4 << "t[0][s] = acc[0][s] + acc[1][s] + acc[2][s];" << std::endl;
+		INDT_4 << "t[1][s] = acc[1][s] - acc[2][s] - acc[3][s];" << std::endl;
+		INDT_3 << "}" << std::endl;
+		std::string bias = get_number_of_inputs() < 3 ? "" : " + bias[m]";
+		INDT_3 << "for( int32_t r=0; r<2; r++ ) {" << std::endl;
+		INDT_4 << "int32_t o0 = th*2 + r;" << std::endl;
+		if (out_height % 2)
+			INDT_4 << "if( o0 == " << out_height << " ) break;" << std::endl;
+		INDT_4 << "y[b][m][o0][tw*2] = " << clipped("t[r][0] + t[r][1] + t[r][2]" + bias) << ";" << std::endl;
+		if (out_width % 2) {
+			INDT_4 << "if( tw*2+1 < " << out_width << " )" << std::endl;
+			INDT_5;
+		}
+		else
+			INDT_4;
+		dst << "y[b][m][o0][tw*2+1] = " << clipped("t[r][1] - t[r][2] - t[r][3]" + bias) << ";" << std::endl;
+		INDT_3 << "}" << std::endl;
+		INDT_2 << "} /* m */" << std::endl;
+		INDT_1 << "} /* tiles */" << std::endl;
+	}
+
+	void print_im2col(std::ostream& dst) const
+	{
+		unsigned n_data_dims = get_numDataDim();
+		std::string type = get_X()->data_type_str();
+		int group_channels = get_channel_dim(get_X()) / group;
+		int row_positions = 1; // output positions of one output row, i.e. o0 value
+		int patch_size = group_channels;
+		for (unsigned i = 0; i < n_data_dims; i++) {
+			if (i > 0)
+				row_positions *= get_spatial_dim(get_Y(), i);
+			patch_size *= kernel_shape[i];
+		}
+
+		INDT_1 << "/* im2col: the input patches of " << im2col_rows << " output rows at a time are packed" << std::endl;
+		INDT_1 << " * into the columns of 'col', and multiplied with the weights */" << std::endl;
+		INDT_1 << "const " << type << " *wf = (const " << type << "*)w;" << std::endl;
+		INDT_1 << type << " *yf = (" << type << "*)y;" << std::endl;
+		INDT_1 << "for( uint32_t b=0; b<" << get_X()->data_dim[0] << "; b++ ) {" << std::endl;
+		INDT_1 << "for( uint32_t g=0; g<" << group << "; g++ ) {" << std::endl;
+		INDT_1 << "for( int32_t t=0; t<" << get_spatial_dim(get_Y(), 0) << "; t+=" << im2col_rows << " ) {" << std::endl;
+		INDT_2 << "int32_t rows = " << get_spatial_dim(get_Y(), 0) << "-t < " << im2col_rows << " ? "
+		       << get_spatial_dim(get_Y(), 0) << "-t : " << im2col_rows << ";" << std::endl;
+		INDT_2 << "uint32_t np = rows * " << row_positions << ";" << std::endl;
+
+		// Pack the patches: one row of 'col' per input channel and kernel position
+		INDT_2 << "uint32_t kr = 0;" << std::endl;
+		INDT_2 << "for( uint32_t c=0; c<" << group_channels << "; c++ )" << std::endl;
+		for (unsigned i = 0; i < n_data_dims; i++)
+			INDT_2 << "for( int32_t k" << i << "=0; k" << i << "<" << kernel_shape[i] << "; k" << i << "++ )" << std::endl;
+		INDT_2 << "{" << std::endl;
+		INDT_3 << "uint32_t p = 0;" << std::endl;
+		for (unsigned i = 0; i < n_data_dims; i++) {
+			std::string o = "o" + std::to_string(i);
+			if (i == 0)
+				INDT_3 << "for( int32_t o0=t; o0<t+rows; o0++ )" << std::endl;
+			else
+				INDT_3 << "for( int32_t " << o << "=0; " << o << "<" << get_spatial_dim(get_Y(), i) << "; " << o << "++ )" << std::endl;
+		}
+		INDT_3 << "{" << std::endl;
+		std::vector<std::string> conds;
+		std::string x_idx = "[b][" + std::string(group > 1 ? "g*" + std::to_string(group_channels) + "+c" : "c") + "]";
+		for (unsigned i = 0; i < n_data_dims; i++) {
+			std::string i_str = std::to_string(i);
+			INDT_4 << "int32_t ii" << i_str << " = o" << i_str << "*" << strides[i] << " - " << pads[i]
+			       << " + k" << i_str << "*" << dilations[i] << ";" << std::endl;
+			x_idx += "[ii" + i_str + "]";
+			// Only check the sides the patches can reach over
+			int max_ii = (get_spatial_dim(get_Y(), i) - 1) * strides[i] - pads[i] + (kernel_shape[i] - 1) * dilations[i];
+			if (pads[i] > 0)
+				conds.push_back("ii" + i_str + " >= 0");
+			if (max_ii >= get_spatial_dim(get_X(), i))
+				conds.push_back("ii" + i_str + " < " + std::to_string(get_spatial_dim(get_X(), i)));
+		}
+		if (conds.size() > 0) {
+			INDT_4 << "if( ";
+			for (unsigned i = 0; i < conds.size(); i++)
+				dst << (i > 0 ? " && " : "") << conds[i];
+			dst << " )" << std::endl;
+			INDT_5 << "col[kr][p] = x" << x_idx << ";" << std::endl;
+			INDT_4 << "else" << std::endl;
+			INDT_5 << "col[kr][p] = 0;" << std::endl;
+		}
+		else
+			INDT_4 << "col[kr][p] = x" << x_idx << ";" << std::endl;
+		INDT_4 << "p++;" << std::endl;
+		INDT_3 << "}" << std::endl;
+		INDT_3 << "kr++;" << std::endl;
+		INDT_2 << "}" << std::endl;
+
+		print_gemm_blocks(dst, patch_size, "np", "col[k][p0+j]", "t*" + std::to_string(row_positions) + " + ");
+		INDT_1 << "} /* t */" << std::endl;
+		INDT_1 << "} /* g */" << std::endl;
+		INDT_1 << "} /* b */" << std::endl;
+	}
+
+	/* Print the GEMM of group g's weights (output channels x k_size) and a
+	 * (k_size x n) matrix, whose element [k][p0+j] is b_elem. The result is
+	 * written to the output positions from y_pos on. The blocks of outputs
+	 * are small enough to keep the accumulators in registers. */
+	void print_gemm_blocks(std::ostream& dst, int k_size, const std::string& n, const std::string& b_elem, const std::string& y_pos) const
+	{
+		// Block sizes of the GEMM: output channels x output positions
+		const int MB = 4, NB = 32;
+		std::string type = get_X()->data_type_str();
+		int maps = get_channel_dim(get_Y());
+		int group_maps = maps / group;
+		int num_positions = get_Y()->data_num_elem() / get_Y()->data_dim[0] / maps;
+
+		std::string m_base = group > 1 ? "g*" + std::to_string(group_maps) + "+m0+i" : "m0+i";
+		INDT_2 << "for( uint32_t m0=0; m0<" << group_maps << "; m0+=" << MB << " ) {" << std::endl;
+		INDT_2 << "uint32_t mb = " << group_maps << "-m0 < " << MB << " ? " << group_maps << "-m0 : " << MB << ";" << std::endl;
+		INDT_2 << "for( uint32_t p0=0; p0<" << n << "; p0+=" << NB << " ) {" << std::endl;
+		INDT_3 << "uint32_t pb = " << n << "-p0 < " << NB << " ? " << n << "-p0 : " << NB << ";" << std::endl;
+		INDT_3 << type << " acc[" << MB << "][" << NB << "];" << std::endl;
+		INDT_3 << "for( uint32_t i=0; i<mb; i++ )" << std::endl;
+		INDT_3 << "for( uint32_t j=0; j<pb; j++ )" << std::endl;
+		INDT_4 << "acc[i][j] = " << (get_number_of_inputs() < 3 ? "0" : "bias[" + m_base + "]") << ";" << std::endl;
+		INDT_3 << "for( uint32_t k=0; k<" << k_size << "; k++ )" << std::endl;
+		INDT_3 << "for( uint32_t i=0; i<mb; i++ ) {" << std::endl;
+		INDT_4 << type << " wv = wf[(" << m_base << ")*" << k_size << " + k];" << std::endl;
+		INDT_4 << "for( uint32_t j=0; j<pb; j++ )" << std::endl;
+		INDT_5 << "acc[i][j] += wv * " << b_elem << ";" << std::endl;
+		INDT_3 << "}" << std::endl;
+		INDT_3 << "for( uint32_t i=0; i<mb; i++ )" << std::endl;
+		INDT_3 << "for( uint32_t j=0; j<pb; j++ )" << std::endl;
+		INDT_4 << "yf[(b*" << maps << " + " << m_base << ")*" << num_positions << " + " << y_pos
+		       << "p0+j] = " << clipped("acc[i][j]") << ";" << std::endl;
+		INDT_2 << "} /* p0 */" << std::endl;
+		INDT_2 << "} /* m0 */" << std::endl;
 	}
 
 	virtual void resolve(void) override
@@ -13,7 +13,7 @@
  *  - https://www.matthewzeiler.com/mattzeiler/deconvolutionalnetworks.pdf
  *
  *
- * In the end, what is implemented in this file is the algorithm described in:
+ * The scatter formulation of the algorithm is described in:
  * http://d2l.ai/chapter_computer-vision/transposed-conv.html
  *
   def trans_conv(X, K):
@@ -24,9 +24,15 @@
             Y[i: i + h, j: j + w] += X[i, j] * K
     return Y
  *
- * Since ONNX backend tests pass, this should be correct :)
+ * That adds to each output many times. What is implemented here is the
+ * same calculation turned around to gather the contributions of each
+ * output (the "sub-pixel" decomposition): with a stride s, the outputs
+ * split into s phases per data dimension, each of which is a regular
+ * convolution of X with every s'th element of the kernel. The outputs
+ * of the phases interleave in Y.
  */
 #include "convtranspose.h"
+#include <numeric>
 
 namespace toC {
 
@@ -248,119 +254,161 @@ void ConvTranspose::print_header_info_comment(std::ostream& dst) const
 	INDT_1 << " */" << std::endl;
 }
 
+// Expression "c + m*v" for the generated code, skipping the zero terms
+static std::string linear(int c, int m, const std::string& v)
+{
+	std::string term = m == 1 ? v : std::to_string(m) + "*" + v;
+	if (m == 0)
+		return std::to_string(c);
+	if (c == 0)
+		return term;
+	return std::to_string(c) + "+" + term;
+}
+
 /*
- * NB: the channel/map/group code is copied from SpatialFilter.
- * The ONNX backend test don't test it.
+ * The outputs are calculated one phase at a time. A phase is the outputs
+ * whose (output index + pad) has the same remainder modulo the stride in
+ * each data dimension. Each output gets exactly one value of its phase
+ * printed for it, and is written only once. No memset is needed, and the
+ * bias is where the sums start from.
  */
 void ConvTranspose::print_calculation(std::ostream& dst) const
 {
-	unsigned n_data_dims = x->data_dim.size() - 2;
+	unsigned n_data_dims = x->rank() - 2;
+	unsigned num_phases = 1;
+	for (auto s : strides)
+		num_phases *= s;
+
+	for (unsigned p = 0; p < num_phases; p++) {
+		std::vector<int> phase(n_data_dims);
+		unsigned rest = p;
+		for (int i = n_data_dims - 1; i >= 0; i--) {
+			phase[i] = rest % strides[i];
+			rest /= strides[i];
+		}
+		print_phase(dst, phase);
+	}
+}
+
+/*
+ * Print one phase as a regular convolution of x with the kernel taps
+ * that hit it. In data dimension i, the output
+ *   o = q*stride + phase - pad
+ * gets the kernel taps k with k*dilation = phase (mod stride). They are
+ *   k = k_first + j*k_step
+ * and read the inputs
+ *   x = q - e_first - j*e_step
+ * The taps are the same for all outputs of the phase, so they are
+ * resolved here, and the generated loops have constant bounds.
+ *
+ * The outputs of the phase along the last data dimension are summed in
+ * a local row, which is stored once at the end. For each input channel
+ * and tap, the row is updated from a contiguous row of x and a single
+ * weight. Only the taps of the other data dimensions need checks for
+ * reading past the edges of x, and they are done once for all channels.
+ *
+ * NB: groups are not supported, so each input channel c contributes to
+ * each map m.
+ */
+void ConvTranspose::print_phase(std::ostream& dst, const std::vector<int>& phase) const
+{
+	unsigned n_data_dims = x->rank() - 2;
+	unsigned last = n_data_dims - 1;
 	unsigned batch_size = x->data_dim[0];
 	unsigned channels = x->data_dim[1];
 	unsigned maps = y->data_dim[1];
+	std::string type = y->data_type_str();
 
-	// Create various indexing strings. This makes generating the loops much cleaner.
+	std::vector<int> q_first, q_end, k_first, k_step, e_first, e_step, taps;
+	bool has_taps = true;
+	for (unsigned i = 0; i < n_data_dims; i++) {
+		int s = strides[i];
+		int d = dilations[i];
+		int pad = pads[i];
+		int r = phase[i];
+		int kernel = kernel_shape[i];
+
+		// Outputs of this phase that are not cut off by the pads
+		q_first.push_back(pad > r ? (pad - r + s - 1) / s : 0);
+		q_end.push_back(std::max(0, (int)(output_shape[i] + pad - r + s - 1) / s));
+		if (q_end[i] <= q_first[i])
+			return;
+
+		// The taps repeat every s/gcd(s,d) kernel elements
+		int g = std::gcd(s, d);
+		int first = -1;
+		for (int k = 0; k < s / g && k < kernel; k++)
+			if ((k * d - r) % s == 0) {
+				first = k;
+				break;
+			}
+		k_first.push_back(first);
+		k_step.push_back(s / g);
+		e_first.push_back(first < 0 ? 0 : (first * d - r) / s);
+		e_step.push_back(d / g);
+		taps.push_back(first < 0 ? 0 : (kernel - first + s / g - 1) / (s / g));
+		if (taps[i] == 0)
+			has_taps = false;
+	}
+
+	int row_size = q_end[last] - q_first[last];
 	std::string x_idx = "[b][c]";
-	std::string w_idx = "[c][m]"; // TODO: in case of groups, change c to something else
+	std::string w_idx = "[c][m]";
 	std::string y_idx = "[b][m]";
-	for (unsigned i = 0; i < n_data_dims; i++) {
+	for (unsigned i = 0; i < last; i++) {
 		std::string i_str = std::to_string(i);
 		x_idx += "[i" + i_str + "]";
-		y_idx += "[o" + i_str + "]";
-		w_idx += "[k" + i_str + "]";
+		w_idx += "[" + linear(k_first[i], k_step[i], "j" + i_str) + "]";
+		y_idx += "[" + linear(phase[i] - pads[i], strides[i], "q" + i_str) + "]";
 	}
-
-	// clear output - required by the algorithm
-	INDT_1 << "memset(y, 0," << y->data_num_elem() * y->data_elem_size() << ");" << std::endl
-	       << std::endl;
-
-	// Create the loops over batches and maps (output channels).
-	INDT_1 << "for( uint32_t b=0; b<" << batch_size << "; b++ ) {" << std::endl;
-	INDT_1 << "for( uint32_t m=0; m<" << maps << "; m++) {" << std::endl;
-
-	// loop inputs
-	for (unsigned i = 0; i < n_data_dims; i++) {
-		std::string i_idx = "i" + std::to_string(i);
-		INDT_2 << "for( int32_t " << i_idx << "=0; ";
-		dst << i_idx << "<" << x->data_dim[2 + i] << "; ";
-		dst << i_idx << "++) {" << std::endl;
-	}
-
-	// Loop over input channels
-	INDT_3 << "for( int32_t c=0; c<" << channels << "; c++ ) {" << std::endl;
-
-	// Generate loops over outputs and kernel indices. Something like:
-	// "for ( k0=0, o0=0; k0<3; k0++, o0+=1){"
-	// This calculates the N-dimensional dot product of input and kernel.
-	//
-	// The oN variable can be negative here when using padding. The naming is a bit
-	// confusing. o (output) is an index to Y (the tensor that this node writes to)
-	// but the padding named 'pad' is applied to the output (and not to the
-	// input as in the "forwared" spatial filters). On top of this, there is the
-	// concept and attribute of 'output_pad', which seems to be used only to calculate
-	// the size of the output. I.e. 'pad's are excluded from the output, 'output_pad's
-	// are included.
-	for (unsigned i = 0; i < n_data_dims; i++) {
-		std::string k_idx = "k" + std::to_string(i);
-		std::string o_idx = "o" + std::to_string(i);
-		std::string i_idx = "i" + std::to_string(i);
-		std::string o_start = i_idx + "*" + std::to_string(strides[i]) + "-" + std::to_string(pads[i]);
-		std::string o_incr = o_idx + "+=" + std::to_string(dilations[i]);
-
-		INDT_3 << "for( int32_t " << k_idx << "=0, " << o_idx << "=" << o_start << "; ";
-		dst << k_idx << "<" << kernel_shape[i] << "; ";
-		dst << k_idx << "++, " << o_incr << ") {" << std::endl;
-	}
-
-	// Skip write if the index into Y is a padding
-	for (unsigned i = 0; i < n_data_dims; i++) {
-		std::string i_str = std::to_string(i);
-		INDT_4 << "if( o" << i_str << "<0) continue;" << std::endl;
-		INDT_4 << "if( o" << i_str << ">=" << output_shape[i] << ") continue;" << std::endl;
+	std::string l_str = std::to_string(last);
+	x_idx += "[q-off]";
+	w_idx += "[" + linear(k_first[last], k_step[last], "j" + l_str) + "]";
+	y_idx += "[" + linear(phase[last] - pads[last] + strides[last] * q_first[last], strides[last], "q") + "]";
+
+	INDT_1 << "/* phase";
+	for (int r : phase)
+		dst << " " << r;
+	dst << " */" << std::endl;
+	INDT_1 << "for( uint32_t b=0; b<" << batch_size << "; b++ )" << std::endl;
+	INDT_1 << "for( uint32_t m=0; m<" << maps << "; m++ )";
+	for (unsigned i = 0; i < last; i++) {
+		std::string q_idx = "q" + std::to_string(i);
+		dst << std::endl;
+		INDT_1 << "for( int32_t " << q_idx << "=" << q_first[i] << "; ";
+		dst << q_idx << "<" << q_end[i] << "; " << q_idx << "++ )";
 	}
+	dst << " {" << std::endl;
+	INDT_2 << type << " acc[" << row_size << "];" << std::endl;
+	INDT_2 << "for( int32_t q=0; q<" << row_size << "; q++ )" << std::endl;
+	INDT_3 << "acc[q] = " << (b ? "bias[m]" : "0") << ";" << std::endl;
 
-	// Do the actual calculation
-	INDT_4 << "y" << y_idx;
-	dst << " += x" << x_idx;
-	dst << " * w" << w_idx;
-	dst << ";" << std::endl;
-
-	// close kernel loop
-	for (unsigned i = 0; i < n_data_dims; i++)
-		INDT_3 << "} /* k */" << std::endl;
-
-	// close input channels loop when it is separate from output channels
-	INDT_3 << "} /* c */" << std::endl;
-
-	// close output loop
-	for (unsigned i = 0; i < n_data_dims; i++)
-		INDT_2 << "} /* o */" << std::endl;
-
-	// close loops over batches and output channels
-	INDT_1 << "} /* m */" << std::endl;
-	INDT_1 << "} /* b */" << std::endl;
-
-	// YK: bias should be added only once
-	if (b) {
-		// Create the loops over batches and maps (output channels).
-		INDT_1 << "for( uint32_t b=0; b<" << batch_size << "; b++ ) {" << std::endl;
-		INDT_2 << "for( uint32_t m=0; m<" << maps << "; m++) {" << std::endl;
-		for (unsigned i = 0; i < n_data_dims; i++) {
-			std::string i_str = std::to_string(i);
-			INDT_3 << "for( uint32_t o" << i_str << "=0; o" << i_str << "<" << output_shape[i] << "; o" << i_str << "++) {" << std::endl;
-		}
-		INDT_4 << "y" << y_idx;
-		dst << " += bias[m]";
-		dst << ";" << std::endl;
-
-		for (unsigned i = 0; i < n_data_dims; i++) {
+	if (has_taps) {
+		for (unsigned i = 0; i < last; i++) {
 			std::string i_str = std::to_string(i);
-			INDT_3 << "} /* o" << i_str << " */" << std::endl;
+			std::string j_idx = "j" + i_str;
+			INDT_2 << "for( int32_t " << j_idx << "=0; " << j_idx << "<" << taps[i] << "; " << j_idx << "++ ) {" << std::endl;
+			INDT_3 << "int32_t i" << i_str << " = q" << i_str << "-" << linear(e_first[i], e_step[i], "j" + i_str) << ";" << std::endl;
+			INDT_3 << "if( i" << i_str << "<0 || i" << i_str << ">=" << x->data_dim[2 + i] << " ) continue;" << std::endl;
 		}
-
-		INDT_2 << "} /* m */" << std::endl;
-		INDT_1 << "} /* b */" << std::endl;
+		// The row of x read by a tap is x[q-off], for the q it has inside x
+		std::string j_idx = "j" + l_str;
+		INDT_2 << "for( int32_t c=0; c<" << channels << "; c++ )" << std::endl;
+		INDT_2 << "for( int32_t " << j_idx << "=0; " << j_idx << "<" << taps[last] << "; " << j_idx << "++ ) {" << std::endl;
+		INDT_3 << "int32_t off = " << linear(e_first[last] - q_first[last], e_step[last], j_idx) << ";" << std::endl;
+		INDT_3 << "int32_t first = off > 0 ? off : 0;" << std::endl;
+		INDT_3 << "int32_t end = off+" << x->data_dim[2 + last] << " < " << row_size << " ? off+" << x->data_dim[2 + last] << " : " << row_size << ";" << std::endl;
+		INDT_3 << type << " weight = w" << w_idx << ";" << std::endl;
+		INDT_3 << "for( int32_t q=first; q<end; q++ )" << std::endl;
+		INDT_4 << "acc[q] += x" << x_idx << " * weight;" << std::endl;
+		INDT_2 << "}" << std::endl;
+		for (unsigned i = 0; i < last; i++)
+			INDT_2 << "} /* j */" << std::endl;
 	}
+
+	INDT_2 << "for( int32_t q=0; q<" << row_size << "; q++ )" << std::endl;
+	INDT_3 << "y" << y_idx << " = acc[q];" << std::endl;
+	INDT_1 << "} /* q */" << std::endl;
 }
 
 } // namespace toC
@@ -56,6 +56,7 @@ class ConvTranspose : public Node {
 	virtual void print(std::ostream& dst) const override;
 	void print_header_info_comment(std::ostream& dst) const;
 	void print_calculation(std::ostream& dst) const;
+	void print_phase(std::ostream& dst, const std::vector<int>& phase) const;
 };
 
 } // namespace toC
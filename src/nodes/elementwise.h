@@ -9,6 +9,7 @@ namespace toC {
 
 class Elementwise : public Node {
 	float alpha, beta, bias, gamma, lambd;
+	std::string approximate;
 
 	public:
 	Elementwise(std::string op)
@@ -16,6 +17,7 @@ class Elementwise : public Node {
 		op_name = op;
 		alpha = beta = gamma = bias = 0;
 		lambd = 0.5;
+		approximate = "none";
 
 		// TODO: use the double precision version of the arithmetics for
 		// double precision input. OTOH - who uses doubles on MCUs?
@@ -57,6 +59,11 @@ class Elementwise : public Node {
 			operation = [this](const std::string& x) { return math_func("erf") + "(" + x + ");"; };
 		else if (op == "Exp")
 			operation = [this](const std::string& x) { return math_func("exp") + "(" + x + ");"; };
+		else if (op == "Gelu")
+			operation = [this](const std::string& x) {
+				if (approximate == "tanh")
+					return "0.5f*"+x+"*(1+"+math_func("tanh")+"(0.7978845608028654f*("+x+"+0.044715f*"+x+"*"+x+"*"+x+")));";
+				return "0.5f*"+x+"*(1+"+math_func("erf")+"("+x+"*0.7071067811865476f));"; };
 		else if (op == "HardSigmoid") {
 			alpha = 0.2;
 			beta = 0.5;
@@ -137,6 +144,14 @@ class Elementwise : public Node {
 			operation = [this](const std::string& x) { return "" + x + "/(1+" + math_func("fabs") + "(" + x + "));"; };
 		else if (op == "Sqrt")
 			operation = [this](const std::string& x) { return math_func("sqrt") + "(" + x + ");"; };
+		else if (op == "Swish") {
+			// Not an ONNX operator. The fuse_decomposed optimization pass creates these
+			// from x*Sigmoid(x), i.e. SiLU, which is Swish with alpha=1.
+			alpha = 1.0;
+			operation = [this](const std::string& x) {
+				std::string a = std::to_string(alpha);
+				return x+"/(1+"+math_func("exp")+"(-"+a+"*"+x+"));"; };
+		}
 		else if (op == "Tan")
 			operation = [this](const std::string& x) { return math_func("tan") + "(" + x + ");"; };
 		else if (op == "Tanh")
@@ -171,6 +186,8 @@ class Elementwise : public Node {
 				gamma = parse_attribute_float(a);
 			else if (a.name() == "lambd") // sic - lambda? In the Shrink operator
 				lambd = parse_attribute_float(a);
+			else if (a.name() == "approximate") // Gelu
+				approximate = parse_attribute_string(a);
 
 			else
 				ERROR("unknown attribute");
@@ -7,6 +7,8 @@
  * C need not be of size A*B, but must be
  * 'unidirectionally broadcastable' to A*B.
  */
+#include "blockedgemm.h"
+
 namespace toC {
 
 class Gemm : public Node {
@@ -24,6 +26,11 @@ class Gemm : public Node {
 	int transA; // boolean for 'do the tranpose'
 	int transB;
 
+	// Set by the 'blocked_gemm' optimization pass
+	bool blocked = false;
+	bool gemv = false; // A is a single row
+	bool prepacked_b = false; // B is packed by BlockedGemm::pack_b()
+
 	/* Parse attributes, if this node has them. */
 	virtual void parseAttributes(onnx::NodeProto& node) override
 	{
@@ -59,9 +66,10 @@ class Gemm : public Node {
 			}
 		}
 
-		int M = transA ? A->data_dim[1] : A->data_dim[0]; // row
+		const Tensor* Y = get_output_tensor(0);
+		int M = Y->data_dim[0]; // row
 		int K = transA ? A->data_dim[0] : A->data_dim[1]; // inner
-		int N = transB ? B->data_dim[0] : B->data_dim[1]; // column
+		int N = Y->data_dim[1]; // column
 		std::string type = A->data_type_str();
 
 		// Documentation if someone is reading the code
@@ -72,13 +80,6 @@ class Gemm : public Node {
 		dst << "\t   transB  = " << transB << std::endl;
 		dst << "\t */" << std::endl;
 
-		// Helper variables to make the code (both this and generated) cleaner
-		dst << "\t" << "const int M = " << M << ";" << std::endl;
-		dst << "\t" << "const int K = " << K << ";" << std::endl;
-		dst << "\t" << "const int N = " << N << ";" << std::endl;
-		dst << "\t" << "float alpha = " << alpha << ";" << std::endl;
-		dst << "\t" << "float beta = " << beta << ";" << std::endl;
-
 		std::string A_el = transA ? "A[i][r]" : "A[r][i]";
 		std::string B_idx = transB ? "[c][i]" : "[i][c]";
 
@@ -128,6 +129,60 @@ class Gemm : public Node {
 			INDT_1 << type << " (*C_)[" << C1 << "]  = (" << type << "(*)[" << C1 << "])C;" << std::endl;
 		}
 
+		BlockedGemm::Element A_at = [this](const std::string& r, const std::string& c) {
+			return transA ? "A[" + c + "][" + r + "]" : "A[" + r + "][" + c + "]";
+		};
+		BlockedGemm::Element B_at = [this](const std::string& r, const std::string& c) {
+			return transB ? "B[" + c + "][" + r + "]" : "B[" + r + "][" + c + "]";
+		};
+		BlockedGemm::Element C_at = [C0, C1](const std::string& r, const std::string& c) {
+			return "C_[" + (C0 <= 1 ? "0" : r) + "][" + (C1 <= 1 ? "0" : c) + "]";
+		};
+
+		if (gemv) {
+			BlockedGemv matvec;
+			matvec.N = N;
+			matvec.K = K;
+			matvec.type = type;
+			matvec.a = [A_at](const std::string& k) { return A_at("0", k); };
+			matvec.b = B_at;
+			matvec.y = [](const std::string& c) { return "Y[0][" + c + "]"; };
+			if (C)
+				matvec.c = [C_at](const std::string& c) { return C_at("0", c); };
+			matvec.alpha = alpha;
+			matvec.beta = beta;
+			matvec.transposed_b = transB;
+			matvec.print(dst);
+			return;
+		}
+
+		if (blocked) {
+			BlockedGemm gemm;
+			gemm.M = M;
+			gemm.N = N;
+			gemm.K = K;
+			gemm.type = type;
+			gemm.a = A_at;
+			gemm.b = B_at;
+			gemm.y = [](const std::string& r, const std::string& c) {
+				return "Y[" + r + "][" + c + "]";
+			};
+			if (C)
+				gemm.c = C_at;
+			gemm.alpha = alpha;
+			gemm.beta = beta;
+			gemm.prepacked_b = prepacked_b;
+			gemm.print(dst);
+			return;
+		}
+
+		// Helper variables to make the code (both this and generated) cleaner
+		dst << "\t" << "const int M = " << M << ";" << std::endl;
+		dst << "\t" << "const int K = " << K << ";" << std::endl;
+		dst << "\t" << "const int N = " << N << ";" << std::endl;
+		dst << "\t" << "float alpha = " << alpha << ";" << std::endl;
+		dst << "\t" << "float beta = " << beta << ";" << std::endl;
+
 		// Now genereate the calculation source code
 
 		// Loop output rows, columns
@@ -131,13 +131,15 @@ void LayerNormalization::print(std::ostream& dst) const
 	}
 	dst << ";" << std::endl;
 
-	// Store mean and inv_std_dev
+	// Store mean and inv_std_dev, if they are used
 	std::string keepdims_idx = outer_idx;
 	for (int i = axis; i < (int)x->data_dim.size(); i++) {
 		keepdims_idx += "[0]";
 	}
-	INDT_2 << "mean" << keepdims_idx << " = mean_value;" << std::endl;
-	INDT_2 << "inv_std_dev" << keepdims_idx << " = inv_std_dev_value;" << std::endl;
+	if (is_output_N_used(1))
+		INDT_2 << "mean" << keepdims_idx << " = mean_value;" << std::endl;
+	if (is_output_N_used(2))
+		INDT_2 << "inv_std_dev" << keepdims_idx << " = inv_std_dev_value;" << std::endl;
 
 	INDT_1 << "}" << std::endl;
 }
@@ -0,0 +1,318 @@
+/* This file is part of onnx2c.
+ *
+ * Loop and Scan nodes.
+ */
+#include "loop.h"
+#include "graph.h"
+#include <set>
+
+namespace toC {
+
+void Loop::parseAttributes(onnx::NodeProto& node)
+{
+	for (const auto& a : node.attribute()) {
+		LOG(TRACE) << "Parsing attribute " << a.name() << std::endl;
+		if (a.name() == "body") {
+			*body_model.mutable_graph() = a.g();
+			body_model.add_opset_import()->set_version(onnx_ir_version);
+		}
+		else if (a.name() == "num_scan_inputs")
+			num_scan_inputs = parse_attribute_int(a);
+		else if (a.name() == "scan_input_axes")
+			scan_input_axes = parse_attribute_ints(a);
+		else if (a.name() == "scan_input_directions")
+			scan_input_directions = parse_attribute_ints(a);
+		else if (a.name() == "scan_output_axes")
+			scan_output_axes = parse_attribute_ints(a);
+		else if (a.name() == "scan_output_directions")
+			scan_output_directions = parse_attribute_ints(a);
+		else
+			ERROR("unknown attribute: " << a.name());
+	}
+}
+
+/* Create the body's input tensors, and compile the body graph */
+void Loop::resolve_body(void)
+{
+	onnx::GraphProto* g = body_model.mutable_graph();
+	unsigned num_body_inputs = g->input_size();
+	std::vector<Tensor*> body_inputs;
+
+	for (unsigned i = 0; i < num_body_inputs; i++) {
+		const Tensor* outer = get_input_tensor(i);
+		Tensor* t = new Tensor;
+		t->name = g->input(i).name();
+		if (is_scan() == false && i == 0)
+			t->data_type = onnx::TensorProto_DataType_INT64; // iteration number
+		else if (is_scan() == false && i == 1)
+			t->data_type = onnx::TensorProto_DataType_BOOL; // condition
+		else {
+			t->data_type = outer->data_type;
+			t->data_dim = outer->data_dim;
+			// The body gets one slice of each scan input
+			if (is_scan() && i >= num_states)
+				t->data_dim.erase(t->data_dim.begin());
+		}
+		t->isIO = true;
+		t->generate = false;
+		t->initialize = false;
+		body_inputs.push_back(t);
+	}
+
+	for (unsigned i = num_body_inputs; i < get_number_of_inputs(); i++) {
+		const Tensor* outer = get_input_tensor(i);
+		Tensor* t = new Tensor;
+		t->name = outer->name;
+		t->data_type = outer->data_type;
+		t->data_dim = outer->data_dim;
+		// Body nodes can still use the values of constants when resolving
+		t->isConst = outer->isConst;
+		t->data_buffer = outer->data_buffer;
+		t->isIO = true;
+		t->generate = false;
+		t->initialize = false;
+		body_inputs.push_back(t);
+		g->add_input()->set_name(outer->name);
+	}
+
+	// Body outputs that no body node calculates (body inputs, outer tensors or
+	// initializers passed through as such) are copied with an Identity node.
+	// Otherwise they would be both inputs and outputs of the body function.
+	std::set<std::string> calculated;
+	for (const auto& n : g->node())
+		for (const auto& o : n.output())
+			calculated.insert(o);
+	std::set<std::string> seen;
+	for (int o = 0; o < g->output_size(); o++) {
+		onnx::ValueInfoProto* vi = g->mutable_output(o);
+		if (calculated.count(vi->name()) && seen.count(vi->name()) == 0) {
+			seen.insert(vi->name());
+			continue;
+		}
+		onnx::NodeProto* identity = g->add_node();
+		identity->set_op_type("Identity");
+		identity->add_input(vi->name());
+		vi->set_name(vi->name() + "_" + onnx_name + "_out_" + std::to_string(o));
+		identity->add_output(vi->name());
+	}
+
+	LOG(DEBUG) << "Compiling the body of " << op_name << " node " << onnx_name << std::endl;
+	body = new Graph(body_model, body_inputs);
+	LOG(DEBUG) << "(done compiling the body of " << onnx_name << ")" << std::endl;
+}
+
+void Loop::resolve(void)
+{
+	if (body_model.has_graph() == false)
+		ERROR(op_name << " node " << onnx_name << " has no body");
+	const onnx::GraphProto& g = body_model.graph();
+	unsigned num_body_inputs = g.input_size();
+	if (get_number_of_inputs() < num_body_inputs)
+		ERROR(op_name << " node " << onnx_name << " has fewer inputs than its body");
+	num_outer_inputs = get_number_of_inputs() - num_body_inputs;
+
+	if (is_scan()) {
+		if (onnx_ir_version < 9)
+			ERROR("Unimplemented: Scan before opset 9");
+		if ((int)num_body_inputs < num_scan_inputs)
+			ERROR("Scan node " << onnx_name << " has more scan inputs than body inputs");
+		num_states = num_body_inputs - num_scan_inputs;
+		if (g.output_size() < (int)num_states)
+			ERROR("Scan node " << onnx_name << " has fewer body outputs than states");
+		num_scan_outputs = g.output_size() - num_states;
+		for (auto axes : {scan_input_axes, scan_output_axes})
+			for (auto a : axes)
+				if (a != 0)
+					ERROR("Unimplemented: Scan over other than the first axis");
+		if (num_scan_inputs < 1)
+			ERROR("Unimplemented: Scan without scan inputs");
+
+		// The trip count is the length of the scan inputs
+		for (unsigned i = num_states; i < num_body_inputs; i++) {
+			const Tensor* t = get_input_tensor(i);
+			if (t->rank() == 0)
+				ERROR("Scan input of node " << onnx_name << " is a scalar");
+			if (i == num_states)
+				trip_count = t->data_dim[0];
+			else if (trip_count != t->data_dim[0])
+				ERROR("Scan inputs of node " << onnx_name << " are of different lengths");
+			name_input(i, "scan_input_" + std::to_string(i - num_states));
+		}
+		for (unsigned i = 0; i < num_states; i++)
+			name_input(i, "initial_state_" + std::to_string(i));
+	}
+	else {
+		if (num_body_inputs < 2)
+			ERROR("Loop node " << onnx_name << " body has fewer than 2 inputs");
+		num_states = num_body_inputs - 2;
+		if (g.output_size() < (int)num_states + 1)
+			ERROR("Loop node " << onnx_name << " has fewer body outputs than loop carried dependencies");
+		num_scan_outputs = g.output_size() - 1 - num_states;
+
+		const Tensor* M = get_input_tensor(0);
+		if (M->is_used() == false || M->isConst == false)
+			ERROR("Unimplemented: Loop node " << onnx_name << " without a constant trip count");
+		trip_count = M->get_data_element(0);
+		if (trip_count < 0)
+			trip_count = 0;
+		name_input(0, "M");
+		name_input(1, "cond");
+		for (unsigned i = 0; i < num_states; i++)
+			name_input(2 + i, "v_initial_" + std::to_string(i));
+	}
+	for (unsigned i = 0; i < num_outer_inputs; i++)
+		name_input(num_body_inputs + i, "outer_" + std::to_string(i));
+
+	resolve_body();
+
+	for (unsigned i = 0; i < num_states; i++) {
+		const Tensor* initial = get_input_tensor(first_state_input() + i);
+		const Tensor* next = body->get_output_tensor(first_state_output() + i);
+		if (next->data_dim != initial->data_dim || next->data_type != initial->data_type)
+			ERROR("Unimplemented: loop carried dependency " << initial->name << " of node " << onnx_name << " changes shape or type");
+		Tensor* t = new Tensor;
+		t->data_dim = initial->data_dim;
+		t->data_type = initial->data_type;
+		register_output(t, (is_scan() ? "final_state_" : "v_final_") + std::to_string(i));
+	}
+	for (unsigned i = 0; i < num_scan_outputs; i++) {
+		const Tensor* slice = body->get_output_tensor(first_state_output() + num_states + i);
+		Tensor* t = new Tensor;
+		t->data_dim = slice->data_dim;
+		t->data_dim.insert(t->data_dim.begin(), trip_count);
+		t->data_type = slice->data_type;
+		register_output(t, "scan_output_" + std::to_string(i));
+	}
+}
+
+void Loop::print_subgraphs(std::ostream& dst) const
+{
+	dst << "/*" << std::endl;
+	dst << " * Body of " << op_name << " node " << onnx_name << std::endl;
+	dst << " */" << std::endl;
+	body->print_global_tensors(dst);
+	dst << std::endl;
+	body->print_functions(dst);
+	dst << "FUNC_PREFIX ";
+	body->print_interface_function(dst, true, body_name());
+	dst << std::endl;
+}
+
+// C dimensions for a buffer the shape of t, e.g. "[2][3]"
+static std::string dims(const Tensor* t)
+{
+	std::string rv;
+	for (int d : t->data_dim)
+		rv += "[" + std::to_string(d) + "]";
+	return rv;
+}
+
+// Scalars are passed as pointers
+static std::string pointer(const Tensor* t, const std::string& name)
+{
+	return t->is_scalar() ? "&" + name : name;
+}
+
+// The slice of a scan input or output for this iteration
+static std::string scan_slice(const std::string& name, const std::vector<int64_t>& directions, unsigned i, int64_t trip_count)
+{
+	std::string idx = "iter";
+	if (i < directions.size() && directions[i] == 1)
+		idx = std::to_string(trip_count - 1) + "-iter";
+	return name + "_" + std::to_string(i) + "[" + idx + "]";
+}
+
+void Loop::print_body_call(std::ostream& dst) const
+{
+	std::vector<std::string> args;
+	if (is_scan() == false) {
+		args.push_back("&iter");
+		args.push_back("&cond_in");
+	}
+	for (unsigned i = 0; i < num_states; i++)
+		args.push_back(pointer(get_input_tensor(first_state_input() + i), "state_" + std::to_string(i)));
+	if (is_scan())
+		for (unsigned i = 0; i < (unsigned)num_scan_inputs; i++) {
+			std::string slice = scan_slice("scan_input", scan_input_directions, i, trip_count);
+			args.push_back(get_input_tensor(num_states + i)->rank() == 1 ? "&" + slice : slice);
+		}
+	for (unsigned i = 0; i < num_outer_inputs; i++)
+		args.push_back("outer_" + std::to_string(i));
+
+	if (is_scan() == false)
+		args.push_back("&cond_out");
+	for (unsigned i = 0; i < num_states; i++)
+		args.push_back(pointer(get_input_tensor(first_state_input() + i), "state_next_" + std::to_string(i)));
+	for (unsigned i = 0; i < num_scan_outputs; i++) {
+		const Tensor* slice = body->get_output_tensor(first_state_output() + num_states + i);
+		if (is_output_N_used(num_states + i))
+			args.push_back(pointer(slice, scan_slice("scan_output", scan_output_directions, i, trip_count)));
+		else
+			args.push_back(pointer(slice, "scan_" + std::to_string(i)));
+	}
+
+	INDT_2 << body_name() << "( ";
+	for (unsigned i = 0; i < args.size(); i++)
+		dst << (i ? ", " : "") << args[i];
+	dst << " );" << std::endl;
+}
+
+void Loop::print(std::ostream& dst) const
+{
+	INDT_1 << "/* " << op_name << std::endl;
+	INDT_1 << " * body: " << body_name() << "()" << std::endl;
+	INDT_1 << " * trip count: " << trip_count << std::endl;
+	INDT_1 << " * loop carried dependencies: " << num_states << std::endl;
+	INDT_1 << " * scan outputs: " << num_scan_outputs << std::endl;
+	INDT_1 << " */" << std::endl;
+
+	// The loop carried dependencies, as inputs and outputs of the body
+	for (unsigned i = 0; i < num_states; i++) {
+		const Tensor* t = get_input_tensor(first_state_input() + i);
+		std::string s = "state_" + std::to_string(i);
+		INDT_1 << "static " << t->data_type_str() << " " << s << dims(t) << ";" << std::endl;
+		INDT_1 << "static " << t->data_type_str() << " state_next_" << i << dims(t) << ";" << std::endl;
+		INDT_1 << "memcpy(" << pointer(t, s) << ", " << (is_scan() ? "initial_state_" : "v_initial_") << i
+		       << ", sizeof(" << s << "));" << std::endl;
+	}
+	// Slices of unused scan outputs are written to a scratch buffer
+	for (unsigned i = 0; i < num_scan_outputs; i++) {
+		if (is_output_N_used(num_states + i))
+			continue;
+		const Tensor* slice = body->get_output_tensor(first_state_output() + num_states + i);
+		INDT_1 << "static " << slice->data_type_str() << " scan_" << i << dims(slice) << ";" << std::endl;
+	}
+
+	if (is_scan()) {
+		INDT_1 << "for( int64_t iter=0; iter<" << trip_count << "; iter++ ) {" << std::endl;
+	}
+	else {
+		if (get_input_tensor(1)->is_used())
+			INDT_1 << "bool cond_in = *cond;" << std::endl;
+		else
+			INDT_1 << "bool cond_in = true;" << std::endl;
+		INDT_1 << "bool cond_out;" << std::endl;
+		INDT_1 << "for( int64_t iter=0; iter<" << trip_count << " && cond_in; iter++ ) {" << std::endl;
+	}
+	print_body_call(dst);
+	for (unsigned i = 0; i < num_states; i++) {
+		const Tensor* t = get_input_tensor(first_state_input() + i);
+		std::string s = "state_" + std::to_string(i);
+		INDT_2 << "memcpy(" << pointer(t, s) << ", " << pointer(t, "state_next_" + std::to_string(i))
+		       << ", sizeof(" << s << "));" << std::endl;
+	}
+	if (is_scan() == false)
+		INDT_2 << "cond_in = cond_out;" << std::endl;
+	INDT_1 << "}" << std::endl;
+
+	for (unsigned i = 0; i < num_states; i++) {
+		if (is_output_N_used(i) == false)
+			continue;
+		const Tensor* t = get_input_tensor(first_state_input() + i);
+		std::string s = "state_" + std::to_string(i);
+		INDT_1 << "memcpy(" << (is_scan() ? "final_state_" : "v_final_") << i << ", " << pointer(t, s)
+		       << ", sizeof(" << s << "));" << std::endl;
+	}
+}
+
+} // namespace toC
@@ -0,0 +1,63 @@
+/* This file is part of onnx2c.
+ *
+ * Loop and Scan nodes.
+ *
+ * The body subgraph is compiled into a function of its own, and
+ * the node's function calls it once per iteration. The loop carried
+ * dependencies are kept in buffers of the node's function between
+ * the iterations. The scan outputs of each iteration are written
+ * directly into their slice of the node's output.
+ *
+ * Only static trip counts are supported: Loop's M must be a constant,
+ * and Scan iterates over the first dimension of its scan inputs.
+ * A Loop that ends early through its condition leaves the rest of
+ * its scan outputs unwritten.
+ *
+ * Tensors of the enclosing graph that the body uses are extra inputs
+ * of the node, after its ONNX inputs. They are passed on to the body
+ * function as parameters.
+ */
+#include "node.h"
+
+namespace toC {
+
+class Graph;
+
+class Loop : public Node {
+	public:
+	Loop(std::string op)
+	{
+		op_name = op;
+	}
+
+	/* Scan attributes */
+	int num_scan_inputs = 0;
+	std::vector<int64_t> scan_input_axes;
+	std::vector<int64_t> scan_input_directions;
+	std::vector<int64_t> scan_output_axes;
+	std::vector<int64_t> scan_output_directions;
+
+	// The body subgraph, wrapped into a model for the Graph class
+	onnx::ModelProto body_model;
+	Graph* body = nullptr;
+
+	int64_t trip_count = 0;
+	unsigned num_states = 0; // loop carried dependencies
+	unsigned num_scan_outputs = 0;
+	unsigned num_outer_inputs = 0;
+
+	virtual void parseAttributes(onnx::NodeProto& node) override;
+	virtual void resolve(void) override;
+	virtual void print(std::ostream& dst) const override;
+	virtual void print_subgraphs(std::ostream& dst) const override;
+
+	private:
+	bool is_scan(void) const { return op_name == "Scan"; }
+	std::string body_name(void) const { return c_name() + "_body"; }
+	// Index of the first loop carried dependency in the node's and the body's inputs and outputs
+	unsigned first_state_input(void) const { return is_scan() ? 0 : 2; }
+	unsigned first_state_output(void) const { return is_scan() ? 0 : 1; }
+	void resolve_body(void);
+	void print_body_call(std::ostream& dst) const;
+};
+} // namespace toC
@@ -2,9 +2,15 @@
  *
  * MatMul node.
  *
+ * The fuse_linear optimization pass can add a third input, C, that is
+ * added to the result. C is unidirectionally broadcast to Y. This is not
+ * in the ONNX specification, but saves a separate pass over Y for
+ * the bias Add of linear layers.
  */
+#pragma once
 
 #include "abstractmatmul.h"
+#include "blockedgemm.h"
 #include "node.h"
 
 namespace toC {
@@ -16,14 +22,24 @@ class MatMul : public AbstractMatMul {
 		op_name = "MatMul";
 	}
 
+	// Set by the 'blocked_gemm' optimization pass
+	bool blocked = false;
+	bool gemv = false; // A is a single row, or a vector
+	bool prepacked_b = false; // B is packed by BlockedGemm::pack_b()
+
 	virtual void resolve(void) override;
+	virtual void print(std::ostream& dst) const override;
+	void print_blocked(std::ostream& dst) const;
+	int folded_rows() const;
+	std::string c_element(const std::string& row, const std::string& col) const;
+	void print_initialize(std::ostream& dst, const std::string& y_idx) const override;
 	void print_multiply_accumulate(std::ostream& dst,
 	                               const std::string& y_idx,
 	                               const std::string& a_idx,
 	                               const std::string& b_idx) const override;
 };
 
-void MatMul::resolve(void)
+inline void MatMul::resolve(void)
 {
 	Tensor* a = get_input_tensor(0);
 	Tensor* b = get_input_tensor(1);
@@ -34,6 +50,8 @@ void MatMul::resolve(void)
 
 	name_input(0, "A");
 	name_input(1, "B");
+	if (get_number_of_inputs() > 2)
+		name_input(2, "C");
 
 	Tensor* y = new Tensor;
 	y->data_dim = resolve_shape();
@@ -41,12 +59,176 @@ void MatMul::resolve(void)
 	register_output(y, "Y");
 }
 
-void MatMul::print_multiply_accumulate(std::ostream& dst,
-                                       const std::string& y_idx,
-                                       const std::string& a_idx,
-                                       const std::string& b_idx) const
+// Element of C added to the element of Y at the given row and column.
+// The variables of the broadcast dimensions are as printed by AbstractMatMul::print()
+inline std::string MatMul::c_element(const std::string& row, const std::string& col) const
+{
+	const Tensor* a = get_input_tensor(0);
+	const Tensor* b = get_input_tensor(1);
+	const Tensor* c = get_input_tensor(2);
+	const Tensor* y = get_output_tensor(0);
+	std::vector<std::string> y_vars;
+	int broadcast_dims = y->rank() - (a->rank() > 1) - (b->rank() > 1);
+	for (int i = 0; i < broadcast_dims; i++)
+		y_vars.push_back("i" + std::to_string(i));
+	if (a->rank() > 1)
+		y_vars.push_back(row);
+	if (b->rank() > 1)
+		y_vars.push_back(col);
+
+	std::string c_idx = "C";
+	if (c->is_scalar())
+		c_idx = "*C";
+	int skip = y->rank() - c->rank();
+	for (unsigned i = 0; i < c->rank(); i++) {
+		if (c->data_dim[i] == 1)
+			c_idx += "[0]";
+		else
+			c_idx += "[" + y_vars[skip + i] + "]";
+	}
+	return c_idx;
+}
+
+inline void MatMul::print_initialize(std::ostream& dst, const std::string& y_idx) const
+{
+	if (get_number_of_inputs() < 3) {
+		AbstractMatMul::print_initialize(dst, y_idx);
+		return;
+	}
+	INDT_3 << y_idx << " = " << c_element("i", "j") << ";" << std::endl;
+}
+
+inline void MatMul::print_multiply_accumulate(std::ostream& dst,
+                                              const std::string& y_idx,
+                                              const std::string& a_idx,
+                                              const std::string& b_idx) const
 {
 	INDT_4 << y_idx << " += " << a_idx << " * " << b_idx << ";" << std::endl;
 }
 
+inline void MatMul::print(std::ostream& dst) const
+{
+	if (blocked || gemv)
+		print_blocked(dst);
+	else
+		AbstractMatMul::print(dst);
+}
+
+// Rows of A and Y, when the broadcast dimensions can be folded into
+// them, i.e. when B and C are the same for all the matrices of A.
+// Zero if they can't.
+inline int MatMul::folded_rows() const
+{
+	const Tensor* a = get_input_tensor(0);
+	const Tensor* b = get_input_tensor(1);
+	// A packed B is always shared
+	for (int i = 0; i < (int)b->rank() - 2 && prepacked_b == false; i++)
+		if (b->data_dim[i] != 1)
+			return 0;
+	if (get_number_of_inputs() > 2) {
+		const Tensor* c = get_input_tensor(2);
+		for (int i = 0; i < (int)c->rank() - 1; i++)
+			if (c->data_dim[i] != 1)
+				return 0;
+	}
+	int rows = 1;
+	for (int i = 0; i < (int)a->rank() - 1; i++)
+		rows *= a->data_dim[i];
+	return rows;
+}
+
+// The 'blocked_gemm' pass lowers only MatMuls with a matrix for B.
+// When B is shared by all the matrices of A, the broadcast dimensions
+// are folded into the rows of one GEMM, which packs B only once.
+// Otherwise the broadcast dimensions are looped over as in
+// AbstractMatMul::print(), with a GEMM for each matrix of Y.
+inline void MatMul::print_blocked(std::ostream& dst) const
+{
+	INDT_1 << "/* MatMul */" << std::endl;
+
+	const Tensor* a = get_input_tensor(0);
+	const Tensor* b = get_input_tensor(1);
+	const Tensor* y = get_output_tensor(0);
+	std::string type = y->data_type_str();
+	int N = y->data_dim[y->rank() - 1];
+	int K = a->data_dim[a->rank() - 1];
+	int M = a->rank() > 1 ? a->data_dim[a->rank() - 2] : 1;
+	int broadcast_dims = y->rank() - (a->rank() > 1) - 1;
+
+	int rows = folded_rows();
+	if (rows > 0) {
+		M = rows;
+		broadcast_dims = 0;
+	}
+
+	for (int i = 0; i < broadcast_dims; i++) {
+		std::string lv = "i" + std::to_string(i);
+		INDT_1 << "for (unsigned " << lv << "=0; " << lv << "<" << y->data_dim[i] << "; " << lv << "++)" << std::endl;
+	}
+	INDT_1 << "{" << std::endl;
+
+	// The matrices of A, B and Y for this iteration of the broadcast loops,
+	// as pointers to their rows. Broadcast dimensions of size 1 have no stride.
+	auto print_matrix = [&](const Tensor* t, const std::string& name, const std::string& param,
+	                        int batch_rank, int t_rows, int row_size, bool is_const) {
+		std::string offset;
+		int stride = t_rows;
+		for (int i = batch_rank - 1; i >= 0; i--) {
+			if (t->data_dim[i] != 1) {
+				std::string term = "i" + std::to_string(broadcast_dims - batch_rank + i) + "*" + std::to_string(stride);
+				offset = offset == "" ? term : term + " + " + offset;
+			}
+			stride *= t->data_dim[i];
+		}
+		std::string c = is_const ? "const " : "";
+		INDT_1 << c << type << " (*" << name << ")[" << row_size << "] = (" << c << type << " (*)[" << row_size << "])" << param;
+		if (offset != "")
+			dst << " + " << offset;
+		dst << ";" << std::endl;
+	};
+	int a_batch_rank = rows > 0 ? 0 : std::max(0, (int)a->rank() - 2);
+	int b_batch_rank = rows > 0 ? 0 : b->rank() - 2;
+	print_matrix(a, "Ab", "A", a_batch_rank, M, K, true);
+	if (prepacked_b == false)
+		print_matrix(b, "Bb", "B", b_batch_rank, K, N, true);
+	print_matrix(y, "Yb", "Y", broadcast_dims, M, N, false);
+
+	BlockedGemm::Element b_at = [](const std::string& r, const std::string& c) {
+		return "Bb[" + r + "][" + c + "]";
+	};
+	if (M == 1) {
+		BlockedGemv matvec;
+		matvec.N = N;
+		matvec.K = K;
+		matvec.type = type;
+		matvec.a = [](const std::string& k) { return "Ab[0][" + k + "]"; };
+		matvec.b = b_at;
+		matvec.y = [](const std::string& c) { return "Yb[0][" + c + "]"; };
+		if (get_number_of_inputs() > 2)
+			matvec.c = [this](const std::string& c) { return c_element("0", c); };
+		matvec.print(dst);
+	}
+	else {
+		BlockedGemm gemm;
+		gemm.M = M;
+		gemm.N = N;
+		gemm.K = K;
+		gemm.type = type;
+		gemm.a = [](const std::string& r, const std::string& c) {
+			return "Ab[" + r + "][" + c + "]";
+		};
+		gemm.b = b_at;
+		gemm.y = [](const std::string& r, const std::string& c) {
+			return "Yb[" + r + "][" + c + "]";
+		};
+		if (get_number_of_inputs() > 2)
+			gemm.c = [this](const std::string& r, const std::string& c) {
+				return c_element(r, c);
+			};
+		gemm.prepacked_b = prepacked_b;
+		gemm.print(dst);
+	}
+	INDT_1 << "}" << std::endl;
+}
+
 } // namespace toC
@@ -3,6 +3,7 @@
  * Pad node.
  */
 #include "pad.h"
+#include <cmath>
 namespace toC {
 
 /* Parse attributes, if this node has them. */
@@ -172,7 +173,12 @@ void Pad::print(std::ostream& dst) const
 			dst << " || pad_at_" << std::to_string(i);
 		}
 		dst << ")" << std::endl;
-		INDT_2 << "output" << oidxs << " = " << constant << ";" << std::endl;
+		INDT_2 << "output" << oidxs << " = ";
+		if (std::isinf(constant))
+			dst << (constant > 0 ? "INFINITY" : "-INFINITY");
+		else
+			dst << constant;
+		dst << ";" << std::endl;
 		INDT_1 << "else" << std::endl;
 	}
 	INDT_2 << "output" << oidxs << "= data" << iidxs << ";" << std::endl;
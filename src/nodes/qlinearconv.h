@@ -14,12 +14,16 @@ class QLinearConv : public SpatialFilter {
 		op_name = "QLinearConv";
 	}
 
+	// C type of the accumulator. The 'range_analysis' optimization pass
+	// narrows it when the sums provably fit in a smaller type.
+	std::string accumulator_type = "int32_t";
+
 	const Tensor* get_X(void) const override { return get_input_tensor(0); }
 	const Tensor* get_W(void) const override { return get_input_tensor(3); }
 
 	void print_output_cell_init(std::ostream& dst, const std::string& y_idx) const override
 	{
-		INDT_3 << "int32_t a = ";
+		INDT_3 << accumulator_type << " a = ";
 		if (get_number_of_inputs() < 9) {
 			dst << "0";
 		}
@@ -34,15 +38,18 @@ class QLinearConv : public SpatialFilter {
 	                            const std::string& w_idx,
 	                            const std::string& y_idx) const override
 	{
-		INDT_4 << "a += ((int32_t)x" << x_idx << " - x_zero_point[0]) * ((int32_t)w" << w_idx << " - w_zero_point[0]);" << std::endl;
+		INDT_4 << "a += ((" << accumulator_type << ")x" << x_idx << " - x_zero_point[0]) * ((" << accumulator_type << ")w" << w_idx << " - w_zero_point[0]);" << std::endl;
 	}
 
 	void print_output_cell_finalize(std::ostream& dst, const std::string& y_idx) const override
 	{
 		std::string float_dtype = get_input_tensor(1)->data_type_str();
 		INDT_3 << float_dtype << " scaled = ((" << float_dtype << ")a) * (x_scale[0] * w_scale[0]) / y_scale[0];" << std::endl;
-		INDT_3 << "scaled = scaled + (" << float_dtype << ")y_zero_point[0];" << std::endl;
-		INDT_3 << "y" << y_idx << " = (" << get_output_tensor(0)->data_type_str() << ") roundf(scaled);" << std::endl;
+		INDT_3 << "scaled = roundf(scaled + (" << float_dtype << ")y_zero_point[0]);" << std::endl;
+		auto [lower, upper] = get_output_tensor(0)->get_type_bounds();
+		INDT_3 << "if (scaled > " << upper << ") scaled = " << upper << ";" << std::endl;
+		INDT_3 << "else if (scaled < " << lower << ") scaled = " << lower << ";" << std::endl;
+		INDT_3 << "y" << y_idx << " = (" << get_output_tensor(0)->data_type_str() << ")scaled;" << std::endl;
 	}
 
 	void print(std::ostream& dst) const override
@@ -87,7 +94,7 @@ class QLinearConv : public SpatialFilter {
 
 		Tensor* rv = new Tensor;
 		rv->data_dim = resolve_output_size();
-		rv->data_type = get_X()->data_type;
+		rv->data_type = get_input_tensor(7)->data_type;
 		register_output(rv, "y");
 	}
 };
@@ -14,12 +14,16 @@ class QLinearMatMul : public AbstractMatMul {
 		op_name = "QLinearMatMul";
 	}
 
+	// C type of the accumulator. The 'range_analysis' optimization pass
+	// narrows it when the sums provably fit in a smaller type.
+	std::string accumulator_type = "int32_t";
+
 	Tensor* get_a() const override { return get_input_tensor(0); }
 	Tensor* get_b() const override { return get_input_tensor(3); }
 
 	void print_initialize(std::ostream& dst, const std::string& y_idx) const override
 	{
-		INDT_3 << "int32_t x = 0;" << std::endl;
+		INDT_3 << accumulator_type << " x = 0;" << std::endl;
 	}
 
 	void print_multiply_accumulate(std::ostream& dst,
@@ -28,8 +32,8 @@ class QLinearMatMul : public AbstractMatMul {
 	                               const std::string& b_idx) const override
 	{
 
-		INDT_4 << "x += ((int32_t)" << a_idx << " - (int32_t) a_zero_point[0]) * "
-		       << "((int32_t)" << b_idx << " - (int32_t) b_zero_point[0]);" << std::endl;
+		INDT_4 << "x += ((" << accumulator_type << ")" << a_idx << " - (" << accumulator_type << ") a_zero_point[0]) * "
+		       << "((" << accumulator_type << ")" << b_idx << " - (" << accumulator_type << ") b_zero_point[0]);" << std::endl;
 	}
 
 	void print_finalize(std::ostream& dst, const std::string& y_idx) const override
@@ -37,8 +41,11 @@ class QLinearMatMul : public AbstractMatMul {
 		std::string float_dtype = get_input_tensor(1)->data_type_str();
 		INDT_3 << float_dtype << " scale = (" << float_dtype << ") (a_scale[0] * b_scale[0]) / y_scale[0];" << std::endl;
 		INDT_3 << "double scaled = ((double) x) * (double) scale;" << std::endl;
-		INDT_3 << "scaled = scaled + (double) y_zero_point[0];" << std::endl;
-		INDT_3 << y_idx << " = (" << get_output_tensor(0)->data_type_str() << ") (int32_t) round(scaled);" << std::endl;
+		INDT_3 << "scaled = round(scaled + (double) y_zero_point[0]);" << std::endl;
+		auto [lower, upper] = get_output_tensor(0)->get_type_bounds();
+		INDT_3 << "if (scaled > " << upper << ") scaled = " << upper << ";" << std::endl;
+		INDT_3 << "else if (scaled < " << lower << ") scaled = " << lower << ";" << std::endl;
+		INDT_3 << y_idx << " = (" << get_output_tensor(0)->data_type_str() << ") (int32_t) scaled;" << std::endl;
 	}
 
 	void name_scalar_input(unsigned input_no, std::string name)
@@ -10,6 +10,7 @@
 
 #pragma once
 #include "node.h"
+#include <functional>
 namespace toC {
 
 class SpatialFilter : public Node {
@@ -29,6 +30,25 @@ class SpatialFilter : public Node {
 	std::vector<int64_t> pads;
 	std::vector<int64_t> strides;
 
+	// A MaxPool or AveragePool fused after the filter by the fuse_conv_pool
+	// optimization pass. The filter output is then not stored at all:
+	// Y is the pooled output, and the filter output cells of each pooling
+	// window are calculated into a local 'cell' variable and reduced
+	// right away. Global poolings are fused as one window over the whole
+	// filter output. Empty pool_op means no pooling is fused.
+	std::string pool_op;
+	std::vector<int64_t> pool_kernel_shape;
+	std::vector<int64_t> pool_pads;
+	std::vector<int64_t> pool_strides;
+	int pool_count_include_pad = 0;
+	std::vector<int> filter_dim; // dimensions of the unstored filter output
+
+	// The data is in channels last (NHWC) layout, instead of ONNX's NCHW.
+	// The 'channels_last' optimization pass converts the nodes. The weights
+	// of a channels last filter are in (M x kH x kW x C/group) layout, so the
+	// innermost loop over the input channels reads both X and W contiguously.
+	bool channels_last = false;
+
 	virtual const Tensor* get_X(void) const { return get_input_tensor(0); }
 	virtual const Tensor* get_W(void) const
 	{
@@ -40,6 +60,42 @@ class SpatialFilter : public Node {
 	const Tensor* get_Y(void) const { return get_output_tensor(0); }
 	uint32_t get_numDataDim(void) const { return get_X()->rank() - 2; }
 
+	// Size of tensor t along the channel, or the i:th data dimension,
+	// in either layout
+	int get_channel_dim(const Tensor* t) const
+	{
+		return channels_last ? t->data_dim.back() : t->data_dim[1];
+	}
+	int get_spatial_dim(const Tensor* t, unsigned i) const
+	{
+		return t->data_dim[channels_last ? 1 + i : 2 + i];
+	}
+
+	// Size of the filter output along data dimension i
+	int get_filter_dim(unsigned i) const
+	{
+		if (pool_op == "")
+			return get_spatial_dim(get_Y(), i);
+		return filter_dim[2 + i];
+	}
+
+	// Size of the pooled output along data dimension i. A fused ReduceMean
+	// might not keep the reduced dimensions.
+	int get_pooled_dim(unsigned i) const
+	{
+		if (get_Y()->rank() == 2)
+			return 1;
+		return get_spatial_dim(get_Y(), i);
+	}
+
+	// Where the output cell callbacks write the calculated value
+	std::string output_cell(const std::string& y_idx) const
+	{
+		if (pool_op == "")
+			return "y" + y_idx;
+		return "cell";
+	}
+
 	virtual void parseAttributes(onnx::NodeProto& node) override
 	{
 		for (const auto& a : node.attribute()) {
@@ -177,14 +233,33 @@ class SpatialFilter : public Node {
 		for (int s : strides)
 			dst << s << " ";
 		dst << std::endl;
+		if (channels_last)
+			INDT_1 << " * layout: channels last" << std::endl;
+		if (pool_op != "") {
+			INDT_1 << " * fused " << pool_op << ":" << std::endl;
+			INDT_1 << " *   kernel_shape: ";
+			for (int k : pool_kernel_shape)
+				dst << k << " ";
+			dst << std::endl;
+			INDT_1 << " *   pads: ";
+			for (int p : pool_pads)
+				dst << p << " ";
+			dst << std::endl;
+			INDT_1 << " *   strides: ";
+			for (int s : pool_strides)
+				dst << s << " ";
+			dst << std::endl;
+		}
 		INDT_1 << " */" << std::endl;
 	}
 
 	/* Print the loops of the convolution.
-	 * This version has checks in the innermost loop for checking when
-	 * the kernel hits paddings.
-	 * This (probably, unless compliers are getting *real* amazing) causes
-	 * a lot of overhead. A.k.a. optmization opportunities.
+	 * The outputs whose kernel window is completely inside the input (the interior)
+	 * are calculated in a loop nest of their own, without checks for the kernel
+	 * hitting paddings. Only the loop nests of the thin border regions around
+	 * the interior have the checks in the innermost loop.
+	 * With a fused pooling, the filter outputs are calculated in pooling window
+	 * order, and a single loop nest with the checks is printed.
 	 *
 	 * Three callbacks to pure virtual functions are used:
 	 * - to initialize output cell
@@ -196,29 +271,114 @@ class SpatialFilter : public Node {
 	virtual void print_output_cell_finalize(std::ostream& dst, const std::string& y_idx = "") const = 0;
 
 	void print_loop_with_padding_checks(std::ostream& dst) const
+	{
+		if (pool_op != "") {
+			std::vector<int> begin(get_numDataDim(), 0), end;
+			for (unsigned i = 0; i < get_numDataDim(); i++)
+				end.push_back(get_filter_dim(i));
+			print_loop_region(dst, begin, end);
+			return;
+		}
+		print_regions(dst, [&](const std::vector<int>& begin, const std::vector<int>& end) {
+			print_loop_region(dst, begin, end);
+		});
+	}
+
+	/* Split the filter outputs into the interior, whose kernel windows are
+	 * completely inside the input, and the border regions around it, and
+	 * call print_region for the range of outputs of each region. */
+	void print_regions(
+	    std::ostream& dst,
+	    const std::function<void(const std::vector<int>& begin, const std::vector<int>& end)>& print_region) const
+	{
+		unsigned n_data_dims = get_numDataDim();
+		std::vector<int> full_begin(n_data_dims, 0), full_end;
+		for (unsigned i = 0; i < n_data_dims; i++)
+			full_end.push_back(get_filter_dim(i));
+
+		// The range of outputs along each data dimension whose kernel
+		// window does not reach the paddings
+		std::vector<int> interior_begin, interior_end;
+		bool has_interior = true, has_border = false;
+		for (unsigned i = 0; i < n_data_dims; i++) {
+			int last_input = get_spatial_dim(get_X(), i) - 1 - (kernel_shape[i] - 1) * dilations[i] + pads[i];
+			int begin = std::min<int>((pads[i] + strides[i] - 1) / strides[i], full_end[i]);
+			int end = last_input < 0 ? 0 : std::min<int>(last_input / strides[i] + 1, full_end[i]);
+			if (end <= begin)
+				has_interior = false;
+			if (begin > 0 || end < full_end[i])
+				has_border = true;
+			interior_begin.push_back(begin);
+			interior_end.push_back(end);
+		}
+		if (has_interior == false || has_border == false) {
+			print_region(full_begin, full_end);
+			return;
+		}
+
+		// Peel off the border regions one data dimension at a time: the outputs
+		// before and after the interior along dimension d, with the dimensions
+		// before d already limited to the interior.
+		std::vector<int> begin = full_begin, end = full_end;
+		for (unsigned d = 0; d < n_data_dims; d++) {
+			std::string o_idx = "o" + std::to_string(d);
+			if (interior_begin[d] > 0) {
+				end[d] = interior_begin[d];
+				INDT_1 << "/* border: " << o_idx << " < " << interior_begin[d] << " */" << std::endl;
+				print_region(begin, end);
+			}
+			if (interior_end[d] < full_end[d]) {
+				begin[d] = interior_end[d];
+				end[d] = full_end[d];
+				INDT_1 << "/* border: " << o_idx << " >= " << interior_end[d] << " */" << std::endl;
+				print_region(begin, end);
+			}
+			begin[d] = interior_begin[d];
+			end[d] = interior_end[d];
+		}
+		INDT_1 << "/* interior: no paddings under the kernel */" << std::endl;
+		print_region(begin, end);
+	}
+
+	// Print the loop nest for the filter outputs from 'begin' to 'end' along each data dimension
+	void print_loop_region(std::ostream& dst, const std::vector<int>& begin, const std::vector<int>& end) const
 	{
 		unsigned n_data_dims = get_numDataDim();
 		unsigned batch_size = get_X()->data_dim[0];
-		unsigned channels = get_X()->data_dim[1];
-		unsigned maps = get_Y()->data_dim[1];
+		unsigned channels = get_channel_dim(get_X());
+		unsigned maps = get_channel_dim(get_Y());
 
 		/* Create various indexing strings. This makes generating the loops much cleaner,
 		 * and makes possible the code sharing in child classes. */
-		std::string x_idx = "[b][c]";
-		std::string in_kern_idxs = "[b][c]";
-		std::string y_idx = "[b][m]";
+		std::string spatial_in_kern, spatial_y, spatial_w;
 		for (unsigned i = 0; i < n_data_dims; i++) {
 			std::string i_str = std::to_string(i);
-			x_idx += "[i" + i_str + "]";
-			y_idx += "[o" + i_str + "]";
-			in_kern_idxs += "[ii" + i_str + "]";
+			spatial_y += "[o" + i_str + "]";
+			spatial_in_kern += "[ii" + i_str + "]";
+			spatial_w += "[k" + i_str + "]";
+		}
+		std::string w_c_idx = group != 1 ? "[c-(gi*g)]" : "[c]";
+		std::string in_kern_idxs, y_idx, w_idx;
+		if (channels_last) {
+			in_kern_idxs = "[b]" + spatial_in_kern + "[c]";
+			y_idx = "[b]" + spatial_y + "[m]";
+			w_idx = "[m]" + spatial_w + w_c_idx;
+		}
+		else {
+			in_kern_idxs = "[b][c]" + spatial_in_kern;
+			y_idx = "[b][m]" + spatial_y;
+			w_idx = "[m]" + w_c_idx + spatial_w;
 		}
 
 		/* Create the loops over batches and channels.
 		 * In case this SpatialFilter has a weights input (w), this first loop is over
 		 * output channels (M). Othervise input channels==outputchannels, and it is named C
+		 * In channels last layout, the channel loops are inside the loops over the outputs,
+		 * so neighbouring channels are written one after the other.
 		 */
 		INDT_1 << "for( uint32_t b=0; b<" << batch_size << "; b++ ) {" << std::endl;
+		if (channels_last)
+			print_output_loops(dst, begin, end);
 		if (direct_channel_map())
 			INDT_1 << "for( uint32_t m=0, c=0; m<" << maps << "; m++, c=m) {" << std::endl;
 		else if (get_W() && group > 1) {
@@ -231,33 +391,27 @@ class SpatialFilter : public Node {
 			INDT_1 << "for( uint32_t m=0; m<" << maps << "; m++) {" << std::endl;
 
 		// loop over outputs and inputs
-		for (unsigned i = 0; i < n_data_dims; i++) {
-			std::string o_idx = "o" + std::to_string(i);
-			std::string i_idx = "i" + std::to_string(i);
-			INDT_2 << "for( int32_t " << o_idx << "=0, ";
-			dst << i_idx << "=" << -pads[i] << "; ";
-			dst << o_idx << "<" << get_Y()->data_dim[2 + i] << "; ";
-			dst << o_idx << "++, " << i_idx << "+=" << strides[i] << ") {" << std::endl;
-		}
+		if (channels_last == false)
+			print_output_loops(dst, begin, end);
 
 		print_output_cell_init(dst, y_idx);
 
+		// In channels last layout, the input channel loop is the innermost one
+		std::string input_channel_loop;
 		if (direct_channel_map())
 			;
 		else if (get_W() && group > 1)
-			INDT_3 << "for( int32_t c=gi*g; c<gi*(g+1); c++ ) {" << std::endl;
+			input_channel_loop = "for( int32_t c=gi*g; c<gi*(g+1); c++ ) {";
 		else // same as above, just cleaner to read :)
-			INDT_3 << "for( int32_t c=0; c<" << channels << "; c++ ) {" << std::endl;
+			input_channel_loop = "for( int32_t c=0; c<" + std::to_string(channels) + "; c++ ) {";
+		if (channels_last == false && input_channel_loop != "")
+			INDT_3 << input_channel_loop << std::endl;
 
-		std::string w_idx = "[m][c]";
-		if (group != 1)
-			w_idx = "[m][c-(gi*g)]";
 		for (unsigned i = 0; i < n_data_dims; i++) {
 			std::string idx = "k" + std::to_string(i);
 			INDT_3 << "for( uint32_t " << idx << "=0; ";
 			dst << idx << "<" << kernel_shape[i] << "; ";
 			dst << idx << "++ ) {" << std::endl;
-			w_idx += "[" + idx + "]";
 		}
 
 		// check for out-of-input reading (i.e. read a pad)
@@ -270,15 +424,15 @@ class SpatialFilter : public Node {
 			// For this we calculate the min and max possible values of ii<n>
 			// analogous to the generated loops.
 
-			int min_ii = -pads[i];
+			int min_ii = -pads[i] + begin[i] * strides[i];
 			if (min_ii < 0)
 				conds.push_back("ii" + i_str + " >= 0");
 
-			int max_i = -pads[i] + (get_Y()->data_dim[2 + i] - 1) * strides[i];
+			int max_i = -pads[i] + (end[i] - 1) * strides[i];
 			int max_k = kernel_shape[i] - 1;
 			int max_ii = max_i + max_k * dilations[i];
-			if (max_ii >= get_X()->data_dim[2 + i])
-				conds.push_back("ii" + i_str + " < " + std::to_string(get_X()->data_dim[2 + i]));
+			if (max_ii >= get_spatial_dim(get_X(), i))
+				conds.push_back("ii" + i_str + " < " + std::to_string(get_spatial_dim(get_X(), i)));
 		}
 
 		if (conds.size() > 0) {
@@ -291,7 +445,11 @@ class SpatialFilter : public Node {
 			dst << " ) {" << std::endl;
 		}
 
+		if (channels_last && input_channel_loop != "")
+			INDT_4 << input_channel_loop << std::endl;
 		print_output_cell_calc(dst, in_kern_idxs, w_idx, y_idx);
+		if (channels_last && input_channel_loop != "")
+			INDT_4 << "} /* c */" << std::endl;
 
 		if (conds.size() > 0)
 			INDT_4 << "} /* if valid */" << std::endl;
@@ -301,19 +459,124 @@ class SpatialFilter : public Node {
 			INDT_3 << "} /* k */" << std::endl;
 
 		// close input channels loop when it is separate from output channels
-		if (direct_channel_map() == false)
+		if (channels_last == false && input_channel_loop != "")
 			INDT_3 << "} /* c */" << std::endl;
 		print_output_cell_finalize(dst, y_idx);
 
 		// close output loop
-		for (unsigned i = 0; i < n_data_dims; i++)
-			INDT_2 << "} /* o */" << std::endl;
+		if (channels_last == false)
+			print_output_loops_end(dst);
 
 		// close loops over batches and output channels
 		INDT_1 << "} /* m */" << std::endl;
 		if (direct_channel_map() == false && group > 1)
 			INDT_2 << "} /* g */" << std::endl;
+		if (channels_last)
+			print_output_loops_end(dst);
 		INDT_1 << "} /* b */" << std::endl;
 	}
+
+	void print_output_loops(std::ostream& dst, const std::vector<int>& begin, const std::vector<int>& end) const
+	{
+		if (pool_op != "") {
+			print_pooling_window_loops(dst);
+			return;
+		}
+		for (unsigned i = 0; i < get_numDataDim(); i++) {
+			std::string o_idx = "o" + std::to_string(i);
+			std::string i_idx = "i" + std::to_string(i);
+			INDT_2 << "for( int32_t " << o_idx << "=" << begin[i] << ", ";
+			dst << i_idx << "=" << -pads[i] + begin[i] * strides[i] << "; ";
+			dst << o_idx << "<" << end[i] << "; ";
+			dst << o_idx << "++, " << i_idx << "+=" << strides[i] << ") {" << std::endl;
+		}
+	}
+
+	void print_output_loops_end(std::ostream& dst) const
+	{
+		if (pool_op != "") {
+			print_pooling_window_loops_end(dst);
+			return;
+		}
+		for (unsigned i = 0; i < get_numDataDim(); i++)
+			INDT_2 << "} /* o */" << std::endl;
+	}
+
+	/* With a fused pooling, the loops over the filter outputs become loops over
+	 * the pooled outputs (p) and the window of filter outputs (o) each of them
+	 * reduces. Window positions in the pooling's padding are skipped. */
+	void print_pooling_window_loops(std::ostream& dst) const
+	{
+		unsigned n_data_dims = get_numDataDim();
+		for (unsigned i = 0; i < n_data_dims; i++) {
+			std::string p_idx = "p" + std::to_string(i);
+			INDT_2 << "for( int32_t " << p_idx << "=0; ";
+			dst << p_idx << "<" << get_pooled_dim(i) << "; ";
+			dst << p_idx << "++ ) {" << std::endl;
+		}
+
+		std::string type = get_Y()->data_type_str();
+		if (pool_op == "MaxPool")
+			INDT_2 << type << " pool = (" << type << ") -INFINITY;" << std::endl;
+		else {
+			INDT_2 << type << " pool = 0;" << std::endl;
+			INDT_2 << "int numpool = 0;" << std::endl;
+		}
+
+		for (unsigned i = 0; i < n_data_dims; i++) {
+			std::string i_str = std::to_string(i);
+			INDT_2 << "for( int32_t q" << i_str << "=0; q" << i_str << "<" << pool_kernel_shape[i] << "; q" << i_str << "++ ) {" << std::endl;
+			INDT_2 << "int32_t o" << i_str << " = p" << i_str << "*" << pool_strides[i] << " + q" << i_str << " - " << pool_pads[i] << ";" << std::endl;
+
+			// Only emit checks if the window can reach the padding
+			std::vector<std::string> conds;
+			if (pool_pads[i] > 0)
+				conds.push_back("o" + i_str + " < 0");
+			int max_o = (get_pooled_dim(i) - 1) * pool_strides[i] + pool_kernel_shape[i] - 1 - pool_pads[i];
+			if (max_o >= get_filter_dim(i))
+				conds.push_back("o" + i_str + " >= " + std::to_string(get_filter_dim(i)));
+			if (conds.size() > 0) {
+				INDT_2 << "if( ";
+				for (unsigned c = 0; c < conds.size(); c++) {
+					if (c > 0)
+						dst << " || ";
+					dst << conds[c];
+				}
+				dst << " ) continue;" << std::endl;
+			}
+			INDT_2 << "int32_t i" << i_str << " = o" << i_str << "*" << strides[i] << " - " << pads[i] << ";" << std::endl;
+		}
+	}
+
+	void print_pooling_window_loops_end(std::ostream& dst) const
+	{
+		unsigned n_data_dims = get_numDataDim();
+		std::string y_idx = "[b][m]";
+		for (unsigned i = 0; i < n_data_dims && get_Y()->rank() > 2; i++)
+			y_idx += "[p" + std::to_string(i) + "]";
+
+		if (pool_op == "MaxPool")
+			INDT_3 << "if( cell > pool ) pool = cell;" << std::endl;
+		else {
+			INDT_3 << "pool += cell;" << std::endl;
+			INDT_3 << "numpool++;" << std::endl;
+		}
+		for (unsigned i = 0; i < n_data_dims; i++)
+			INDT_2 << "} /* q */" << std::endl;
+
+		if (pool_op == "MaxPool")
+			INDT_2 << "y" << y_idx << " = pool;" << std::endl;
+		else {
+			if (pool_count_include_pad) {
+				int numpool = 1;
+				for (auto k : pool_kernel_shape)
+					numpool *= k;
+				INDT_2 << "numpool = " << numpool << ";" << std::endl;
+			}
+			INDT_2 << "y" << y_idx << " = pool / numpool;" << std::endl;
+		}
+		for (unsigned i = 0; i < n_data_dims; i++)
+			INDT_2 << "} /* p */" << std::endl;
+	}
 };
 } // namespace toC
@@ -0,0 +1,146 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'blocked_gemm' optimization pass.
+ *
+ * The Gemm and MatMul nodes calculate each output as a dot product of a
+ * row of A and a column of B. Walking down the column of B strides over
+ * a whole row of B for every multiply-add, and each value loaded is used
+ * once. For all but the smallest matrices, the loops are bound by the
+ * memory traffic rather than the arithmetic.
+ *
+ * This pass makes the nodes print a blocked GEMM (see nodes/blockedgemm.h):
+ * the operands are packed in cache sized blocks into scratch buffers, and
+ * the outputs are calculated in small register tiles. A constant B is
+ * packed at compile time, and needs no scratch buffer. When all the
+ * matrices of a batched MatMul share B (e.g. the sequence positions of
+ * a transformer going through a linear layer), they are calculated as
+ * the rows of one GEMM, and B is packed only once.
+ *
+ * Matrix-vector products (one row in A, e.g. the layers of an MLP run
+ * with a batch of one) reuse nothing in B, and are bound by reading it.
+ * They are printed as a GEMV instead, which reads B once, in the order
+ * it is stored in, and needs no scratch buffers. A constant, transposed B
+ * (as in the fully connected layers exported from PyTorch) is transposed
+ * back at compile time: adding rows of B to the outputs vectorizes better
+ * than the dot products with the rows of a transposed B.
+ *
+ * Matrices with fewer rows or columns than a register tile are left as
+ * they are. The packing would not pay for itself.
+ */
+#include "graph.h"
+#include "nodes/gemm.h"
+#include "nodes/matmul.h"
+#include "options.h"
+
+using namespace toC;
+
+// Replace the constant B input of node n with a copy packed at compile time
+void Graph::prepack_gemm_b(Node* n, Tensor* b, int K, int N, bool transposed)
+{
+	Tensor* bp = addConstTensor(b->name + "_packed", onnx::TensorProto_DataType_FLOAT, BlockedGemm::prepacked_b_dims(N, K));
+	BlockedGemm::pack_b((const float*)b->data_buffer, (float*)bp->data_buffer, K, N, transposed);
+	replaceNodeInput(n, b, bp);
+}
+
+// Replace the constant, transposed B input of node n with
+// a copy transposed back at compile time
+void Graph::transpose_gemm_b(Node* n, Tensor* b, int K, int N)
+{
+	Tensor* bt = addConstTensor(b->name + "_transposed", onnx::TensorProto_DataType_FLOAT, {K, N});
+	const float* src = (const float*)b->data_buffer;
+	float* dst = (float*)bt->data_buffer;
+	for( int k=0; k<K; k++ )
+		for( int c=0; c<N; c++ )
+			dst[k * N + c] = src[c * K + k];
+	replaceNodeInput(n, b, bt);
+}
+
+bool Graph::lower_to_blocked_gemm(Node* n)
+{
+	Gemm* gemm = dynamic_cast<Gemm*>(n);
+	MatMul* matmul = dynamic_cast<MatMul*>(n);
+	if( gemm == nullptr && matmul == nullptr )
+		return false;
+	if( (gemm && (gemm->blocked || gemm->gemv)) || (matmul && (matmul->blocked || matmul->gemv)) )
+		return false;
+
+	Tensor* a = n->get_input_tensor(0);
+	Tensor* b = n->get_input_tensor(1);
+	const Tensor* y = n->get_output_tensor(0);
+	if( y->data_type != onnx::TensorProto_DataType_FLOAT && y->data_type != onnx::TensorProto_DataType_DOUBLE )
+		return false;
+	if( b->rank() < 2 || y->isRecursive )
+		return false;
+
+	int M = a->rank() > 1 ? y->data_dim[y->rank() - 2] : 1;
+	int N = y->data_dim[y->rank() - 1];
+	int K = gemm && gemm->transA ? a->data_dim[0] : a->data_dim[a->rank() - 1];
+	bool transposed = gemm && gemm->transB;
+	// A MatMul with the same B for all the matrices of A is one GEMM
+	if( matmul && matmul->folded_rows() > 0 )
+		M = matmul->folded_rows();
+
+	// A constant B shared by all the broadcast matrices of A
+	// is packed at compile time
+	bool shared_b = (int)b->data_num_elem() == K * N;
+	bool prepack = shared_b && isInitializer(b) && b->data_type == onnx::TensorProto_DataType_FLOAT;
+
+	if( M == 1 ) {
+		LOG(DEBUG) << "  lowering " << n->op_name << " " << n->onnx_name << " to a GEMV, "
+		           << N << "x" << K << std::endl;
+		// Adding the rows of B to Y vectorizes better than dot products with its columns
+		if( prepack && transposed ) {
+			transpose_gemm_b(n, b, K, N);
+			gemm->transB = 0;
+		}
+		if( gemm )
+			gemm->gemv = true;
+		else
+			matmul->gemv = true;
+		return true;
+	}
+
+	if( M < BlockedGemm::MR || N < BlockedGemm::NR )
+		return false;
+
+	LOG(DEBUG) << "  lowering " << n->op_name << " " << n->onnx_name << " to a blocked GEMM, "
+	           << M << "x" << N << "x" << K << std::endl;
+	if( prepack )
+		prepack_gemm_b(n, b, K, N, transposed);
+
+	addScratchTensor(n, "Ap", "packed_a", y->data_type, {BlockedGemm::packed_a_size(M, K)});
+	if( prepack == false )
+		addScratchTensor(n, "Bp", "packed_b", y->data_type, {BlockedGemm::packed_b_size(N, K)});
+
+	if( gemm ) {
+		gemm->blocked = true;
+		gemm->prepacked_b = prepack;
+	}
+	else {
+		matmul->blocked = true;
+		matmul->prepacked_b = prepack;
+	}
+	return true;
+}
+
+void Graph::blocked_gemm(void)
+{
+	LOG(DEBUG) << "Optimisation pass: blocked GEMM" << std::endl;
+	unsigned num_lowered = 0;
+
+	if( scratchAllowed("Blocked GEMM") == false )
+		return;
+	// The packed B is read without the AVR program memory accessors
+	if( options.target_avr ) {
+		LOG(INFO) << "Blocked GEMM: not run for AVR targets" << std::endl;
+		return;
+	}
+
+	for( auto n : nodes ) {
+		LOG(TRACE) << "considering node: " << n->onnx_name << std::endl;
+		if( lower_to_blocked_gemm(n) )
+			num_lowered++;
+	}
+
+	LOG(INFO) << "Blocked GEMM: " << num_lowered << " Gemm and MatMul nodes lowered to a blocked GEMM or GEMV" << std::endl;
+}
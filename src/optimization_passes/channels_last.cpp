@@ -0,0 +1,129 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'channels_last' optimization pass.
+ *
+ * ONNX convolutions and poolings use the NCHW layout. With it, the
+ * innermost loops of a convolution step over the spatial positions
+ * of one channel, and the values of neighbouring channels of a pixel
+ * are far apart in memory.
+ *
+ * This pass converts the Conv, MaxPool and AveragePool nodes to the
+ * channels last (NHWC) layout: the loops over the channels become the
+ * innermost ones, and Conv weights are reordered at compile time so
+ * that the input channels of each kernel position are contiguous.
+ *
+ * Each converted node is first wrapped in Transposes to and from the
+ * NHWC layout. The 'fold_transposes' pass is then run, to cancel the
+ * Transposes between neighbouring converted nodes and to sink them
+ * through layout agnostic elementwise nodes. This way Transposes are
+ * left only on the borders of the convolutional parts of the network,
+ * e.g. next to the graph inputs and outputs and before a Flatten.
+ */
+#include "graph.h"
+#include "nodes/spatialfilter.h"
+#include "nodes/transpose.h"
+
+using namespace toC;
+
+// Convert a SpatialFilter node to read and write channels last tensors,
+// with Transposes from and to its original input and output.
+bool Graph::convert_to_channels_last(Node* n)
+{
+	SpatialFilter* sf = dynamic_cast<SpatialFilter*>(n);
+	if( sf == nullptr || sf->channels_last || sf->pool_op != "" )
+		return false;
+	if( n->op_name == "Conv" ) {
+		if( isInitializer(n->get_input_tensor(1)) == false )
+			return false;
+	}
+	else if( n->op_name == "MaxPool" ) {
+		// Indices would refer to the NCHW tensor
+		if( n->is_output_N_used(1) )
+			return false;
+	}
+	else if( n->op_name != "AveragePool" )
+		return false;
+
+	Tensor* x = n->get_input_tensor(0);
+	Tensor* y = n->get_output_tensor(0);
+	unsigned rank = x->rank();
+	if( rank < 3 || y->isRecursive )
+		return false;
+	std::vector<int> to_nhwc = {0};
+	for( unsigned d=2; d<rank; d++ )
+		to_nhwc.push_back(d);
+	to_nhwc.push_back(1);
+	std::vector<int> to_nchw = {0, (int)rank - 1};
+	for( unsigned d=1; d<rank-1; d++ )
+		to_nchw.push_back(d);
+
+	LOG(DEBUG) << "  converting " << n->op_name << " " << n->onnx_name << " to channels last" << std::endl;
+
+	// Weights from (M x C/group x kH x kW) to (M x kH x kW x C/group)
+	if( n->op_name == "Conv" ) {
+		Tensor* w = n->get_input_tensor(1);
+		Tensor* wt = transpose_constant(w, to_nhwc);
+		replaceNodeInput(n, w, wt);
+	}
+
+	// Input: reuse the Transpose made for another node reading the same tensor
+	Tensor* xt = nullptr;
+	for( auto c : x->consumers ) {
+		Transpose* t = dynamic_cast<Transpose*>(c);
+		if( t && t->perm == to_nhwc && t->get_output_tensor(0)->isIO == false )
+			xt = t->get_output_tensor(0);
+	}
+	if( xt == nullptr ) {
+		onnx::NodeProto proto;
+		proto.set_op_type("Transpose");
+		proto.add_input(x->name);
+		proto.add_output(uniqueName(x->name + "_nhwc"));
+		addIntsAttribute(proto, "perm", std::vector<int64_t>(to_nhwc.begin(), to_nhwc.end()));
+		xt = insertNode(proto, n)->get_output_tensor(0);
+	}
+	n->replace_input(x, xt);
+	std::erase(x->consumers, n);
+	xt->consumers.push_back(n);
+
+	// Output: the node writes a new channels last tensor,
+	// and a Transpose of it takes over the original output
+	Tensor* yt = new Tensor;
+	yt->data_type = y->data_type;
+	yt->name = uniqueName(y->name + "_nhwc");
+	for( int p : to_nhwc )
+		yt->data_dim.push_back(y->data_dim[p]);
+	addTensor(yt);
+	n->replace_output(y, yt);
+
+	onnx::NodeProto proto;
+	proto.set_op_type("Transpose");
+	proto.add_input(yt->name);
+	proto.add_output(uniqueName(y->name + "_nchw"));
+	addIntsAttribute(proto, "perm", std::vector<int64_t>(to_nchw.begin(), to_nchw.end()));
+	Node* t_out = insertNode(proto, n);
+	moveNodeAfter(t_out, n);
+	takeOverOutput(t_out, 0, y);
+
+	sf->channels_last = true;
+	return true;
+}
+
+void Graph::channels_last(void)
+{
+	LOG(DEBUG) << "Optimisation pass: channels last" << std::endl;
+	unsigned num_converted = 0;
+
+	// Nodes are added while iterating
+	std::vector<Node*> original_nodes = nodes;
+	for( auto n : original_nodes ) {
+		LOG(TRACE) << "considering node: " << n->onnx_name << std::endl;
+		if( convert_to_channels_last(n) )
+			num_converted++;
+	}
+
+	LOG(INFO) << "Channels last: " << num_converted << " nodes converted to channels last layout" << std::endl;
+
+	// Remove the Transposes between the converted nodes
+	if( num_converted > 0 )
+		fold_transposes();
+}
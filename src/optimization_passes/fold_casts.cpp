@@ -1,83 +1,271 @@
 /* This file is part of onnx2c.
  *
  * Implemented here is the 'fold_casts' optimization pass
- * that tires to remove Cast nodes.
+ * that tires to remove Cast nodes:
+ *  - Casts to the type the input already has are removed
+ *  - Casts of constants are calculated at compile time
+ *  - Cast chains, where the first Cast does not lose
+ *    information, are shortcut to one Cast
+ *  - several Casts of the same tensor to the same type are merged
+ *  - the remaining Casts are folded to their predecessor,
+ *    i.e. the predecessor node calculates its output directly
+ *    in the type the Cast would produce. Only elementwise
+ *    predecessors can do this.
  */
 #include "graph.h"
+#include "nodes/elementwise.h"
+#include "nodes/elementwise_2.h"
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <map>
+#include <utility>
 
 using namespace toC;
 
+// Can all values of type 'from' be represented in 'to'.
+static bool cast_is_exact(onnx::TensorProto_DataType from, onnx::TensorProto_DataType to)
+{
+	if( from == to )
+		return true;
+	switch( from ) {
+		case onnx::TensorProto_DataType_BOOL:
+		case onnx::TensorProto_DataType_INT8:
+		case onnx::TensorProto_DataType_UINT8:
+		case onnx::TensorProto_DataType_INT16:
+		case onnx::TensorProto_DataType_UINT16:
+			return to == onnx::TensorProto_DataType_INT32
+			    || to == onnx::TensorProto_DataType_INT64
+			    || to == onnx::TensorProto_DataType_FLOAT
+			    || to == onnx::TensorProto_DataType_DOUBLE;
+		case onnx::TensorProto_DataType_INT32:
+			return to == onnx::TensorProto_DataType_INT64
+			    || to == onnx::TensorProto_DataType_DOUBLE;
+		case onnx::TensorProto_DataType_UINT32:
+			return to == onnx::TensorProto_DataType_INT64
+			    || to == onnx::TensorProto_DataType_DOUBLE;
+		case onnx::TensorProto_DataType_FLOAT:
+			return to == onnx::TensorProto_DataType_DOUBLE;
+		default:
+			return false;
+	}
+}
+
+// Types whose constants can be Cast at compile time.
+// FLOAT16 and BFLOAT16 are left to the generated code.
+static bool can_cast_constant(onnx::TensorProto_DataType type)
+{
+	switch( type ) {
+		case onnx::TensorProto_DataType_FLOAT:
+		case onnx::TensorProto_DataType_DOUBLE:
+		case onnx::TensorProto_DataType_BOOL:
+		case onnx::TensorProto_DataType_INT8:
+		case onnx::TensorProto_DataType_UINT8:
+		case onnx::TensorProto_DataType_INT16:
+		case onnx::TensorProto_DataType_UINT16:
+		case onnx::TensorProto_DataType_INT32:
+		case onnx::TensorProto_DataType_UINT32:
+		case onnx::TensorProto_DataType_INT64:
+		case onnx::TensorProto_DataType_UINT64:
+			return true;
+		default:
+			return false;
+	}
+}
+
+template <typename T>
+static T cast_element(const Tensor* t, int i)
+{
+	switch( t->data_type ) {
+		case onnx::TensorProto_DataType_FLOAT: return (T)((float*)t->data_buffer)[i];
+		case onnx::TensorProto_DataType_DOUBLE: return (T)((double*)t->data_buffer)[i];
+		case onnx::TensorProto_DataType_BOOL: return (T)((bool*)t->data_buffer)[i];
+		case onnx::TensorProto_DataType_INT8: return (T)((int8_t*)t->data_buffer)[i];
+		case onnx::TensorProto_DataType_UINT8: return (T)((uint8_t*)t->data_buffer)[i];
+		case onnx::TensorProto_DataType_INT16: return (T)((int16_t*)t->data_buffer)[i];
+		case onnx::TensorProto_DataType_UINT16: return (T)((uint16_t*)t->data_buffer)[i];
+		case onnx::TensorProto_DataType_INT32: return (T)((int32_t*)t->data_buffer)[i];
+		case onnx::TensorProto_DataType_UINT32: return (T)((uint32_t*)t->data_buffer)[i];
+		case onnx::TensorProto_DataType_INT64: return (T)((int64_t*)t->data_buffer)[i];
+		case onnx::TensorProto_DataType_UINT64: return (T)((uint64_t*)t->data_buffer)[i];
+		default:
+			ERROR("Unhandled data type in constant Cast");
+	}
+}
+
+template <typename T>
+static void cast_elements(Tensor* dst, const Tensor* src)
+{
+	for( int i=0; i<src->data_num_elem(); i++ )
+		((T*)dst->data_buffer)[i] = cast_element<T>(src, i);
+}
+
+// Calculate the Cast of a constant tensor
+Tensor* Graph::cast_constant(const Tensor* c, onnx::TensorProto_DataType type)
+{
+	Tensor* rv = addConstTensor(c->name + "_cast", type, c->data_dim);
+	switch( type ) {
+		case onnx::TensorProto_DataType_FLOAT: cast_elements<float>(rv, c); break;
+		case onnx::TensorProto_DataType_DOUBLE: cast_elements<double>(rv, c); break;
+		case onnx::TensorProto_DataType_BOOL: cast_elements<bool>(rv, c); break;
+		case onnx::TensorProto_DataType_INT8: cast_elements<int8_t>(rv, c); break;
+		case onnx::TensorProto_DataType_UINT8: cast_elements<uint8_t>(rv, c); break;
+		case onnx::TensorProto_DataType_INT16: cast_elements<int16_t>(rv, c); break;
+		case onnx::TensorProto_DataType_UINT16: cast_elements<uint16_t>(rv, c); break;
+		case onnx::TensorProto_DataType_INT32: cast_elements<int32_t>(rv, c); break;
+		case onnx::TensorProto_DataType_UINT32: cast_elements<uint32_t>(rv, c); break;
+		case onnx::TensorProto_DataType_INT64: cast_elements<int64_t>(rv, c); break;
+		case onnx::TensorProto_DataType_UINT64: cast_elements<uint64_t>(rv, c); break;
+		default:
+			ERROR("Unhandled data type in constant Cast");
+	}
+	return rv;
+}
+
+// Nodes that assign each output element once, from an expression
+// calculated in the input type. Storing that to an output of another
+// type converts it the same way a Cast would.
+// Most other nodes either accumulate into the output, or access it
+// through a pointer of the input type, so Casts can't be folded into them.
+static bool can_fold_cast_into(const Node* n)
+{
+	return dynamic_cast<const Elementwise*>(n) != nullptr
+	    || dynamic_cast<const Elementwise_2*>(n) != nullptr;
+}
+
 void Graph::fold_casts(void)
 {
 	LOG(DEBUG) << "Optimisation pass: fold casts"<< std::endl;
-	std::vector<Node*> removed_nodes;
+	unsigned num_noop = 0, num_const = 0, num_chain = 0, num_merged = 0, num_folded = 0;
+	std::vector<std::pair<Node*, std::string>> remaining;
 
-	// Loop over all Cast nodes
-	for( auto n : nodes ) {
-		if( n->op_name != "Cast" ) {
-			LOG(TRACE) << n->onnx_name << " is not a Cast node, ignoring."<< std::endl;
-			continue;
-		}
-		LOG(DEBUG) << "considering 'Cast' Node: " << n->onnx_name << std::endl;
-
-
-		// If the Cast node's input has other users
-		// the transformation becomes too difficult.
-		// The input generating Predecessor node
-		// would now need to generate two different
-		// outputs, one for the folded cast, one of
-		// the other user(s).
-		// Skip folding these Cast nodes.
-		assert(n->get_number_of_inputs() == 1);
-		Tensor *input_tensor = n->get_input_tensor(0);
-		Tensor *output_tensor = n->get_output_tensor(0);
-		if( input_tensor->consumers.size() != 1 ) {
-			LOG(DEBUG) << "  skipping. Input tensor has other users."<< std::endl;
-			continue;
-		}
+	bool changed;
+	do {
+		changed = false;
+		remaining.clear();
+		for( auto n : nodes ) {
+			if( n->op_name != "Cast" ) {
+				LOG(TRACE) << n->onnx_name << " is not a Cast node, ignoring."<< std::endl;
+				continue;
+			}
+			LOG(DEBUG) << "considering 'Cast' Node: " << n->onnx_name << std::endl;
 
+			assert(n->get_number_of_inputs() == 1);
+			Tensor *input_tensor = n->get_input_tensor(0);
+			Tensor *output_tensor = n->get_output_tensor(0);
+			Node *producer = findProducer(input_tensor);
 
-		// We should not modify the type of graph inputs or outputs
-		// as this would change the graph's interface.
-		if( output_tensor->isIO || input_tensor->isIO ) {
-			LOG(WARNING) << "   Cast is input or output tensor." << std::endl;
-			continue;
-		}
+			// Cast to the same type
+			if( input_tensor->data_type == output_tensor->data_type && output_tensor->isIO == false ) {
+				LOG(DEBUG) << "  removing no-op Cast."<< std::endl;
+				replaceTensorUsers(output_tensor, input_tensor);
+				removeNode(n);
+				num_noop++;
+				changed = true;
+				break;
+			}
 
+			// Cast of a constant
+			if( input_tensor->isConst && input_tensor->data_buffer && input_tensor->isIO == false
+			    && output_tensor->isIO == false
+			    && can_cast_constant(input_tensor->data_type) && can_cast_constant(output_tensor->data_type) ) {
+				LOG(DEBUG) << "  calculating Cast of a constant at compile time."<< std::endl;
+				Tensor *c = cast_constant(input_tensor, output_tensor->data_type);
+				replaceTensorUsers(output_tensor, c);
+				removeNode(n);
+				num_const++;
+				changed = true;
+				break;
+			}
 
-		LOG(DEBUG) << "  folding away this Cast node."<< std::endl;
-		// Modify the Predecessor node's output to
-		// match the type of the Cast node's output.
-		onnx::TensorProto_DataType cast_to_type;
-		cast_to_type = output_tensor->data_type;
-		input_tensor->data_type = cast_to_type;
-
-		// Replace the Cast output tensor's users input
-		// with the Predecessor node output. I.e. bypass
-		// the cast node.
-		for( auto cn : output_tensor->consumers ) {
-			bool replaced;
-			replaced = cn->replace_input(output_tensor, input_tensor );
-			if( !replaced ) {
-				LOG(FATAL) << output_tensor->name << " was not replaced" << std::endl;
+			// Cast -> Cast, where the first one is lossless.
+			// E.g. int8->float->double is the same as int8->double
+			if( producer && producer->op_name == "Cast"
+			    && cast_is_exact(producer->get_input_tensor(0)->data_type, input_tensor->data_type) ) {
+				LOG(DEBUG) << "  shortcutting Cast chain."<< std::endl;
+				Tensor *chain_input = producer->get_input_tensor(0);
+				n->replace_input(input_tensor, chain_input);
+				chain_input->consumers.push_back(n);
+				std::erase(input_tensor->consumers, n);
+				if( input_tensor->consumers.size() == 0 && input_tensor->isIO == false )
+					removeNode(producer);
+				num_chain++;
+				changed = true;
+				break;
 			}
-			else {
-				std::erase(tensors, output_tensor);
-				delete output_tensor;
+
+			// Several Casts of the same tensor to the same type.
+			// Only later duplicates are merged into this Cast, so it
+			// is calculated before any users of the merged ones.
+			auto later_nodes = std::find(nodes.begin(), nodes.end(), n) + 1;
+			Node *duplicate = nullptr;
+			for( auto c : input_tensor->consumers )
+				if( c->op_name == "Cast"
+				    && std::find(later_nodes, nodes.end(), c) != nodes.end()
+				    && c->get_output_tensor(0)->data_type == output_tensor->data_type
+				    && c->get_output_tensor(0)->isIO == false )
+					duplicate = c;
+			if( duplicate ) {
+				LOG(DEBUG) << "  merging Cast " << duplicate->onnx_name << " into this one" << std::endl;
+				replaceTensorUsers(duplicate->get_output_tensor(0), output_tensor);
+				removeNode(duplicate);
+				num_merged++;
+				changed = true;
+				break;
 			}
+
+			// If the Cast node's input has other users
+			// the transformation becomes too difficult.
+			// The input generating Predecessor node
+			// would now need to generate two different
+			// outputs, one for the folded cast, one of
+			// the other user(s).
+			// Skip folding these Cast nodes.
+			if( input_tensor->isIO ) {
+				remaining.push_back({n, "input is a graph input"});
+				continue;
+			}
+			if( input_tensor->consumers.size() != 1 ) {
+				remaining.push_back({n, "input has other users"});
+				continue;
+			}
+			if( producer == nullptr || can_fold_cast_into(producer) == false ) {
+				remaining.push_back({n, "predecessor can't calculate in the Cast's output type"});
+				continue;
+			}
+			if( input_tensor->isRecursive ) {
+				remaining.push_back({n, "input is a recursive tensor"});
+				continue;
+			}
+
+			// Make the Predecessor node write to the Cast node's
+			// output, in the Cast node's output type. I.e. bypass
+			// the cast node.
+			// This keeps the Cast output, so it works for graph outputs too.
+			LOG(DEBUG) << "  folding away this Cast node."<< std::endl;
+			producer->replace_output(input_tensor, output_tensor);
+			input_tensor->consumers.clear();
+			removeNode(n);
+			dropTensor(input_tensor);
+			num_folded++;
+			changed = true;
+			break;
 		}
+	} while( changed );
 
-		// Mark the now orphaned Cast node for removal
-		removed_nodes.push_back(n);
-	}
+	for( auto& r : remaining )
+		LOG(DEBUG) << "  Cast " << r.first->onnx_name << " not folded: " << r.second << std::endl;
+	std::map<std::string, unsigned> reasons;
+	for( auto& r : remaining )
+		reasons[r.second]++;
 
-	for( auto rn : removed_nodes ) {
-		std::erase(nodes, rn);
-		delete rn;
-	}
+	LOG(INFO) << "Fold casts: " << num_folded << " folded to predecessor, "
+	          << num_const << " calculated at compile time, "
+	          << num_noop << " no-op removed, "
+	          << num_chain << " chains shortcut, "
+	          << num_merged << " duplicates merged. "
+	          << remaining.size() << " Casts remain" << std::endl;
+	for( auto& r : reasons )
+		LOG(INFO) << "  " << r.second << " Casts remain: " << r.first << std::endl;
 	LOG(TRACE) << "folding Cast nodes finished" << std::endl;
 }
-
-
@@ -0,0 +1,115 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'fold_pads' optimization pass.
+ *
+ * A Pad node followed by a Conv or pooling node makes a padded
+ * copy of the whole input. The Conv and pooling nodes can do the same
+ * padding without the copy, by skipping the out-of-bounds input
+ * elements. This pass moves the Pad node's paddings into the
+ * 'pads' attribute of the following node, when skipping the padded
+ * elements gives the same result:
+ *  - Conv with padding by zeros
+ *  - AveragePool with padding by zeros, when the padding
+ *    is counted into the average
+ *  - MaxPool with padding by -inf
+ */
+#include "graph.h"
+#include "nodes/pad.h"
+#include "nodes/pooling.h"
+#include <cmath>
+
+using namespace toC;
+
+// Pad -> Conv/MaxPool/AveragePool
+// becomes
+// Conv/MaxPool/AveragePool with the paddings added to 'pads'
+bool Graph::fold_pad(Pad* pad)
+{
+	Tensor* x = pad->get_input_tensor(0);
+	Tensor* padded = pad->get_output_tensor(0);
+	if( padded->isIO || padded->consumers.size() != 1 )
+		return false;
+	Node* consumer = padded->consumers[0];
+	SpatialFilter* sf = dynamic_cast<SpatialFilter*>(consumer);
+	if( sf == nullptr || sf->get_X() != padded )
+		return false;
+	if( pad->mode != "constant" || sf->auto_pad == "SAME_UPPER" || sf->auto_pad == "SAME_LOWER" )
+		return false;
+	if( x->data_type != padded->data_type )
+		return false;
+
+	// Only the spatial dimensions can be padded
+	unsigned rank = padded->rank();
+	if( pad->paddings_start.size() != rank || pad->paddings_end.size() != rank )
+		return false;
+	for( unsigned d=0; d<rank; d++ ) {
+		if( pad->paddings_start[d] < 0 || pad->paddings_end[d] < 0 )
+			return false;
+		if( d < 2 && (pad->paddings_start[d] != 0 || pad->paddings_end[d] != 0) )
+			return false;
+	}
+
+	if( consumer->op_name == "Conv" ) {
+		if( pad->constant != 0 )
+			return false;
+	}
+	else if( consumer->op_name == "MaxPool" ) {
+		if( std::isinf(pad->constant) == false || pad->constant > 0 )
+			return false;
+		// Indices would refer to the padded tensor
+		if( consumer->is_output_N_used(1) )
+			return false;
+	}
+	else if( consumer->op_name == "AveragePool" ) {
+		Pooling* pool = dynamic_cast<Pooling*>(consumer);
+		if( pad->constant != 0 || pool->ceil_mode )
+			return false;
+		bool own_pads = false;
+		for( auto p : pool->pads )
+			own_pads |= p != 0;
+		// The node's own padding must stay out of the average
+		if( pool->count_include_pad == 0 && own_pads )
+			return false;
+		pool->count_include_pad = 1;
+	}
+	else
+		return false;
+
+	LOG(DEBUG) << "  folding Pad " << pad->onnx_name << " into " << consumer->onnx_name << std::endl;
+	unsigned num_data_dim = rank - 2;
+	for( unsigned i=0; i<num_data_dim; i++ ) {
+		sf->pads[i] += pad->paddings_start[2 + i];
+		sf->pads[i + num_data_dim] += pad->paddings_end[2 + i];
+	}
+	sf->auto_pad = "NOTSET";
+
+	consumer->replace_input(padded, x);
+	x->consumers.push_back(consumer);
+	padded->consumers.clear();
+	removeNode(pad);
+	return true;
+}
+
+void Graph::fold_pads(void)
+{
+	LOG(DEBUG) << "Optimisation pass: fold pads" << std::endl;
+	unsigned num_folded = 0;
+
+	bool changed;
+	do {
+		changed = false;
+		for( auto n : nodes ) {
+			Pad* pad = dynamic_cast<Pad*>(n);
+			if( pad == nullptr )
+				continue;
+			LOG(TRACE) << "considering Pad node: " << pad->onnx_name << std::endl;
+			if( fold_pad(pad) ) {
+				num_folded++;
+				changed = true;
+				break;
+			}
+		}
+	} while( changed );
+
+	LOG(INFO) << "Fold pads: " << num_folded << " Pad nodes folded into the following node" << std::endl;
+}
@@ -0,0 +1,376 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'fold_transposes' optimization pass.
+ *
+ * Models converted from NHWC frameworks (TF, TFLite) wrap
+ * most nodes into Transposes. Each Transpose is a full copy
+ * of its input, so this pass tries to get rid of them:
+ *  - Transposes of constants are calculated at compile time
+ *  - consecutive Transposes are merged into one, and if the
+ *    merged permutation is the identity, it is removed
+ *  - Transposes are sunk below layout agnostic elementwise nodes.
+ *    This way pairs of inverse Transposes meet, and get merged away.
+ *  - a 2D Transpose feeding a Gemm or MatMul is folded into
+ *    the transA/transB attributes of a Gemm.
+ */
+#include "graph.h"
+#include "nodes/elementwise.h"
+#include "nodes/elementwise_2.h"
+#include "nodes/gemm.h"
+#include "nodes/transpose.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace toC;
+
+static bool is_identity(const std::vector<int>& perm)
+{
+	for( unsigned i=0; i<perm.size(); i++ )
+		if( perm[i] != (int)i )
+			return false;
+	return true;
+}
+
+// Transpose with 'first', then 'second' == Transpose with the returned
+static std::vector<int> compose(const std::vector<int>& first, const std::vector<int>& second)
+{
+	std::vector<int> rv;
+	for( int p : second )
+		rv.push_back(first[p]);
+	return rv;
+}
+
+static std::vector<int> invert(const std::vector<int>& perm)
+{
+	std::vector<int> rv(perm.size());
+	for( unsigned i=0; i<perm.size(); i++ )
+		rv[perm[i]] = i;
+	return rv;
+}
+
+// Nodes that calculate each output element from the input
+// element in the same position, and so don't care about the
+// order of the dimensions.
+static bool is_unary_elementwise(const Node* n)
+{
+	if( dynamic_cast<const Elementwise*>(n) )
+		return true;
+	if( n->op_name == "Relu" || n->op_name == "Identity" || n->op_name == "Cast" )
+		return true;
+	// Clip limits are scalars
+	if( n->op_name == "Clip" )
+		return true;
+	// Dropout, unless the mask output is used
+	if( n->op_name == "Dropout" )
+		return n->is_output_N_used(1) == false;
+	return false;
+}
+
+// Transpose the contents of a constant tensor.
+// The tensor is first broadcast (i.e. prefixed with dimensions of size 1)
+// to the length of perm.
+Tensor* Graph::transpose_constant(const Tensor* c, const std::vector<int>& perm)
+{
+	std::vector<int> in_dim = c->data_dim;
+	while( in_dim.size() < perm.size() )
+		in_dim.insert(in_dim.begin(), 1);
+	std::vector<int> out_dim;
+	for( int p : perm )
+		out_dim.push_back(in_dim[p]);
+
+	Tensor* rv = addConstTensor(c->name + "_transposed", c->data_type, out_dim);
+	unsigned elem_size = c->data_elem_size();
+	unsigned rank = in_dim.size();
+	std::vector<int> in_idx(rank, 0);
+	for( int i=0; i<c->data_num_elem(); i++ ) {
+		// i -> in_idx
+		int rem = i;
+		for( int d=rank-1; d>=0; d-- ) {
+			in_idx[d] = rem % in_dim[d];
+			rem /= in_dim[d];
+		}
+		// out_idx[d] = in_idx[perm[d]]
+		int o = 0;
+		for( unsigned d=0; d<rank; d++ )
+			o = o*out_dim[d] + in_idx[perm[d]];
+		memcpy((char*)rv->data_buffer + o*elem_size, (char*)c->data_buffer + i*elem_size, elem_size);
+	}
+	return rv;
+}
+
+// Replace the output of a Transpose node with its input.
+// Only for Transposes that don't change the data layout
+bool Graph::bypass_transpose(Transpose* t)
+{
+	Tensor* in = t->get_input_tensor(0);
+	Tensor* out = t->get_output_tensor(0);
+	if( out->isIO )
+		return false;
+	// Not quite a no-op: e.g. [1,5] -> [5,1]
+	if( in->data_dim != out->data_dim )
+		return false;
+	LOG(DEBUG) << "  removing no-op Transpose " << t->onnx_name << std::endl;
+	replaceTensorUsers(out, in);
+	removeNode(t);
+	return true;
+}
+
+// Transpose -> unary elementwise node E
+// becomes
+// E -> Transpose
+bool Graph::sink_transpose_unary(Transpose* t, Node* e)
+{
+	Tensor* x = t->get_input_tensor(0);
+	Tensor* a = t->get_output_tensor(0);
+	Tensor* b = e->get_output_tensor(0);
+
+	if( e->get_input_tensor(0) != a )
+		return false;
+	for( unsigned i=1; i<e->get_number_of_inputs(); i++ )
+		if( e->get_input_tensor(i) == a )
+			return false;
+
+	LOG(DEBUG) << "  sinking Transpose " << t->onnx_name << " below " << e->onnx_name << std::endl;
+	e->replace_input(a, x);
+	x->consumers.push_back(e);
+	std::erase(x->consumers, t);
+
+	// Reuse tensor 'a' as the link between E and the Transpose
+	a->data_dim = x->data_dim;
+	a->data_type = b->data_type;
+	a->consumers.clear();
+	a->consumers.push_back(t);
+	e->replace_output(b, a);
+	t->replace_output(a, b);
+	t->replace_input(x, a);
+
+	moveNodeAfter(t, e);
+	return true;
+}
+
+// Transpose -> binary elementwise node E
+// becomes
+// E -> Transpose
+// when the other input of E can be transposed back at
+// compile time, or is another Transpose with the same permutation.
+bool Graph::sink_transpose_binary(Transpose* t, Node* e)
+{
+	Tensor* x = t->get_input_tensor(0);
+	Tensor* a = t->get_output_tensor(0);
+	Tensor* b = e->get_output_tensor(0);
+
+	unsigned a_idx = e->get_input_tensor(0) == a ? 0 : 1;
+	Tensor* other = e->get_input_tensor(1 - a_idx);
+	Tensor* other_replacement = nullptr;
+	Transpose* other_transpose = dynamic_cast<Transpose*>(findProducer(other));
+
+	if( other == a )
+		other_replacement = x;
+	else if( other->rank() > a->rank() )
+		return false;
+	else if( other->data_num_elem() == 1 )
+		// scalars broadcast to any layout
+		other_replacement = other;
+	else if( other_transpose
+	         && other_transpose->perm == t->perm
+	         && other->consumers.size() == 1
+	         && other->isIO == false )
+		other_replacement = other_transpose->get_input_tensor(0);
+	else if( isInitializer(other) )
+		other_replacement = transpose_constant(other, invert(t->perm));
+	else
+		return false;
+
+	// Check the result of E is the same shape in the new layout
+	std::vector<int> new_dim;
+	std::vector<int> o_dim = other_replacement->data_dim;
+	if( o_dim.size() > x->rank() )
+		return false;
+	while( o_dim.size() < x->rank() )
+		o_dim.insert(o_dim.begin(), 1);
+	for( unsigned d=0; d<x->rank(); d++ ) {
+		if( x->data_dim[d] != o_dim[d] && x->data_dim[d] != 1 && o_dim[d] != 1 )
+			return false;
+		new_dim.push_back(std::max(x->data_dim[d], o_dim[d]));
+	}
+	std::vector<int> check_dim;
+	for( int p : t->perm )
+		check_dim.push_back(new_dim[p]);
+	if( check_dim != b->data_dim ) {
+		if( other_replacement->consumers.size() == 0 && isInitializer(other_replacement) ) {
+			std::erase(tensors, other_replacement);
+			delete other_replacement;
+		}
+		return false;
+	}
+
+	LOG(DEBUG) << "  sinking Transpose " << t->onnx_name << " below " << e->onnx_name << std::endl;
+	if( other != other_replacement && other != a ) {
+		e->replace_input(other, other_replacement);
+		std::erase(other->consumers, e);
+		other_replacement->consumers.push_back(e);
+		if( other_transpose )
+			removeNode(other_transpose);
+		else if( other->consumers.size() == 0 ) {
+			std::erase(tensors, other);
+			delete other;
+		}
+	}
+	while( e->replace_input(a, x) )
+		;
+	x->consumers.push_back(e);
+	std::erase(x->consumers, t);
+
+	a->data_dim = new_dim;
+	a->data_type = b->data_type;
+	a->consumers.clear();
+	a->consumers.push_back(t);
+	e->replace_output(b, a);
+	t->replace_output(a, b);
+	t->replace_input(x, a);
+
+	moveNodeAfter(t, e);
+	return true;
+}
+
+// A 2D Transpose feeding a Gemm, or a MatMul of matrices.
+// Fold the Transpose into the Gemm's transA/transB attributes.
+bool Graph::fold_transpose_into_gemm(Transpose* t, Node* consumer)
+{
+	Tensor* x = t->get_input_tensor(0);
+	Tensor* a = t->get_output_tensor(0);
+	if( a->rank() != 2 || t->perm != std::vector<int>({1, 0}) )
+		return false;
+
+	Gemm* gemm = dynamic_cast<Gemm*>(consumer);
+	if( gemm ) {
+		// Transpose used as the bias. Leave it be.
+		if( gemm->get_number_of_inputs() > 2 && gemm->get_input_tensor(2) == a )
+			return false;
+		for( unsigned i=0; i<2; i++ ) {
+			if( gemm->get_input_tensor(i) != a )
+				continue;
+			gemm->replace_input(a, x);
+			if( i == 0 )
+				gemm->transA = !gemm->transA;
+			else
+				gemm->transB = !gemm->transB;
+		}
+		x->consumers.push_back(gemm);
+		std::erase(a->consumers, gemm);
+		LOG(DEBUG) << "  folded Transpose " << t->onnx_name << " into Gemm " << gemm->onnx_name << std::endl;
+		return true;
+	}
+
+	if( consumer->op_name != "MatMul" )
+		return false;
+	Tensor* A = consumer->get_input_tensor(0);
+	Tensor* B = consumer->get_input_tensor(1);
+	Tensor* Y = consumer->get_output_tensor(0);
+	// Gemm does all arithmetic in float
+	if( A->rank() != 2 || B->rank() != 2 || A->data_type != onnx::TensorProto_DataType_FLOAT )
+		return false;
+
+	onnx::NodeProto gemm_proto;
+	gemm_proto.set_name(uniqueName(consumer->onnx_name + "_gemm"));
+	gemm_proto.set_op_type("Gemm");
+	gemm_proto.add_input(A == a ? x->name : A->name);
+	gemm_proto.add_input(B == a ? x->name : B->name);
+	gemm_proto.add_output(uniqueName(Y->name + "_gemm"));
+	addIntAttribute(gemm_proto, "transA", A == a);
+	addIntAttribute(gemm_proto, "transB", B == a);
+
+	Node* g = insertNode(gemm_proto, consumer);
+	takeOverOutput(g, 0, Y);
+	removeNode(consumer);
+	LOG(DEBUG) << "  folded Transpose " << t->onnx_name << " into Gemm " << g->onnx_name << std::endl;
+	return true;
+}
+
+void Graph::fold_transposes(void)
+{
+	LOG(DEBUG) << "Optimisation pass: fold transposes" << std::endl;
+	unsigned num_constant = 0, num_merged = 0, num_removed = 0, num_sunk = 0, num_folded = 0;
+
+	bool changed;
+	do {
+		changed = false;
+		for( auto n : nodes ) {
+			Transpose* t = dynamic_cast<Transpose*>(n);
+			if( t == nullptr )
+				continue;
+			Tensor* x = t->get_input_tensor(0);
+			Tensor* a = t->get_output_tensor(0);
+			LOG(TRACE) << "considering Transpose node: " << t->onnx_name << std::endl;
+
+			// Transpose of a constant: do it now.
+			if( isInitializer(x) && a->isIO == false ) {
+				Tensor* c = transpose_constant(x, t->perm);
+				LOG(DEBUG) << "  calculated Transpose " << t->onnx_name << " at compile time" << std::endl;
+				replaceTensorUsers(a, c);
+				removeNode(t);
+				num_constant++;
+				changed = true;
+				break;
+			}
+
+			// Transpose -> Transpose: merge into the latter one
+			Transpose* prev = dynamic_cast<Transpose*>(findProducer(x));
+			if( prev ) {
+				Tensor* prev_in = prev->get_input_tensor(0);
+				LOG(DEBUG) << "  merging Transpose " << prev->onnx_name << " into " << t->onnx_name << std::endl;
+				t->perm = compose(prev->perm, t->perm);
+				t->replace_input(x, prev_in);
+				std::erase(x->consumers, t);
+				prev_in->consumers.push_back(t);
+				if( x->consumers.size() == 0 && x->isIO == false )
+					removeNode(prev);
+				num_merged++;
+				changed = true;
+				break;
+			}
+
+			if( is_identity(t->perm) && bypass_transpose(t) ) {
+				num_removed++;
+				changed = true;
+				break;
+			}
+
+			// Fold into Gemm operand access
+			bool folded = false;
+			std::vector<Node*> users = a->consumers;
+			for( auto c : users )
+				folded |= fold_transpose_into_gemm(t, c);
+			if( folded ) {
+				if( a->consumers.size() == 0 && a->isIO == false )
+					removeNode(t);
+				num_folded++;
+				changed = true;
+				break;
+			}
+
+			// Sink below elementwise nodes
+			if( a->isIO || a->consumers.size() != 1 )
+				continue;
+			Node* e = a->consumers[0];
+			if( e->get_number_of_outputs() < 1 )
+				continue;
+			bool sunk = false;
+			if( is_unary_elementwise(e) )
+				sunk = sink_transpose_unary(t, e);
+			else if( dynamic_cast<Elementwise_2*>(e) )
+				sunk = sink_transpose_binary(t, e);
+			if( sunk ) {
+				num_sunk++;
+				changed = true;
+				break;
+			}
+		}
+	} while( changed );
+
+	LOG(INFO) << "Fold transposes: " << num_constant << " calculated at compile time, "
+	          << num_merged << " merged, "
+	          << num_removed << " removed as no-op, "
+	          << num_folded << " folded into Gemm, "
+	          << num_sunk << " sunk below elementwise nodes" << std::endl;
+}
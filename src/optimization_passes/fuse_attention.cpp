@@ -0,0 +1,183 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'fuse_attention' optimization pass.
+ *
+ * Transformer blocks export scaled dot product attention as
+ *   MatMul(Q, K^T) -> Div or Mul by scale -> Add mask -> Softmax -> MatMul(., V)
+ * where the scale and the mask are optional. The output of the first
+ * MatMul is a [q_seq x kv_seq] score matrix for each head, which
+ * onnx2c would store in full.
+ *
+ * This pass replaces the subgraph with an Attention node, that
+ * calculates the output one query row at a time, and never stores
+ * the scores.
+ */
+#include "graph.h"
+#include "nodes/softmax.h"
+#include "nodes/transpose.h"
+
+using namespace toC;
+
+// An intermediate tensor, used only by the next node of the subgraph
+static bool is_internal(const Tensor* t)
+{
+	return t->isIO == false && t->consumers.size() == 1;
+}
+
+// The constant scalar value of t, or false if t is not one
+static bool get_scalar_constant(const Tensor* t, float& value)
+{
+	if( t->isConst == false || t->data_buffer == nullptr || t->isIO || t->data_num_elem() != 1 )
+		return false;
+	if( t->data_type != onnx::TensorProto_DataType_FLOAT )
+		return false;
+	value = t->get_data_element_float(0);
+	return true;
+}
+
+// Softmax -> MatMul(., V), with the Softmax input calculated by
+// MatMul(Q, K^T) [-> Div/Mul by scale] [-> Add mask]
+bool Graph::fuse_attention_at(Node* softmax)
+{
+	Softmax* sm = dynamic_cast<Softmax*>(softmax);
+	if( sm == nullptr || sm->is_log_softmax )
+		return false;
+	Tensor* scores = sm->get_input_tensor(0);
+	Tensor* probs = sm->get_output_tensor(0);
+	unsigned rank = scores->rank();
+	if( rank != 3 && rank != 4 )
+		return false;
+	if( sm->axis != -1 && sm->axis != (int)rank - 1 )
+		return false;
+	if( scores->data_type != onnx::TensorProto_DataType_FLOAT )
+		return false;
+	if( is_internal(probs) == false || probs->consumers[0]->op_name != "MatMul" )
+		return false;
+	Node* pv = probs->consumers[0];
+	if( pv->get_number_of_inputs() != 2 || pv->get_input_tensor(0) != probs || pv->get_input_tensor(1) == probs )
+		return false;
+	Tensor* v = pv->get_input_tensor(1);
+
+	// Walk up from the Softmax through the optional mask and scale
+	std::vector<Node*> subgraph = {pv, sm};
+	Tensor* t = scores;
+	Tensor* mask = nullptr;
+	float scale = 1;
+	Node* producer = findProducer(t);
+	if( producer && producer->op_name == "Add" && is_internal(t) ) {
+		Tensor* a = producer->get_input_tensor(0);
+		Tensor* b = producer->get_input_tensor(1);
+		// The other input is the mask
+		Node* a_producer = findProducer(a);
+		bool a_is_scores = a_producer && is_internal(a)
+		    && (a_producer->op_name == "MatMul" || a_producer->op_name == "Mul" || a_producer->op_name == "Div");
+		Tensor* in = a_is_scores ? a : b;
+		mask = a_is_scores ? b : a;
+		// The mask must not broadcast the scores to a larger shape
+		if( in->data_dim != t->data_dim || mask == in || mask->data_type != t->data_type || mask->rank() > rank )
+			return false;
+		subgraph.push_back(producer);
+		t = in;
+		producer = findProducer(t);
+	}
+	if( producer && (producer->op_name == "Mul" || producer->op_name == "Div") && is_internal(t) ) {
+		Tensor* a = producer->get_input_tensor(0);
+		Tensor* b = producer->get_input_tensor(1);
+		float c;
+		if( get_scalar_constant(b, c) && a->data_dim == t->data_dim )
+			t = a;
+		else if( producer->op_name == "Mul" && get_scalar_constant(a, c) && b->data_dim == t->data_dim )
+			t = b;
+		else
+			return false;
+		// A zero scale would make the Attention node use its default scale
+		if( c == 0 )
+			return false;
+		scale = producer->op_name == "Div" ? 1 / c : c;
+		subgraph.push_back(producer);
+		producer = findProducer(t);
+	}
+	if( producer == nullptr || producer->op_name != "MatMul" || producer->get_number_of_inputs() != 2 || is_internal(t) == false )
+		return false;
+	Node* qk = producer;
+	Tensor* q = qk->get_input_tensor(0);
+	Tensor* kt = qk->get_input_tensor(1);
+	subgraph.push_back(qk);
+
+	// No broadcasting between the heads
+	if( q->rank() != rank || kt->rank() != rank || v->rank() != rank )
+		return false;
+	for( unsigned d=0; d<rank-2; d++ )
+		if( q->data_dim[d] != scores->data_dim[d] || kt->data_dim[d] != scores->data_dim[d] || v->data_dim[d] != scores->data_dim[d] )
+			return false;
+	if( q->data_type != onnx::TensorProto_DataType_FLOAT || v->data_type != q->data_type )
+		return false;
+
+	// The Attention node takes K, not K^T. Usually K^T is a Transpose of K.
+	Tensor* k = nullptr;
+	Transpose* transpose = dynamic_cast<Transpose*>(findProducer(kt));
+	if( transpose ) {
+		std::vector<int> swap_last;
+		for( unsigned d=0; d<rank; d++ )
+			swap_last.push_back(d);
+		std::swap(swap_last[rank - 2], swap_last[rank - 1]);
+		if( transpose->perm == swap_last )
+			k = transpose->get_input_tensor(0);
+	}
+
+	LOG(DEBUG) << "  fusing attention from " << qk->onnx_name << " to " << pv->onnx_name << std::endl;
+	if( k == nullptr ) {
+		onnx::NodeProto proto;
+		proto.set_op_type("Transpose");
+		proto.add_input(kt->name);
+		proto.add_output(uniqueName(kt->name + "_transposed"));
+		std::vector<int64_t> perm;
+		for( unsigned d=0; d<rank; d++ )
+			perm.push_back(d < rank - 2 ? d : (d == rank - 2 ? rank - 1 : rank - 2));
+		addIntsAttribute(proto, "perm", perm);
+		k = insertNode(proto, qk)->get_output_tensor(0);
+	}
+
+	onnx::NodeProto proto;
+	proto.set_name(uniqueName(pv->onnx_name + "_attention"));
+	proto.set_op_type("Attention");
+	proto.add_input(q->name);
+	proto.add_input(k->name);
+	proto.add_input(v->name);
+	if( mask )
+		proto.add_input(mask->name);
+	proto.add_output(uniqueName(pv->get_output_tensor(0)->name + "_attention"));
+	addFloatAttribute(proto, "scale", scale);
+	Node* attention = insertNode(proto, pv);
+	takeOverOutput(attention, 0, pv->get_output_tensor(0));
+
+	// subgraph is in reverse order of execution
+	for( auto n : subgraph )
+		removeNode(n);
+	if( transpose && kt->consumers.size() == 0 && kt->isIO == false )
+		removeNode(transpose);
+	return true;
+}
+
+void Graph::fuse_attention(void)
+{
+	LOG(DEBUG) << "Optimisation pass: fuse attention" << std::endl;
+	unsigned num_fused = 0;
+
+	bool changed;
+	do {
+		changed = false;
+		for( auto n : nodes ) {
+			if( n->op_name != "Softmax" )
+				continue;
+			LOG(TRACE) << "considering Softmax node: " << n->onnx_name << std::endl;
+			if( fuse_attention_at(n) ) {
+				num_fused++;
+				changed = true;
+				break;
+			}
+		}
+	} while( changed );
+
+	LOG(INFO) << "Fuse attention: " << num_fused << " attention subgraphs fused into Attention nodes" << std::endl;
+}
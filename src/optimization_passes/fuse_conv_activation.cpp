@@ -0,0 +1,105 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'fuse_conv_activation' optimization pass.
+ *
+ * Convolutional networks follow most Conv nodes with a Relu, or a Clip
+ * to [0,6] (Relu6 of MobileNets). As separate nodes, the activation
+ * reads the whole Conv output back from memory, and needs an output
+ * buffer of its own unless the tensors are unionized.
+ *
+ * This pass fuses the activation into the Conv node, which clamps its
+ * outputs as it writes them. Only Clips with constant limits are fused.
+ *
+ * The pass runs before 'fuse_conv_pool', so that a Conv -> Relu ->
+ * MaxPool chain becomes a single node.
+ */
+#include "graph.h"
+#include "nodes/clip.h"
+#include "nodes/conv.h"
+#include <cmath>
+#include <limits>
+
+using namespace toC;
+
+// The limits of a Relu or a Clip node, if they are known at compile time
+static bool activation_limits(const Node* n, float& lo, float& hi)
+{
+	if( n->op_name == "Relu" ) {
+		lo = 0;
+		hi = INFINITY;
+		return true;
+	}
+	if( n->op_name != "Clip" )
+		return false;
+
+	const Clip* clip = dynamic_cast<const Clip*>(n);
+	// The default attributes of Clip are the limits of float, i.e. no limit
+	lo = clip->min_attr == std::numeric_limits<float>::lowest() ? -INFINITY : clip->min_attr;
+	hi = clip->max_attr == std::numeric_limits<float>::max() ? INFINITY : clip->max_attr;
+	for( unsigned i=1; i<3 && i<n->get_number_of_inputs(); i++ ) {
+		const Tensor* t = n->get_input_tensor(i);
+		if( t->is_used() == false )
+			continue;
+		if( t->isConst == false || t->data_buffer == nullptr || t->isIO || t->data_num_elem() != 1 )
+			return false;
+		if( t->data_type != onnx::TensorProto_DataType_FLOAT )
+			return false;
+		(i == 1 ? lo : hi) = t->get_data_element_float(0);
+	}
+	return lo <= hi;
+}
+
+// Conv -> Relu/Clip
+// becomes
+// Conv with the activation fused into it
+bool Graph::fuse_conv_activation_at(Node* n)
+{
+	Conv* conv = dynamic_cast<Conv*>(n);
+	Tensor* y = n->get_output_tensor(0);
+	if( conv == nullptr || conv->fused_clip || conv->pool_op != "" )
+		return false;
+	if( y->data_type != onnx::TensorProto_DataType_FLOAT )
+		return false;
+	if( y->isIO || y->isRecursive || y->consumers.size() != 1 )
+		return false;
+	Node* consumer = y->consumers[0];
+	if( consumer->get_input_tensor(0) != y )
+		return false;
+
+	float lo, hi;
+	if( activation_limits(consumer, lo, hi) == false )
+		return false;
+
+	LOG(DEBUG) << "  fusing " << consumer->op_name << " " << consumer->onnx_name << " into Conv " << n->onnx_name << std::endl;
+	conv->fused_clip = true;
+	conv->clip_min = lo;
+	conv->clip_max = hi;
+	Tensor* activated = consumer->get_output_tensor(0);
+	n->replace_output(y, activated);
+	removeNode(consumer);
+	dropTensor(y);
+	return true;
+}
+
+void Graph::fuse_conv_activation(void)
+{
+	LOG(DEBUG) << "Optimisation pass: fuse conv activation" << std::endl;
+	unsigned num_fused = 0;
+
+	bool changed;
+	do {
+		changed = false;
+		for( auto n : nodes ) {
+			if( n->op_name != "Conv" )
+				continue;
+			LOG(TRACE) << "considering Conv node: " << n->onnx_name << std::endl;
+			if( fuse_conv_activation_at(n) ) {
+				num_fused++;
+				changed = true;
+				break;
+			}
+		}
+	} while( changed );
+
+	LOG(INFO) << "Fuse conv activation: " << num_fused << " activation nodes fused into Conv nodes" << std::endl;
+}
@@ -0,0 +1,126 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'fuse_conv_pool' optimization pass.
+ *
+ * A Conv followed by a MaxPool or AveragePool writes the full
+ * resolution output of the Conv into memory, only for the pooling
+ * to read it back and keep e.g. a quarter of it. On small targets,
+ * that intermediate buffer is often the largest one in the network.
+ *
+ * This pass fuses the pooling into the Conv node. The Conv then
+ * loops over the pooled outputs, calculates the convolution outputs
+ * of each pooling window and reduces them on the fly. So only the
+ * pooled tensor is stored.
+ *
+ * Only non-overlapping pooling windows (strides >= kernel_shape) are
+ * fused, since overlapping windows would calculate the convolution
+ * outputs they share more than once.
+ *
+ * GlobalAveragePool, GlobalMaxPool and a ReduceMean over the spatial
+ * dimensions (as at the end of classifier networks) are fused as a
+ * pooling with one window covering the whole convolution output.
+ * The Conv then keeps one running accumulator per output channel.
+ */
+#include "graph.h"
+#include "nodes/pooling.h"
+#include "nodes/reduce.h"
+#include <algorithm>
+
+using namespace toC;
+
+// Is n a reduction of all of the spatial dimensions of its input
+static bool is_global_pool(const Node* n)
+{
+	if( n->op_name == "GlobalAveragePool" || n->op_name == "GlobalMaxPool" )
+		return true;
+	if( n->op_name != "ReduceMean" )
+		return false;
+	const Reduce* reduce = dynamic_cast<const Reduce*>(n);
+	std::vector<size_t> axes = reduce->norm_axes;
+	std::sort(axes.begin(), axes.end());
+	unsigned rank = n->get_input_tensor(0)->rank();
+	if( axes.size() != rank - 2 )
+		return false;
+	for( unsigned i=0; i<axes.size(); i++ )
+		if( axes[i] != i + 2 )
+			return false;
+	return true;
+}
+
+// Conv -> MaxPool/AveragePool/GlobalAveragePool/GlobalMaxPool/ReduceMean
+// becomes
+// Conv with the pooling fused into it
+bool Graph::fuse_conv_pool_at(Node* conv_node)
+{
+	SpatialFilter* conv = dynamic_cast<SpatialFilter*>(conv_node);
+	Tensor* y = conv->get_output_tensor(0);
+	if( conv->pool_op != "" || y->data_type != onnx::TensorProto_DataType_FLOAT )
+		return false;
+	if( y->isIO || y->isRecursive || y->consumers.size() != 1 )
+		return false;
+	Node* consumer = y->consumers[0];
+	if( consumer->get_input_tensor(0) != y )
+		return false;
+	unsigned num_data_dim = conv->get_numDataDim();
+
+	if( is_global_pool(consumer) ) {
+		// One window over all of the Conv output
+		conv->pool_op = consumer->op_name == "GlobalMaxPool" ? "MaxPool" : "AveragePool";
+		conv->pool_kernel_shape.assign(y->data_dim.begin() + 2, y->data_dim.end());
+		conv->pool_strides = conv->pool_kernel_shape;
+		conv->pool_pads.assign(2 * num_data_dim, 0);
+		conv->pool_count_include_pad = 0;
+	}
+	else if( consumer->op_name == "MaxPool" || consumer->op_name == "AveragePool" ) {
+		Pooling* pool = dynamic_cast<Pooling*>(consumer);
+		if( pool->ceil_mode || pool->is_output_N_used(1) )
+			return false;
+		if( pool->auto_pad != "NOTSET" && pool->auto_pad != "VALID" )
+			return false;
+		for( unsigned i=0; i<num_data_dim; i++ ) {
+			if( pool->dilations[i] != 1 || pool->strides[i] < pool->kernel_shape[i] )
+				return false;
+			// A window entirely in the padding would have nothing to reduce
+			if( pool->pads[i] >= pool->kernel_shape[i] || pool->pads[i + num_data_dim] >= pool->kernel_shape[i] )
+				return false;
+		}
+		conv->pool_op = pool->op_name;
+		conv->pool_kernel_shape = pool->kernel_shape;
+		conv->pool_pads = pool->pads;
+		conv->pool_strides = pool->strides;
+		conv->pool_count_include_pad = pool->count_include_pad;
+	}
+	else
+		return false;
+
+	LOG(DEBUG) << "  fusing " << consumer->op_name << " " << consumer->onnx_name << " into Conv " << conv->onnx_name << std::endl;
+	conv->filter_dim = y->data_dim;
+	Tensor* pooled = consumer->get_output_tensor(0);
+	conv->replace_output(y, pooled);
+	removeNode(consumer);
+	dropTensor(y);
+	return true;
+}
+
+void Graph::fuse_conv_pool(void)
+{
+	LOG(DEBUG) << "Optimisation pass: fuse conv pool" << std::endl;
+	unsigned num_fused = 0;
+
+	bool changed;
+	do {
+		changed = false;
+		for( auto n : nodes ) {
+			if( n->op_name != "Conv" )
+				continue;
+			LOG(TRACE) << "considering Conv node: " << n->onnx_name << std::endl;
+			if( fuse_conv_pool_at(n) ) {
+				num_fused++;
+				changed = true;
+				break;
+			}
+		}
+	} while( changed );
+
+	LOG(INFO) << "Fuse conv pool: " << num_fused << " pooling nodes fused into Conv nodes" << std::endl;
+}
@@ -0,0 +1,280 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'fuse_decomposed' optimization pass.
+ *
+ * Operators that were added to ONNX late are exported for older
+ * opsets as subgraphs of basic nodes. Each of those nodes becomes
+ * a separate loop over the data, with its own output buffer.
+ * This pass recognizes the subgraphs and replaces them with one node:
+ *  - GELU: x * 0.5 * (1 + Erf(x / sqrt(2))), as a Gelu node
+ *  - SiLU: x * Sigmoid(x), as a Swish node
+ *  - Layer normalization: (x - mean(x)) / sqrt(var(x) + epsilon) * scale + bias,
+ *    with the mean and variance calculated with ReduceMeans,
+ *    as a LayerNormalization node
+ */
+#include "graph.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace toC;
+
+// An intermediate tensor, used only by the next node of the subgraph
+static bool is_internal(const Tensor* t)
+{
+	return t->isIO == false && t->consumers.size() == 1;
+}
+
+// Is t a float constant scalar with (approximately) the given value
+static bool is_constant(const Tensor* t, float value)
+{
+	if( t == nullptr || t->isConst == false || t->data_buffer == nullptr || t->isIO || t->data_num_elem() != 1 )
+		return false;
+	if( t->data_type != onnx::TensorProto_DataType_FLOAT )
+		return false;
+	return std::fabs(t->get_data_element_float(0) - value) <= 1e-4 * std::fabs(value);
+}
+
+// The input of binary node n that is not t, or nullptr
+static Tensor* other_input(const Node* n, const Tensor* t)
+{
+	if( n->get_number_of_inputs() != 2 )
+		return nullptr;
+	if( n->get_input_tensor(0) == t && n->get_input_tensor(1) != t )
+		return n->get_input_tensor(1);
+	if( n->get_input_tensor(1) == t && n->get_input_tensor(0) != t )
+		return n->get_input_tensor(0);
+	return nullptr;
+}
+
+// The only user of t, if it is a node of type 'op'
+static Node* next_node(const Tensor* t, const std::string& op)
+{
+	if( is_internal(t) == false || t->consumers[0]->op_name != op )
+		return nullptr;
+	return t->consumers[0];
+}
+
+// Create an elementwise node of type 'op' calculating y from x,
+// to replace the nodes of 'subgraph'
+void Graph::replace_with_elementwise(const std::string& op, Tensor* x, Tensor* y, const std::vector<Node*>& subgraph)
+{
+	onnx::NodeProto proto;
+	proto.set_name(uniqueName(y->name + "_" + op));
+	proto.set_op_type(op);
+	proto.add_input(x->name);
+	proto.add_output(uniqueName(y->name + "_fused"));
+	LOG(DEBUG) << "  replacing " << subgraph.size() << " nodes with " << op << " " << proto.name() << std::endl;
+	Node* fused = insertNode(proto, findProducer(y));
+	takeOverOutput(fused, 0, y);
+	removeNodes(subgraph);
+}
+
+// Div(x, sqrt(2)) -> Erf -> Add 1 -> Mul x -> Mul 0.5
+// with the Muls in any order
+bool Graph::fuse_gelu(Node* erf)
+{
+	Tensor* scaled = erf->get_input_tensor(0);
+	Node* div = findProducer(scaled);
+	if( div == nullptr || is_internal(scaled) == false || div->get_number_of_inputs() != 2 )
+		return false;
+	Tensor* x = div->get_input_tensor(0);
+	if( div->op_name == "Div" && is_constant(div->get_input_tensor(1), 1.41421356f) )
+		;
+	else if( div->op_name == "Mul" && is_constant(div->get_input_tensor(1), 0.70710678f) )
+		;
+	else if( div->op_name == "Mul" && is_constant(x, 0.70710678f) )
+		x = div->get_input_tensor(1);
+	else
+		return false;
+	if( x->data_type != onnx::TensorProto_DataType_FLOAT || scaled->data_dim != x->data_dim )
+		return false;
+
+	Node* add = next_node(erf->get_output_tensor(0), "Add");
+	if( add == nullptr || is_constant(other_input(add, erf->get_output_tensor(0)), 1) == false )
+		return false;
+	Tensor* a = add->get_output_tensor(0);
+	Node* mul1 = next_node(a, "Mul");
+	if( mul1 == nullptr )
+		return false;
+	Tensor* o = other_input(mul1, a);
+	Tensor* m = mul1->get_output_tensor(0);
+	std::vector<Node*> subgraph = {div, erf, add, mul1};
+	Tensor* y;
+	if( o == x || (o && is_constant(o, 0.5)) ) {
+		// Mul(x, a) -> Mul 0.5, or Mul(a, 0.5) -> Mul x
+		Node* mul2 = next_node(m, "Mul");
+		if( mul2 == nullptr )
+			return false;
+		Tensor* o2 = other_input(mul2, m);
+		if( o2 == nullptr || (o == x ? is_constant(o2, 0.5) : o2 == x) == false )
+			return false;
+		subgraph.push_back(mul2);
+		y = mul2->get_output_tensor(0);
+	}
+	else {
+		// Mul(x, 0.5) -> Mul a
+		Node* half = o ? findProducer(o) : nullptr;
+		if( half == nullptr || half->op_name != "Mul" || is_internal(o) == false )
+			return false;
+		Tensor* h = other_input(half, x);
+		if( h == nullptr || is_constant(h, 0.5) == false )
+			return false;
+		subgraph.push_back(half);
+		y = m;
+	}
+	if( y->data_dim != x->data_dim || y->data_type != x->data_type )
+		return false;
+
+	replace_with_elementwise("Gelu", x, y, subgraph);
+	return true;
+}
+
+// Sigmoid(x) -> Mul x
+bool Graph::fuse_silu(Node* sigmoid)
+{
+	Tensor* x = sigmoid->get_input_tensor(0);
+	Tensor* s = sigmoid->get_output_tensor(0);
+	Node* mul = next_node(s, "Mul");
+	if( mul == nullptr || other_input(mul, s) != x )
+		return false;
+	Tensor* y = mul->get_output_tensor(0);
+	if( y->data_dim != x->data_dim || x->data_type != onnx::TensorProto_DataType_FLOAT )
+		return false;
+
+	replace_with_elementwise("Swish", x, y, {sigmoid, mul});
+	return true;
+}
+
+// ReduceMean(x) -> Sub(x, mean) -> Pow 2 -> ReduceMean -> Add epsilon -> Sqrt -> Div(d, .)
+// [-> Mul scale] [-> Add bias]
+bool Graph::fuse_layernorm(Node* mean_node)
+{
+	Tensor* x = mean_node->get_input_tensor(0);
+	Tensor* mean = mean_node->get_output_tensor(0);
+	unsigned rank = x->rank();
+	if( x->data_type != onnx::TensorProto_DataType_FLOAT || mean->rank() != rank || rank == 0 )
+		return false;
+	// The mean must be over the trailing dimensions
+	unsigned axis = rank;
+	while( axis > 0 && mean->data_dim[axis - 1] == 1 )
+		axis--;
+	for( unsigned d=0; d<axis; d++ )
+		if( mean->data_dim[d] != x->data_dim[d] )
+			return false;
+	if( axis == rank )
+		return false;
+
+	Node* sub = next_node(mean, "Sub");
+	if( sub == nullptr || sub->get_input_tensor(0) != x || sub->get_input_tensor(1) != mean )
+		return false;
+	Tensor* d = sub->get_output_tensor(0);
+	// Mul(d, d) is in the consumers twice
+	std::vector<Node*> d_users;
+	for( auto c : d->consumers )
+		if( std::find(d_users.begin(), d_users.end(), c) == d_users.end() )
+			d_users.push_back(c);
+	if( d->isIO || d_users.size() != 2 || d->data_dim != x->data_dim )
+		return false;
+	Node* pow = d_users[0];
+	Node* div = d_users[1];
+	if( pow->op_name == "Div" )
+		std::swap(pow, div);
+	if( div->op_name != "Div" || div->get_input_tensor(0) != d )
+		return false;
+	if( pow->op_name == "Pow" ) {
+		if( pow->get_input_tensor(0) != d || is_constant(pow->get_input_tensor(1), 2) == false )
+			return false;
+	}
+	else if( pow->op_name != "Mul" || pow->get_input_tensor(0) != d || pow->get_input_tensor(1) != d )
+		return false;
+
+	Node* var_node = next_node(pow->get_output_tensor(0), "ReduceMean");
+	if( var_node == nullptr || var_node->get_output_tensor(0)->data_dim != mean->data_dim )
+		return false;
+	Tensor* var = var_node->get_output_tensor(0);
+	Node* add_eps = next_node(var, "Add");
+	if( add_eps == nullptr )
+		return false;
+	Tensor* eps = other_input(add_eps, var);
+	if( eps == nullptr || eps->isConst == false || eps->data_buffer == nullptr || eps->data_num_elem() != 1
+	    || eps->data_type != onnx::TensorProto_DataType_FLOAT )
+		return false;
+	float epsilon = eps->get_data_element_float(0);
+	Node* sqrt = next_node(add_eps->get_output_tensor(0), "Sqrt");
+	if( sqrt == nullptr || div->get_input_tensor(1) != sqrt->get_output_tensor(0) || is_internal(sqrt->get_output_tensor(0)) == false )
+		return false;
+	Tensor* y = div->get_output_tensor(0);
+	if( y->data_dim != x->data_dim )
+		return false;
+	std::vector<Node*> subgraph = {mean_node, sub, pow, var_node, add_eps, sqrt, div};
+
+	// Optional scale and bias. They must not broadcast y to a larger shape.
+	Tensor* scale = nullptr;
+	Tensor* bias = nullptr;
+	Node* mul = next_node(y, "Mul");
+	if( mul && other_input(mul, y) && mul->get_output_tensor(0)->data_dim == y->data_dim ) {
+		scale = other_input(mul, y);
+		subgraph.push_back(mul);
+		y = mul->get_output_tensor(0);
+	}
+	Node* add = next_node(y, "Add");
+	if( scale && add && other_input(add, y) && add->get_output_tensor(0)->data_dim == y->data_dim ) {
+		bias = other_input(add, y);
+		subgraph.push_back(add);
+		y = add->get_output_tensor(0);
+	}
+	for( Tensor* t : {scale, bias} )
+		if( t && (t->data_type != x->data_type || t->rank() > rank - axis) )
+			return false;
+	if( scale == nullptr ) {
+		std::vector<int> dims(x->data_dim.begin() + axis, x->data_dim.end());
+		scale = addConstTensor(x->name + "_layernorm_scale", x->data_type, dims);
+		for( int i=0; i<scale->data_num_elem(); i++ )
+			((float*)scale->data_buffer)[i] = 1;
+	}
+
+	onnx::NodeProto proto;
+	proto.set_name(uniqueName(y->name + "_LayerNormalization"));
+	proto.set_op_type("LayerNormalization");
+	proto.add_input(x->name);
+	proto.add_input(scale->name);
+	if( bias )
+		proto.add_input(bias->name);
+	proto.add_output(uniqueName(y->name + "_fused"));
+	addIntAttribute(proto, "axis", axis);
+	addFloatAttribute(proto, "epsilon", epsilon);
+
+	LOG(DEBUG) << "  replacing " << subgraph.size() << " nodes with LayerNormalization " << proto.name() << std::endl;
+	Node* fused = insertNode(proto, findProducer(y));
+	takeOverOutput(fused, 0, y);
+	removeNodes(subgraph);
+	return true;
+}
+
+void Graph::fuse_decomposed(void)
+{
+	LOG(DEBUG) << "Optimisation pass: fuse decomposed" << std::endl;
+	unsigned num_gelu = 0, num_silu = 0, num_layernorm = 0;
+
+	bool changed;
+	do {
+		changed = false;
+		for( auto n : nodes ) {
+			LOG(TRACE) << "considering node: " << n->onnx_name << std::endl;
+			if( n->op_name == "Erf" && fuse_gelu(n) )
+				num_gelu++;
+			else if( n->op_name == "Sigmoid" && fuse_silu(n) )
+				num_silu++;
+			else if( n->op_name == "ReduceMean" && fuse_layernorm(n) )
+				num_layernorm++;
+			else
+				continue;
+			changed = true;
+			break;
+		}
+	} while( changed );
+
+	LOG(INFO) << "Fuse decomposed: " << num_gelu << " GELU, "
+	          << num_silu << " SiLU, "
+	          << num_layernorm << " LayerNormalization subgraphs fused" << std::endl;
+}
@@ -0,0 +1,143 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'fuse_linear' optimization pass.
+ *
+ * Linear layers exported from PyTorch come out as a MatMul
+ * followed by an Add of the bias. For inputs of more than 2
+ * dimensions, the MatMul is sometimes wrapped in Reshapes that
+ * flatten the leading dimensions and then restore them.
+ *
+ * This pass gives the bias to the MatMul node as an extra input,
+ * C, so the bias initializes the accumulator, and the Add node and
+ * its output buffer are removed. The Reshapes around a MatMul with
+ * a 2D weight matrix are removed, since MatMul broadcasts over the
+ * leading dimensions with the same memory layout.
+ */
+#include "graph.h"
+#include <algorithm>
+
+using namespace toC;
+
+// Is n before 'position' in the order of execution.
+static bool is_before(const std::vector<Node*>& nodes, const Node* n, const Node* position)
+{
+	for( auto i : nodes ) {
+		if( i == n )
+			return true;
+		if( i == position )
+			return false;
+	}
+	return false;
+}
+
+// MatMul -> Add(Y, bias)
+// becomes
+// MatMul(A, B, bias)
+bool Graph::fuse_matmul_add(Node* matmul)
+{
+	if( matmul->get_number_of_inputs() != 2 )
+		return false;
+	Tensor* y = matmul->get_output_tensor(0);
+	if( y->isIO || y->consumers.size() != 1 )
+		return false;
+	Node* add = y->consumers[0];
+	if( add->op_name != "Add" )
+		return false;
+
+	Tensor* bias = add->get_input_tensor(0) == y ? add->get_input_tensor(1) : add->get_input_tensor(0);
+	Tensor* z = add->get_output_tensor(0);
+	if( bias == y )
+		return false;
+	// bias must not broadcast Y to a larger shape
+	if( z->data_dim != y->data_dim || z->data_type != y->data_type )
+		return false;
+	Node* bias_producer = findProducer(bias);
+	if( bias_producer && is_before(nodes, bias_producer, matmul) == false )
+		return false;
+
+	LOG(DEBUG) << "  fusing Add " << add->onnx_name << " into MatMul " << matmul->onnx_name << std::endl;
+	matmul->register_input(bias, "C");
+	std::erase(bias->consumers, add);
+	bias->consumers.push_back(matmul);
+	matmul->replace_output(y, z);
+	removeNode(add);
+	dropTensor(y);
+	return true;
+}
+
+// Reshape(X[...,K] -> [M,K]) -> MatMul(., W[K,N]) -> Reshape([M,N] -> [...,N])
+// becomes
+// MatMul(X, W)
+bool Graph::fuse_reshape_matmul_reshape(Node* matmul)
+{
+	Tensor* a = matmul->get_input_tensor(0);
+	Tensor* w = matmul->get_input_tensor(1);
+	Tensor* y = matmul->get_output_tensor(0);
+	if( a->rank() != 2 || w->rank() != 2 || a == w )
+		return false;
+	if( a->isIO || a->consumers.size() != 1 || y->isIO || y->consumers.size() != 1 )
+		return false;
+
+	Node* flatten = findProducer(a);
+	Node* unflatten = y->consumers[0];
+	if( flatten == nullptr || flatten->op_name != "Reshape" || unflatten->op_name != "Reshape" )
+		return false;
+
+	Tensor* x = flatten->get_input_tensor(0);
+	Tensor* z = unflatten->get_output_tensor(0);
+	if( x->rank() < 2 || x->data_dim.back() != a->data_dim[1] )
+		return false;
+	std::vector<int> expected = x->data_dim;
+	expected.back() = y->data_dim[1];
+	if( z->data_dim != expected )
+		return false;
+
+	// A bias over the flattened rows can't be broadcast to Z
+	if( matmul->get_number_of_inputs() > 2 ) {
+		Tensor* c = matmul->get_input_tensor(2);
+		if( c->data_num_elem() != 1 && c->data_num_elem() != y->data_dim[1] )
+			return false;
+		if( c->rank() > 1 && c->data_dim[c->rank() - 2] != 1 )
+			return false;
+	}
+
+	LOG(DEBUG) << "  removing Reshapes around MatMul " << matmul->onnx_name << std::endl;
+	matmul->replace_input(a, x);
+	x->consumers.push_back(matmul);
+	a->consumers.clear();
+	removeNode(flatten);
+
+	matmul->replace_output(y, z);
+	removeNode(unflatten);
+	dropTensor(y);
+	return true;
+}
+
+void Graph::fuse_linear(void)
+{
+	LOG(DEBUG) << "Optimisation pass: fuse linear" << std::endl;
+	unsigned num_bias = 0, num_reshape = 0;
+
+	bool changed;
+	do {
+		changed = false;
+		for( auto n : nodes ) {
+			if( n->op_name != "MatMul" )
+				continue;
+			LOG(TRACE) << "considering MatMul node: " << n->onnx_name << std::endl;
+			if( fuse_matmul_add(n) ) {
+				num_bias++;
+				changed = true;
+				break;
+			}
+			if( fuse_reshape_matmul_reshape(n) ) {
+				num_reshape++;
+				changed = true;
+				break;
+			}
+		}
+	} while( changed );
+
+	LOG(INFO) << "Fuse linear: " << num_bias << " bias Adds fused into MatMul, "
+	          << num_reshape << " Reshape pairs removed" << std::endl;
+}
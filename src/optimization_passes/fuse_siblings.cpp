@@ -0,0 +1,275 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'fuse_siblings' optimization pass.
+ *
+ * Attention Q/K/V projections and multi-branch convolutions read
+ * the same input tensor with different weights in separate nodes,
+ * each of them reading the input from memory again.
+ *
+ * This pass replaces such sibling Gemm, MatMul and Conv nodes with
+ * one node, whose weights (and biases) are the siblings' weights
+ * concatenated at compile time. The original outputs are copied
+ * out of the combined result with a Split node.
+ * onnx2c has no views of tensors, so the Split is a copy of the
+ * outputs - but that is cheap compared to the multiplications.
+ *
+ * The siblings must have the same attributes, and constant weights.
+ */
+#include "graph.h"
+#include "nodes/gemm.h"
+#include "nodes/spatialfilter.h"
+#include <cstring>
+
+using namespace toC;
+
+static bool is_fusable_op(const Node* n)
+{
+	return n->op_name == "Gemm" || n->op_name == "MatMul" || n->op_name == "Conv";
+}
+
+// Width of the node's output along the axis the siblings are concatenated
+static int output_channels(const Node* n)
+{
+	const Tensor* w = n->get_input_tensor(1);
+	if( n->op_name == "Gemm" )
+		return dynamic_cast<const Gemm*>(n)->transB ? w->data_dim[0] : w->data_dim[1];
+	if( n->op_name == "MatMul" )
+		return w->data_dim[1];
+	return w->data_dim[0];
+}
+
+// Axis of the weights the siblings are concatenated along
+static unsigned weight_axis(const Node* n)
+{
+	if( n->op_name == "Gemm" )
+		return dynamic_cast<const Gemm*>(n)->transB ? 0 : 1;
+	if( n->op_name == "MatMul" )
+		return 1;
+	return 0;
+}
+
+// Can node n be fused with its siblings at all
+bool Graph::can_fuse_sibling(const Node* n) const
+{
+	if( is_fusable_op(n) == false || n->get_number_of_inputs() < 2 )
+		return false;
+	const Tensor* x = n->get_input_tensor(0);
+	const Tensor* w = n->get_input_tensor(1);
+	if( w == x || isInitializer(w) == false || n->get_output_tensor(0)->isRecursive )
+		return false;
+	if( n->op_name == "MatMul" && w->rank() != 2 )
+		return false;
+	if( n->op_name == "Gemm" && x->data_type != onnx::TensorProto_DataType_FLOAT )
+		return false;
+	if( n->op_name == "Conv" ) {
+		const SpatialFilter* conv = dynamic_cast<const SpatialFilter*>(n);
+		if( conv->group != 1 || (conv->auto_pad != "NOTSET" && conv->auto_pad != "VALID") )
+			return false;
+	}
+
+	if( n->get_number_of_inputs() < 3 )
+		return true;
+	// The bias must be the same for all rows, so it can be concatenated as a vector
+	const Tensor* b = n->get_input_tensor(2);
+	int channels = output_channels(n);
+	if( isInitializer(b) == false || b->data_type != w->data_type )
+		return false;
+	if( b->data_num_elem() != 1 && b->data_num_elem() != channels )
+		return false;
+	if( b->rank() > 0 && b->data_dim.back() != b->data_num_elem() )
+		return false;
+	// Gemm takes a rank 1 C of M elements to be a column vector
+	if( n->op_name == "Gemm" && b->rank() == 1 && b->data_num_elem() > 1 ) {
+		const Gemm* gemm = dynamic_cast<const Gemm*>(n);
+		int M = gemm->transA ? x->data_dim[1] : x->data_dim[0];
+		if( M == channels )
+			return false;
+	}
+	return true;
+}
+
+// Do the nodes calculate the same thing, apart from the weights
+static bool are_compatible_siblings(const Node* a, const Node* b)
+{
+	if( a->op_name != b->op_name )
+		return false;
+	const Tensor* wa = a->get_input_tensor(1);
+	const Tensor* wb = b->get_input_tensor(1);
+	if( wa->data_type != wb->data_type || wa->rank() != wb->rank() )
+		return false;
+
+	if( a->op_name == "Gemm" ) {
+		const Gemm* ga = dynamic_cast<const Gemm*>(a);
+		const Gemm* gb = dynamic_cast<const Gemm*>(b);
+		return ga->alpha == gb->alpha && ga->beta == gb->beta
+		    && ga->transA == gb->transA && ga->transB == gb->transB;
+	}
+	if( a->op_name == "Conv" ) {
+		const SpatialFilter* ca = dynamic_cast<const SpatialFilter*>(a);
+		const SpatialFilter* cb = dynamic_cast<const SpatialFilter*>(b);
+		for( unsigned d=1; d<wa->rank(); d++ )
+			if( wa->data_dim[d] != wb->data_dim[d] )
+				return false;
+		return ca->kernel_shape == cb->kernel_shape && ca->strides == cb->strides
+		    && ca->pads == cb->pads && ca->dilations == cb->dilations;
+	}
+	return true;
+}
+
+// Concatenate constant tensors along 'axis'
+Tensor* Graph::concat_constants(const std::vector<const Tensor*>& ts, unsigned axis, const std::string& name_base)
+{
+	std::vector<int> dims = ts[0]->data_dim;
+	dims[axis] = 0;
+	for( auto t : ts )
+		dims[axis] += t->data_dim[axis];
+	Tensor* rv = addConstTensor(name_base, ts[0]->data_type, dims);
+
+	size_t outer = 1, inner = ts[0]->data_elem_size();
+	for( unsigned d=0; d<axis; d++ )
+		outer *= dims[d];
+	for( unsigned d=axis+1; d<dims.size(); d++ )
+		inner *= dims[d];
+
+	char* dst = (char*)rv->data_buffer;
+	for( size_t o=0; o<outer; o++ )
+		for( auto t : ts ) {
+			size_t chunk = t->data_dim[axis] * inner;
+			memcpy(dst, (char*)t->data_buffer + o * chunk, chunk);
+			dst += chunk;
+		}
+	return rv;
+}
+
+// Concatenate the siblings' biases to one vector. Missing biases are zeros,
+// single element biases are repeated for each output channel.
+Tensor* Graph::concat_biases(const std::vector<Node*>& siblings, const std::vector<int>& dims)
+{
+	const Tensor* w = siblings[0]->get_input_tensor(1);
+	Tensor* rv = addConstTensor(siblings[0]->get_input_tensor(0)->name + "_fused_bias", w->data_type, dims);
+	size_t elem_size = rv->data_elem_size();
+	char* dst = (char*)rv->data_buffer;
+	for( auto n : siblings ) {
+		int channels = output_channels(n);
+		if( n->get_number_of_inputs() > 2 ) {
+			const Tensor* b = n->get_input_tensor(2);
+			for( int c=0; c<channels; c++ )
+				memcpy(dst + c * elem_size, (char*)b->data_buffer + (b->data_num_elem() == 1 ? 0 : c * elem_size), elem_size);
+		}
+		dst += channels * elem_size;
+	}
+	return rv;
+}
+
+// Replace the sibling nodes (in execution order) with one node
+// calculating the outputs of all of them, and a Split of its output.
+void Graph::fuse_sibling_group(const std::vector<Node*>& siblings)
+{
+	Node* first = siblings[0];
+	Tensor* x = first->get_input_tensor(0);
+	LOG(DEBUG) << "  fusing " << siblings.size() << " " << first->op_name << " nodes reading " << x->name << std::endl;
+
+	std::vector<const Tensor*> weights;
+	int total_channels = 0;
+	bool has_bias = false;
+	for( auto n : siblings ) {
+		weights.push_back(n->get_input_tensor(1));
+		total_channels += output_channels(n);
+		has_bias |= n->get_number_of_inputs() > 2;
+	}
+	Tensor* w = concat_constants(weights, weight_axis(first), first->get_input_tensor(1)->name + "_fused");
+	Tensor* bias = nullptr;
+	if( has_bias ) {
+		// Gemm would take a rank 1 C with M elements as a column
+		std::vector<int> bias_dims = {total_channels};
+		if( first->op_name == "Gemm" )
+			bias_dims = {1, total_channels};
+		bias = concat_biases(siblings, bias_dims);
+	}
+
+	onnx::NodeProto proto;
+	proto.set_name(uniqueName(first->onnx_name + "_fused"));
+	proto.set_op_type(first->op_name);
+	proto.add_input(x->name);
+	proto.add_input(w->name);
+	if( bias )
+		proto.add_input(bias->name);
+	proto.add_output(uniqueName(x->name + "_" + first->op_name + "_fused"));
+
+	unsigned split_axis;
+	if( first->op_name == "Gemm" ) {
+		const Gemm* gemm = dynamic_cast<const Gemm*>(first);
+		addFloatAttribute(proto, "alpha", gemm->alpha);
+		addFloatAttribute(proto, "beta", gemm->beta);
+		addIntAttribute(proto, "transA", gemm->transA);
+		addIntAttribute(proto, "transB", gemm->transB);
+		split_axis = 1;
+	}
+	else if( first->op_name == "Conv" ) {
+		const SpatialFilter* conv = dynamic_cast<const SpatialFilter*>(first);
+		addIntsAttribute(proto, "kernel_shape", conv->kernel_shape);
+		addIntsAttribute(proto, "dilations", conv->dilations);
+		addIntsAttribute(proto, "pads", conv->pads);
+		addIntsAttribute(proto, "strides", conv->strides);
+		split_axis = 1;
+	}
+	else
+		split_axis = first->get_output_tensor(0)->rank() - 1;
+	Node* fused = insertNode(proto, first);
+
+	Tensor* split_sizes = addConstTensor(fused->get_output_tensor(0)->name + "_split", onnx::TensorProto_DataType_INT64, {(int)siblings.size()});
+	for( unsigned i=0; i<siblings.size(); i++ )
+		((int64_t*)split_sizes->data_buffer)[i] = output_channels(siblings[i]);
+
+	onnx::NodeProto split_proto;
+	split_proto.set_name(uniqueName(fused->onnx_name + "_split"));
+	split_proto.set_op_type("Split");
+	split_proto.add_input(fused->get_output_tensor(0)->name);
+	split_proto.add_input(split_sizes->name);
+	for( auto n : siblings )
+		split_proto.add_output(uniqueName(n->get_output_tensor(0)->name + "_split"));
+	addIntAttribute(split_proto, "axis", split_axis);
+	Node* split = insertNode(split_proto, first);
+
+	for( unsigned i=0; i<siblings.size(); i++ ) {
+		takeOverOutput(split, i, siblings[i]->get_output_tensor(0));
+		removeNode(siblings[i]);
+	}
+}
+
+void Graph::fuse_siblings(void)
+{
+	LOG(DEBUG) << "Optimisation pass: fuse siblings" << std::endl;
+	unsigned num_groups = 0, num_fused = 0;
+
+	bool changed;
+	do {
+		changed = false;
+		for( auto n : nodes ) {
+			if( can_fuse_sibling(n) == false )
+				continue;
+			LOG(TRACE) << "considering node: " << n->onnx_name << std::endl;
+
+			// Consumers are not in execution order, but the fused node
+			// must be placed before all of the siblings.
+			std::vector<Node*> siblings = {n};
+			for( auto m : nodes ) {
+				if( m == n )
+					continue;
+				if( m->get_number_of_inputs() > 0 && m->get_input_tensor(0) == n->get_input_tensor(0)
+				    && can_fuse_sibling(m) && are_compatible_siblings(n, m) )
+					siblings.push_back(m);
+			}
+			if( siblings.size() < 2 )
+				continue;
+
+			fuse_sibling_group(siblings);
+			num_groups++;
+			num_fused += siblings.size();
+			changed = true;
+			break;
+		}
+	} while( changed );
+
+	LOG(INFO) << "Fuse siblings: " << num_fused << " nodes fused into " << num_groups << " nodes" << std::endl;
+}
@@ -0,0 +1,262 @@
+/* This file is part of onnx2c.
+ *
+ * Helpers for the optimization passes to edit the graph.
+ * The passes find a pattern of nodes, and then use these
+ * to rewire tensors, add replacement nodes and remove the
+ * nodes that became unnecessary.
+ *
+ * Nodes are kept in the Graph::nodes vector in the order they
+ * get printed (i.e. executed), so any added node must be placed
+ * after the producers of its inputs.
+ */
+#include "graph.h"
+#include "options.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace toC;
+
+// Get the node that calculates tensor t.
+// nullptr for graph inputs and initialized tensors.
+Node* Graph::findProducer(const Tensor* t) const
+{
+	for( auto n : nodes )
+		for( unsigned o=0; o<n->get_number_of_outputs(); o++ )
+			if( n->get_output_tensor(o) == t )
+				return n;
+	return nullptr;
+}
+
+// A constant tensor from the .onnx file (or one created by an optimization
+// pass), i.e. a tensor that is not calculated by any node.
+bool Graph::isInitializer(const Tensor* t) const
+{
+	return t->isConst && t->initialize && t->data_buffer != nullptr
+	    && t->isIO == false && findProducer(t) == nullptr;
+}
+
+// Make all nodes that read 'old' read 'replacement' instead.
+// Graph outputs can't be replaced this way, since that would
+// change the graph's interface.
+void Graph::replaceTensorUsers(Tensor* old, Tensor* replacement)
+{
+	if( old->isIO )
+		ERROR("onnx2c internal error: replacing uses of graph IO tensor " << old->name);
+
+	for( auto c : old->consumers ) {
+		// a node might use the same tensor for several inputs
+		while( c->replace_input(old, replacement) )
+			;
+		if( std::find(replacement->consumers.begin(), replacement->consumers.end(), c) == replacement->consumers.end() )
+			replacement->consumers.push_back(c);
+	}
+	old->consumers.clear();
+}
+
+// Make node n read 'replacement' instead of 'old', e.g. a constant
+// the pass has rearranged at compile time. Other users of 'old' are
+// left as they are. If nothing reads 'old' anymore and it is a
+// constant, it is removed.
+void Graph::replaceNodeInput(Node* n, Tensor* old, Tensor* replacement)
+{
+	while( n->replace_input(old, replacement) )
+		;
+	std::erase(old->consumers, n);
+	if( std::find(replacement->consumers.begin(), replacement->consumers.end(), n) == replacement->consumers.end() )
+		replacement->consumers.push_back(n);
+	if( old->consumers.size() == 0 && isInitializer(old) ) {
+		LOG(DEBUG) << "    removing unused constant " << old->name << std::endl;
+		std::erase(tensors, old);
+		delete old;
+	}
+}
+
+// Remove a node from the graph.
+// The node's inputs that are left without users are removed too,
+// if they are constants. Outputs are removed if nothing reads them
+// and no other node (e.g. a replacement node) has taken them over.
+void Graph::removeNode(Node* n)
+{
+	LOG(DEBUG) << "  removing node " << n->onnx_name << std::endl;
+	std::erase(nodes, n);
+
+	for( unsigned i=0; i<n->get_number_of_inputs(); i++ ) {
+		Tensor* t = n->get_input_tensor(i);
+		std::erase(t->consumers, n);
+		if( t->name == "" || t->consumers.size() > 0 )
+			continue;
+		if( isInitializer(t) ) {
+			LOG(DEBUG) << "    removing unused constant " << t->name << std::endl;
+			std::erase(tensors, t);
+			delete t;
+		}
+	}
+
+	for( unsigned o=0; o<n->get_number_of_outputs(); o++ ) {
+		Tensor* t = n->get_output_tensor(o);
+		if( t->consumers.size() > 0 || t->isIO )
+			continue;
+		if( findProducer(t) != nullptr )
+			continue;
+		// unused optional outputs were never added to the graph's tensors
+		if( std::find(tensors.begin(), tensors.end(), t) == tensors.end() )
+			continue;
+		LOG(DEBUG) << "    removing unused output " << t->name << std::endl;
+		std::erase(tensors, t);
+		delete t;
+	}
+
+	delete n;
+}
+
+// Remove a subgraph of nodes. The nodes are removed users first, so
+// the tensors between them are left unused and get removed too.
+void Graph::removeNodes(std::vector<Node*> ns)
+{
+	std::vector<Node*> ordered;
+	for( auto it = nodes.rbegin(); it != nodes.rend(); it++ )
+		if( std::find(ns.begin(), ns.end(), *it) != ns.end() )
+			ordered.push_back(*it);
+	for( auto n : ordered )
+		removeNode(n);
+}
+
+// Delete an intermediate tensor that no node uses or calculates anymore.
+// E.g. the output of a node whose output was taken over by another node.
+void Graph::dropTensor(Tensor* t)
+{
+	if( t->consumers.size() > 0 || t->isIO || findProducer(t) != nullptr )
+		ERROR("onnx2c internal error: dropping tensor " << t->name << " that is still in use");
+	std::erase(tensors, t);
+	delete t;
+}
+
+// Move node n to be executed just after 'position'
+void Graph::moveNodeAfter(Node* n, Node* position)
+{
+	std::erase(nodes, n);
+	auto pos = std::find(nodes.begin(), nodes.end(), position);
+	if( pos == nodes.end() )
+		ERROR("onnx2c internal error: node " << position->onnx_name << " not in graph");
+	nodes.insert(pos+1, n);
+}
+
+// Create a new node from an ONNX node description, as if it had been
+// in the input .onnx file. The node's inputs are referred to by name,
+// and must already exist in the graph.
+// The new node is placed to be executed just before 'position'.
+Node* Graph::insertNode(onnx::NodeProto& onnx_node, Node* position)
+{
+	if( onnx_node.name() == "" )
+		onnx_node.set_name(uniqueName("onnx2c_" + onnx_node.op_type()));
+
+	if( tryResolveNode(onnx_node) == false )
+		ERROR("onnx2c internal error: could not resolve generated node " << onnx_node.name());
+
+	Node* n = nodes.back();
+	nodes.pop_back();
+	auto pos = std::find(nodes.begin(), nodes.end(), position);
+	if( pos == nodes.end() )
+		ERROR("onnx2c internal error: node " << position->onnx_name << " not in graph");
+	nodes.insert(pos, n);
+	return n;
+}
+
+// Add attributes to an ONNX node description made for insertNode()
+void Graph::addIntAttribute(onnx::NodeProto& onnx_node, const std::string& name, int64_t val)
+{
+	onnx::AttributeProto* attr = onnx_node.add_attribute();
+	attr->set_name(name);
+	attr->set_type(onnx::AttributeProto_AttributeType_INT);
+	attr->set_i(val);
+}
+
+void Graph::addIntsAttribute(onnx::NodeProto& onnx_node, const std::string& name, const std::vector<int64_t>& vals)
+{
+	onnx::AttributeProto* attr = onnx_node.add_attribute();
+	attr->set_name(name);
+	attr->set_type(onnx::AttributeProto_AttributeType_INTS);
+	for( auto v : vals )
+		attr->add_ints(v);
+}
+
+void Graph::addFloatAttribute(onnx::NodeProto& onnx_node, const std::string& name, float val)
+{
+	onnx::AttributeProto* attr = onnx_node.add_attribute();
+	attr->set_name(name);
+	attr->set_type(onnx::AttributeProto_AttributeType_FLOAT);
+	attr->set_f(val);
+}
+
+// Make node n write its Nth output into the existing tensor t, instead of
+// the new tensor it created when resolving. This is how a replacement node
+// takes over the place of the node(s) it replaces, keeping the name, graph IO
+// status and users of the replaced node's output.
+void Graph::takeOverOutput(Node* n, unsigned output_no, Tensor* t)
+{
+	Tensor* created = n->get_output_tensor(output_no);
+	if( created->data_dim != t->data_dim || created->data_type != t->data_type )
+		ERROR("onnx2c internal error: replacement node " << n->onnx_name << " output does not match " << t->name);
+
+	n->replace_output(created, t);
+	std::erase(tensors, created);
+	delete created;
+}
+
+// Create a new constant tensor. The data buffer is allocated and zeroed,
+// and it is left for the caller to fill.
+Tensor* Graph::addConstTensor(const std::string& name_base, onnx::TensorProto_DataType type, const std::vector<int>& dims)
+{
+	Tensor* t = new Tensor;
+	t->data_type = type;
+	t->data_dim = dims;
+	t->isConst = true;
+	t->initialize = true;
+	t->generate = true;
+	t->name = uniqueName(name_base);
+	t->data_buffer = calloc(t->data_num_elem(), t->data_elem_size());
+	if( t->data_buffer == NULL )
+		ERROR("memory allocation failed for tensor " << t->name);
+	addTensor(t);
+	return t;
+}
+
+// Can a pass give nodes scratch buffers (see addScratchTensor())?
+// Not with runtime sized dimensions: the scratch tensors don't have the
+// runtime sized dimension, and resolve_runtime_dims() can't tell them
+// from the real outputs.
+bool Graph::scratchAllowed(const std::string& pass_name) const
+{
+	if( options.runtime_dims.size() == 0 )
+		return true;
+	LOG(INFO) << pass_name << ": not run with runtime sized dimensions" << std::endl;
+	return false;
+}
+
+// Create a scratch buffer for node n, named after it. The buffer is
+// passed to the node's function as the output named 'param'.
+Tensor* Graph::addScratchTensor(Node* n, const std::string& param, const std::string& name_suffix,
+                                onnx::TensorProto_DataType type, const std::vector<int>& dims)
+{
+	Tensor* t = new Tensor;
+	t->data_type = type;
+	t->data_dim = dims;
+	t->name = uniqueName(n->onnx_name + "_" + name_suffix);
+	addTensor(t);
+	n->register_output(t, param);
+	return t;
+}
+
+// A tensor or node name that is not yet used in the graph
+std::string Graph::uniqueName(const std::string& base) const
+{
+	std::string name = base;
+	for( unsigned i=0; ; i++ ) {
+		bool taken = findTensor(name) != nullptr;
+		for( auto n : nodes )
+			taken |= n->onnx_name == name;
+		if( !taken )
+			return name;
+		name = base + "_" + std::to_string(i);
+	}
+}
@@ -0,0 +1,88 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'im2col' optimization pass.
+ *
+ * The direct loops of a convolution read each input value once per
+ * output channel and kernel position, with little data reuse between
+ * the innermost loops. The im2col lowering first packs the input patches
+ * under the kernel into the columns of a scratch matrix, and then
+ * calculates the convolution as a GEMM of the weights and that matrix,
+ * in register sized blocks.
+ *
+ * The packing pays off only when each packed patch is used for several
+ * output channels. So the pass lowers the Conv nodes with enough output
+ * channels per group, and leaves e.g. depthwise convolutions alone.
+ * Pointwise convolutions don't need packing at all: the Conv node
+ * prints them as a GEMM with the input as it is.
+ *
+ * The scratch matrix is not made for the whole output at once: the
+ * patches of a tile of output rows are packed at a time. The tile is
+ * the largest one whose matrix is not larger than the node's output.
+ * The matrix is an output of the node, so that the 'unionize' pass can
+ * share its memory with the other intermediate tensors.
+ */
+#include "graph.h"
+#include "nodes/conv.h"
+
+using namespace toC;
+
+// Output channels per group a patch is used for, at least.
+// The GEMM calculates four channels at a time.
+static const int MIN_GROUP_MAPS = 8;
+
+bool Graph::lower_to_im2col(Node* n)
+{
+	Conv* conv = dynamic_cast<Conv*>(n);
+	if( conv == nullptr || conv->im2col_rows > 0 || conv->winograd || conv->pool_op != "" || conv->channels_last )
+		return false;
+	const Tensor* x = conv->get_X();
+	const Tensor* y = conv->get_Y();
+	if( x->data_type != onnx::TensorProto_DataType_FLOAT && x->data_type != onnx::TensorProto_DataType_DOUBLE )
+		return false;
+	unsigned n_data_dims = conv->get_numDataDim();
+	if( n_data_dims == 0 || y->isRecursive )
+		return false;
+
+	int group_maps = conv->get_channel_dim(y) / conv->group;
+	if( group_maps < MIN_GROUP_MAPS )
+		return false;
+
+	// Pointwise convolutions are printed as a GEMM without the packing
+	if( conv->is_pointwise() )
+		return false;
+
+	int patch_size = conv->get_channel_dim(x) / conv->group;
+	int row_positions = 1;
+	for( unsigned i=0; i<n_data_dims; i++ ) {
+		patch_size *= conv->kernel_shape[i];
+		if( i > 0 )
+			row_positions *= conv->get_spatial_dim(y, i);
+	}
+
+	int rows = y->data_num_elem() / (patch_size * row_positions);
+	if( rows < 1 )
+		return false;
+	rows = std::min(rows, conv->get_spatial_dim(y, 0));
+
+	LOG(DEBUG) << "  lowering Conv " << n->onnx_name << " to im2col, " << rows << " output rows at a time" << std::endl;
+	addScratchTensor(n, "col", "im2col", x->data_type, {patch_size, rows * row_positions});
+	conv->im2col_rows = rows;
+	return true;
+}
+
+void Graph::im2col(void)
+{
+	LOG(DEBUG) << "Optimisation pass: im2col" << std::endl;
+	unsigned num_lowered = 0;
+
+	if( scratchAllowed("im2col") == false )
+		return;
+
+	for( auto n : nodes ) {
+		LOG(TRACE) << "considering node: " << n->onnx_name << std::endl;
+		if( lower_to_im2col(n) )
+			num_lowered++;
+	}
+
+	LOG(INFO) << "im2col: " << num_lowered << " Conv nodes lowered to im2col and GEMM" << std::endl;
+}
@@ -0,0 +1,292 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'lower_qdq' optimization pass.
+ *
+ * Quantized models in the QDQ format keep the computation nodes
+ * in float, and wrap them in DequantizeLinear and QuantizeLinear
+ * nodes:
+ *   DQ(x) -> Conv -> Q
+ *   DQ(w) -/
+ * This pass replaces such patterns with the corresponding
+ * integer node (QLinearConv, QLinearMatMul, QLinearAdd, QLinearMul)
+ * that reads and writes the quantized tensors directly.
+ * The Q -> DQ pairs between the computation nodes disappear with
+ * the lowered nodes. DQ -> Q pairs that quantize back with the same
+ * parameters are removed.
+ *
+ * Only per-tensor quantization is handled, since that is what the
+ * QLinear nodes implement.
+ */
+#include "graph.h"
+#include "nodes/spatialfilter.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace toC;
+
+static bool is_8bit(const Tensor* t)
+{
+	return t->data_type == onnx::TensorProto_DataType_INT8
+	    || t->data_type == onnx::TensorProto_DataType_UINT8;
+}
+
+static bool is_scalar_param(const Tensor* t)
+{
+	return t->rank() == 0 || (t->rank() == 1 && t->data_dim[0] == 1);
+}
+
+// Get the quantization parameters of a DequantizeLinear or QuantizeLinear node.
+// A missing zero point is created as a constant 0.
+// Return false if the parameters are not per-tensor.
+bool Graph::get_qparams(Node* n, onnx::TensorProto_DataType type, Tensor*& scale, Tensor*& zero_point)
+{
+	scale = n->get_input_tensor(1);
+	zero_point = n->get_number_of_inputs() > 2 ? n->get_input_tensor(2) : nullptr;
+	if( is_scalar_param(scale) == false )
+		return false;
+	if( zero_point && is_scalar_param(zero_point) == false )
+		return false;
+	if( zero_point == nullptr )
+		zero_point = addConstTensor(n->onnx_name + "_zero_point", type, {1});
+	return true;
+}
+
+// The DequantizeLinear node calculating t, if it dequantizes an 8-bit tensor
+Node* Graph::find_dequantizer(const Tensor* t)
+{
+	Node* dq = findProducer(t);
+	if( dq == nullptr || dq->op_name != "DequantizeLinear" )
+		return nullptr;
+	if( is_8bit(dq->get_input_tensor(0)) == false )
+		return nullptr;
+	if( dq->get_input_tensor(1)->data_type != onnx::TensorProto_DataType_FLOAT )
+		return nullptr;
+	return dq;
+}
+
+// Calculate the float bias of a Conv at compile time, and quantize
+// it to int32 with the scale x_scale*w_scale, as QLinearConv expects.
+// The bias is either a float constant, or a dequantized constant.
+Tensor* Graph::quantize_conv_bias(Tensor* bias, Tensor* x_scale, Tensor* w_scale)
+{
+	if( isInitializer(x_scale) == false || isInitializer(w_scale) == false )
+		return nullptr;
+	double scale = (double)x_scale->get_data_element_float(0) * w_scale->get_data_element_float(0);
+	if( scale == 0 )
+		return nullptr;
+
+	std::vector<double> vals;
+	if( isInitializer(bias) && bias->data_type == onnx::TensorProto_DataType_FLOAT ) {
+		for( int i=0; i<bias->data_num_elem(); i++ )
+			vals.push_back(bias->get_data_element_float(i));
+	}
+	else {
+		Node* dq = findProducer(bias);
+		if( dq == nullptr || dq->op_name != "DequantizeLinear" )
+			return nullptr;
+		Tensor* q = dq->get_input_tensor(0);
+		Tensor* b_scale = dq->get_input_tensor(1);
+		Tensor* b_zero_point = dq->get_number_of_inputs() > 2 ? dq->get_input_tensor(2) : nullptr;
+		if( isInitializer(q) == false || isInitializer(b_scale) == false )
+			return nullptr;
+		if( b_zero_point && isInitializer(b_zero_point) == false )
+			return nullptr;
+		if( q->data_type == onnx::TensorProto_DataType_INT64 || b_scale->data_type != onnx::TensorProto_DataType_FLOAT )
+			return nullptr;
+		if( is_scalar_param(b_scale) == false || (b_zero_point && is_scalar_param(b_zero_point) == false) )
+			return nullptr;
+		double s = b_scale->get_data_element_float(0);
+		int64_t zp = b_zero_point ? b_zero_point->get_data_element(0) : 0;
+		for( int i=0; i<q->data_num_elem(); i++ )
+			vals.push_back((q->get_data_element(i) - zp) * s);
+	}
+
+	// A bias that does not fit into int32 can't be lowered.
+	// Check before creating the tensor, so nothing is left behind.
+	for( auto& v : vals ) {
+		v = std::nearbyint(v / scale);
+		if( !(v <= INT32_MAX && v >= INT32_MIN) ) {
+			LOG(DEBUG) << "  bias " << bias->name << " does not fit into int32 when quantized" << std::endl;
+			return nullptr;
+		}
+	}
+
+	Tensor* rv = addConstTensor(bias->name + "_quantized", onnx::TensorProto_DataType_INT32, {(int)vals.size()});
+	for( unsigned i=0; i<vals.size(); i++ )
+		((int32_t*)rv->data_buffer)[i] = vals[i];
+	return rv;
+}
+
+// DQ(a), DQ(b) -> n -> Q
+// becomes
+// QLinear<n>(a, b)
+bool Graph::lower_qdq_node(Node* n)
+{
+	bool is_conv = n->op_name == "Conv";
+	if( !is_conv && n->op_name != "MatMul" && n->op_name != "Add" && n->op_name != "Mul" )
+		return false;
+
+	Tensor* y = n->get_output_tensor(0);
+	if( y->isIO || y->consumers.size() != 1 || y->consumers[0]->op_name != "QuantizeLinear" )
+		return false;
+	Node* q = y->consumers[0];
+	if( q->get_input_tensor(1)->data_type != onnx::TensorProto_DataType_FLOAT )
+		return false;
+
+	Node* dq_a = find_dequantizer(n->get_input_tensor(0));
+	Node* dq_b = find_dequantizer(n->get_input_tensor(1));
+	if( dq_a == nullptr || dq_b == nullptr )
+		return false;
+	Tensor* a = dq_a->get_input_tensor(0);
+	Tensor* b = dq_b->get_input_tensor(0);
+	Tensor* z = q->get_output_tensor(0);
+	if( is_8bit(z) == false )
+		return false;
+	// QLinearAdd and QLinearMul keep the type of the inputs
+	if( !is_conv && n->op_name != "MatMul" && (a->data_type != b->data_type || a->data_type != z->data_type) )
+		return false;
+
+	// Check all parameters before creating anything
+	for( Node* qn : {dq_a, dq_b, q} ) {
+		if( is_scalar_param(qn->get_input_tensor(1)) == false )
+			return false;
+		if( qn->get_number_of_inputs() > 2 && is_scalar_param(qn->get_input_tensor(2)) == false )
+			return false;
+	}
+	Tensor* bias = nullptr;
+	Node* dq_bias = nullptr;
+	if( is_conv && n->get_number_of_inputs() > 2 ) {
+		bias = quantize_conv_bias(n->get_input_tensor(2), dq_a->get_input_tensor(1), dq_b->get_input_tensor(1));
+		if( bias == nullptr )
+			return false;
+		dq_bias = findProducer(n->get_input_tensor(2));
+		if( dq_bias && dq_bias->op_name != "DequantizeLinear" )
+			dq_bias = nullptr;
+	}
+
+	Tensor *a_scale, *a_zero_point, *b_scale, *b_zero_point, *y_scale, *y_zero_point;
+	get_qparams(dq_a, a->data_type, a_scale, a_zero_point);
+	get_qparams(dq_b, b->data_type, b_scale, b_zero_point);
+	get_qparams(q, z->data_type, y_scale, y_zero_point);
+
+	onnx::NodeProto proto;
+	proto.set_name(uniqueName(n->onnx_name + "_quantized"));
+	if( is_conv )
+		proto.set_op_type("QLinearConv");
+	else
+		proto.set_op_type("QLinear" + n->op_name);
+	for( Tensor* t : {a, a_scale, a_zero_point, b, b_scale, b_zero_point, y_scale, y_zero_point} )
+		proto.add_input(t->name);
+	if( bias )
+		proto.add_input(bias->name);
+	proto.add_output(uniqueName(z->name + "_quantized"));
+
+	if( is_conv ) {
+		SpatialFilter* conv = dynamic_cast<SpatialFilter*>(n);
+		addIntsAttribute(proto, "kernel_shape", conv->kernel_shape);
+		addIntsAttribute(proto, "dilations", conv->dilations);
+		addIntsAttribute(proto, "pads", conv->pads);
+		addIntsAttribute(proto, "strides", conv->strides);
+		addIntAttribute(proto, "group", conv->group);
+	}
+
+	LOG(DEBUG) << "  lowering " << n->op_name << " " << n->onnx_name << " to " << proto.op_type() << std::endl;
+	Node* lowered = insertNode(proto, n);
+	takeOverOutput(lowered, 0, z);
+	removeNode(q);
+	removeNode(n);
+	for( Node* dq : {dq_a, dq_b, dq_bias} ) {
+		// dq_a might be dq_b, and already deleted
+		if( dq == nullptr || std::find(nodes.begin(), nodes.end(), dq) == nodes.end() )
+			continue;
+		Tensor* dq_out = dq->get_output_tensor(0);
+		if( dq_out->consumers.size() == 0 && dq_out->isIO == false )
+			removeNode(dq);
+	}
+	return true;
+}
+
+// Two quantization parameter tensors that are known to be equal
+static bool same_param(const Tensor* a, const Tensor* b, bool is_float)
+{
+	if( a == b )
+		return true;
+	if( a->data_type != b->data_type || a->data_num_elem() != b->data_num_elem() )
+		return false;
+	if( a->isConst == false || b->isConst == false || a->data_buffer == nullptr || b->data_buffer == nullptr )
+		return false;
+	for( int i=0; i<a->data_num_elem(); i++ ) {
+		if( is_float && a->get_data_element_float(i) != b->get_data_element_float(i) )
+			return false;
+		if( !is_float && a->get_data_element(i) != b->get_data_element(i) )
+			return false;
+	}
+	return true;
+}
+
+// DQ(x) -> Q with the same parameters is a no-op
+bool Graph::cancel_dq_q(Node* dq)
+{
+	Tensor* x = dq->get_input_tensor(0);
+	Tensor* f = dq->get_output_tensor(0);
+	if( f->isIO || f->consumers.size() != 1 || f->consumers[0]->op_name != "QuantizeLinear" )
+		return false;
+	Node* q = f->consumers[0];
+	Tensor* z = q->get_output_tensor(0);
+	if( z->isIO || x->data_type != z->data_type || x->data_dim != z->data_dim )
+		return false;
+	if( dq->get_input_tensor(1)->data_type != onnx::TensorProto_DataType_FLOAT )
+		return false;
+	if( same_param(dq->get_input_tensor(1), q->get_input_tensor(1), true) == false )
+		return false;
+	// per-axis parameters must be along the same axis
+	if( dq->get_input_tensor(1)->data_num_elem() > 1 )
+		return false;
+	bool dq_zp = dq->get_number_of_inputs() > 2;
+	bool q_zp = q->get_number_of_inputs() > 2;
+	if( dq_zp && q_zp ) {
+		if( same_param(dq->get_input_tensor(2), q->get_input_tensor(2), false) == false )
+			return false;
+	}
+	else if( dq_zp || q_zp ) {
+		// a missing zero point is uint8 0
+		Tensor* zp = dq_zp ? dq->get_input_tensor(2) : q->get_input_tensor(2);
+		if( zp->data_type != onnx::TensorProto_DataType_UINT8 || zp->isConst == false || zp->data_buffer == nullptr )
+			return false;
+		if( zp->get_data_element(0) != 0 )
+			return false;
+	}
+
+	LOG(DEBUG) << "  removing DequantizeLinear/QuantizeLinear pair " << dq->onnx_name << ", " << q->onnx_name << std::endl;
+	replaceTensorUsers(z, x);
+	removeNode(q);
+	removeNode(dq);
+	return true;
+}
+
+void Graph::lower_qdq(void)
+{
+	LOG(DEBUG) << "Optimisation pass: lower QDQ" << std::endl;
+	unsigned num_lowered = 0, num_cancelled = 0;
+
+	bool changed;
+	do {
+		changed = false;
+		for( auto n : nodes ) {
+			LOG(TRACE) << "considering node: " << n->onnx_name << std::endl;
+			if( n->op_name == "DequantizeLinear" && cancel_dq_q(n) ) {
+				num_cancelled++;
+				changed = true;
+				break;
+			}
+			if( lower_qdq_node(n) ) {
+				num_lowered++;
+				changed = true;
+				break;
+			}
+		}
+	} while( changed );
+
+	LOG(INFO) << "Lower QDQ: " << num_lowered << " nodes lowered to integer arithmetic, "
+	          << num_cancelled << " DequantizeLinear/QuantizeLinear pairs removed" << std::endl;
+}
@@ -0,0 +1,433 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'range_analysis' optimization pass.
+ *
+ * The pass propagates the range of values of each tensor through the
+ * graph, in node order. The ranges start from the constant tensors,
+ * the integer types, the ranges of graph inputs declared with the
+ * '--input-range' option and the nodes whose outputs are limited
+ * regardless of their inputs (e.g. Relu, Sigmoid, QuantizeLinear).
+ *
+ * The ranges are then used to
+ *  - remove the Relu and Clip nodes whose input is already inside
+ *    their limits (e.g. a Relu after a Sigmoid),
+ *  - use 16 bit accumulators in the QLinearConv and QLinearMatMul nodes
+ *    whose sums are provably small enough. On 8 and 16 bit MCUs this
+ *    halves the cost of the inner loop.
+ *  - store constant int64 Gather indices as int32.
+ *
+ * A declared input range is a promise: if the inputs are outside it
+ * at runtime, the removed Relus and Clips are missed.
+ */
+#include "graph.h"
+#include "nodes/clip.h"
+#include "nodes/qlinearconv.h"
+#include "nodes/qlinearmatmul.h"
+#include "options.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+
+using namespace toC;
+
+struct Range {
+	double lo, hi;
+};
+typedef std::map<const Tensor*, Range> RangeMap;
+
+static const double INF = std::numeric_limits<double>::infinity();
+
+// The value of element i of a constant, for the types ranges are kept for
+static bool constant_element(const Tensor* t, unsigned i, double& v)
+{
+	switch( t->data_type ) {
+		case onnx::TensorProto_DataType_FLOAT:
+			v = t->get_data_element_float(i);
+			return true;
+		case onnx::TensorProto_DataType_DOUBLE:
+			v = ((double*)t->data_buffer)[i];
+			return true;
+		case onnx::TensorProto_DataType_INT8:
+		case onnx::TensorProto_DataType_UINT8:
+		case onnx::TensorProto_DataType_INT16:
+		case onnx::TensorProto_DataType_UINT16:
+		case onnx::TensorProto_DataType_INT32:
+		case onnx::TensorProto_DataType_INT64:
+			v = t->get_data_element(i);
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool is_constant(const Tensor* t)
+{
+	return t->isConst && t->data_buffer != nullptr && t->isIO == false;
+}
+
+static bool scalar_constant(const Tensor* t, double& v)
+{
+	if( is_constant(t) == false || t->data_num_elem() != 1 )
+		return false;
+	return constant_element(t, 0, v);
+}
+
+static bool type_range(onnx::TensorProto_DataType type, Range& r)
+{
+	switch( type ) {
+		case onnx::TensorProto_DataType_INT8:
+			r = {INT8_MIN, INT8_MAX};
+			return true;
+		case onnx::TensorProto_DataType_UINT8:
+			r = {0, UINT8_MAX};
+			return true;
+		case onnx::TensorProto_DataType_INT16:
+			r = {INT16_MIN, INT16_MAX};
+			return true;
+		case onnx::TensorProto_DataType_UINT16:
+			r = {0, UINT16_MAX};
+			return true;
+		case onnx::TensorProto_DataType_INT32:
+			r = {INT32_MIN, INT32_MAX};
+			return true;
+		case onnx::TensorProto_DataType_UINT32:
+			r = {0, UINT32_MAX};
+			return true;
+		default:
+			return false;
+	}
+}
+
+// The range of a tensor: propagated, from the constant's values, or from its type
+static bool get_range(const Tensor* t, const RangeMap& ranges, Range& r)
+{
+	auto it = ranges.find(t);
+	if( it != ranges.end() ) {
+		r = it->second;
+		return true;
+	}
+	if( is_constant(t) && t->data_num_elem() > 0 ) {
+		r = {INF, -INF};
+		for( int i=0; i<t->data_num_elem(); i++ ) {
+			double v;
+			if( constant_element(t, i, v) == false )
+				return false;
+			r.lo = std::min(r.lo, v);
+			r.hi = std::max(r.hi, v);
+		}
+		return true;
+	}
+	return type_range(t->data_type, r);
+}
+
+// The limits of a Clip node. Non-constant limits are unknown.
+static bool clip_limits(const Node* n, Range& limits)
+{
+	const Clip* clip = dynamic_cast<const Clip*>(n);
+	limits = {clip->min_attr, clip->max_attr};
+	for( unsigned i=1; i<3 && i<n->get_number_of_inputs(); i++ ) {
+		const Tensor* t = n->get_input_tensor(i);
+		if( t->is_used() == false )
+			continue;
+		if( scalar_constant(t, i == 1 ? limits.lo : limits.hi) == false )
+			return false;
+	}
+	return limits.lo <= limits.hi;
+}
+
+// Interval arithmetic for the binary elementwise nodes
+static bool binary_range(const std::string& op, Range a, Range b, Range& r)
+{
+	if( op == "Add" )
+		r = {a.lo + b.lo, a.hi + b.hi};
+	else if( op == "Sub" )
+		r = {a.lo - b.hi, a.hi - b.lo};
+	else if( op == "Max" )
+		r = {std::max(a.lo, b.lo), std::max(a.hi, b.hi)};
+	else if( op == "Min" )
+		r = {std::min(a.lo, b.lo), std::min(a.hi, b.hi)};
+	else if( op == "Mul" ) {
+		// inf * 0 would be NaN
+		if( !std::isfinite(a.lo) || !std::isfinite(a.hi) || !std::isfinite(b.lo) || !std::isfinite(b.hi) )
+			return false;
+		double p[] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+		r = {*std::min_element(p, p + 4), *std::max_element(p, p + 4)};
+	}
+	else
+		return false;
+	return true;
+}
+
+// The range of the first output of node n
+static bool output_range(const Node* n, const RangeMap& ranges, Range& r)
+{
+	const std::string& op = n->op_name;
+	Range in{};
+	bool known = get_range(n->get_input_tensor(0), ranges, in);
+
+	if( op == "Relu" ) {
+		r = known ? Range{std::max(in.lo, 0.0), std::max(in.hi, 0.0)} : Range{0, INF};
+		return true;
+	}
+	if( op == "Clip" ) {
+		Range limits;
+		if( clip_limits(n, limits) == false )
+			return false;
+		if( known == false )
+			in = {-INF, INF};
+		r = {std::clamp(in.lo, limits.lo, limits.hi), std::clamp(in.hi, limits.lo, limits.hi)};
+		return true;
+	}
+	if( op == "Sigmoid" || op == "HardSigmoid" || op == "Softmax" ) {
+		r = {0, 1};
+		return true;
+	}
+	if( op == "Tanh" ) {
+		r = {-1, 1};
+		return true;
+	}
+	if( op == "Abs" ) {
+		r = known ? Range{in.lo > 0 ? in.lo : (in.hi < 0 ? -in.hi : 0), std::max(-in.lo, in.hi)} : Range{0, INF};
+		return true;
+	}
+	if( op == "Exp" ) {
+		r = known ? Range{std::exp(in.lo), std::exp(in.hi)} : Range{0, INF};
+		return true;
+	}
+
+	if( op == "DequantizeLinear" || op == "QuantizeLinear" ) {
+		double scale, zero_point = 0;
+		if( known == false || scalar_constant(n->get_input_tensor(1), scale) == false || scale <= 0 )
+			return false;
+		if( n->get_number_of_inputs() > 2 && n->get_input_tensor(2)->is_used()
+		 && scalar_constant(n->get_input_tensor(2), zero_point) == false )
+			return false;
+		if( op == "DequantizeLinear" )
+			r = {(in.lo - zero_point) * scale, (in.hi - zero_point) * scale};
+		else
+			r = {std::round(in.lo / scale) + zero_point, std::round(in.hi / scale) + zero_point};
+		return true;
+	}
+
+	if( op == "Add" || op == "Sub" || op == "Mul" || op == "Max" || op == "Min" ) {
+		if( n->get_number_of_inputs() != 2 )
+			return false;
+		Range b;
+		if( known == false || get_range(n->get_input_tensor(1), ranges, b) == false )
+			return false;
+		return binary_range(op, in, b, r);
+	}
+
+	if( op == "Concat" ) {
+		if( known == false )
+			return false;
+		r = in;
+		for( unsigned i=1; i<n->get_number_of_inputs(); i++ ) {
+			Range o;
+			if( get_range(n->get_input_tensor(i), ranges, o) == false )
+				return false;
+			r = {std::min(r.lo, o.lo), std::max(r.hi, o.hi)};
+		}
+		return true;
+	}
+
+	// Nodes whose outputs are elements of their first input
+	if( op == "Reshape" || op == "Flatten" || op == "Squeeze" || op == "Unsqueeze"
+	 || op == "Transpose" || op == "Identity" || op == "Dropout" || op == "Slice"
+	 || op == "Gather" || op == "Split"
+	 || op == "MaxPool" || op == "GlobalMaxPool" || op == "ReduceMax" || op == "ReduceMin"
+	 || op == "GlobalAveragePool" || op == "ReduceMean" ) {
+		r = in;
+		return known;
+	}
+	// Averages that may include zero padding
+	if( op == "AveragePool" ) {
+		r = {std::min(in.lo, 0.0), std::max(in.hi, 0.0)};
+		return known;
+	}
+	return false;
+}
+
+// Is the input of a Relu or Clip node already inside its limits
+static bool is_redundant_clamp(const Node* n, const RangeMap& ranges)
+{
+	Range in, limits;
+	if( n->op_name == "Relu" )
+		limits = {0, INF};
+	else if( n->op_name != "Clip" || clip_limits(n, limits) == false )
+		return false;
+	if( get_range(n->get_input_tensor(0), ranges, in) == false )
+		return false;
+	return in.lo >= limits.lo && in.hi <= limits.hi;
+}
+
+// The largest absolute value of (x - zero_point) for a quantized input
+static bool max_offset(const Tensor* x, const Tensor* zero_point, const RangeMap& ranges, double& offset)
+{
+	Range r;
+	double zp;
+	if( get_range(x, ranges, r) == false || scalar_constant(zero_point, zp) == false )
+		return false;
+	offset = std::max(std::abs(r.lo - zp), std::abs(r.hi - zp));
+	return true;
+}
+
+// The sums of |w - zero_point| of the constant weights, in 'groups' of
+// 'count' elements, 'stride' elements apart. E.g. the weights used for
+// each output channel of a convolution.
+static bool weight_sums(const Tensor* w, const Tensor* zero_point, unsigned groups, unsigned count,
+                        unsigned stride, unsigned group_stride, std::vector<double>& sums)
+{
+	double zp;
+	if( is_constant(w) == false || scalar_constant(zero_point, zp) == false )
+		return false;
+	for( unsigned g=0; g<groups; g++ ) {
+		double sum = 0;
+		for( unsigned i=0; i<count; i++ ) {
+			double v;
+			if( constant_element(w, g * group_stride + i * stride, v) == false )
+				return false;
+			sum += std::abs(v - zp);
+		}
+		sums.push_back(sum);
+	}
+	return true;
+}
+
+// Switch a QLinearConv or QLinearMatMul to a 16 bit accumulator, if the
+// largest possible sum of products (and bias) fits in it.
+// The partial sums and the single products are not larger than that.
+static bool narrow_accumulator(Node* n, const RangeMap& ranges)
+{
+	double x_offset, bound = 0;
+	std::vector<double> sums;
+	if( max_offset(n->get_input_tensor(0), n->get_input_tensor(2), ranges, x_offset) == false )
+		return false;
+
+	const Tensor* w = n->get_input_tensor(3);
+	QLinearConv* conv = dynamic_cast<QLinearConv*>(n);
+	QLinearMatMul* matmul = dynamic_cast<QLinearMatMul*>(n);
+	if( conv ) {
+		// W is (M x C/group x kH x kW), or (M x kH x kW x C/group) in channels last
+		unsigned M = w->data_dim[0];
+		unsigned per_output = w->data_num_elem() / M;
+		if( weight_sums(w, n->get_input_tensor(5), M, per_output, 1, per_output, sums) == false )
+			return false;
+		for( unsigned m=0; m<M; m++ ) {
+			double bias = 0;
+			if( n->get_number_of_inputs() == 9 ) {
+				const Tensor* b = n->get_input_tensor(8);
+				if( is_constant(b) == false || constant_element(b, m, bias) == false )
+					return false;
+			}
+			bound = std::max(bound, sums[m] * x_offset + std::abs(bias));
+		}
+	}
+	else if( matmul ) {
+		// B is (... x K x N), the products of each column are summed
+		unsigned rank = w->rank();
+		unsigned K = rank >= 2 ? w->data_dim[rank - 2] : w->data_dim[0];
+		unsigned N = rank >= 2 ? w->data_dim[rank - 1] : 1;
+		for( unsigned batch=0; batch < w->data_num_elem() / (K * N); batch++ )
+			for( unsigned col=0; col<N; col++ )
+				if( weight_sums(w, n->get_input_tensor(5), 1, K, N, batch * K * N + col, sums) == false )
+					return false;
+		for( double s : sums )
+			bound = std::max(bound, s * x_offset);
+	}
+	else
+		return false;
+
+	LOG(TRACE) << "  largest sum of " << n->onnx_name << " is " << bound << std::endl;
+	if( bound > INT16_MAX )
+		return false;
+	LOG(DEBUG) << "  using a 16 bit accumulator in " << n->op_name << " " << n->onnx_name << std::endl;
+	if( conv )
+		conv->accumulator_type = "int16_t";
+	else
+		matmul->accumulator_type = "int16_t";
+	return true;
+}
+
+// Replace the constant int64 indices of a Gather node with int32 ones
+bool Graph::narrow_gather_indices(Node* n)
+{
+	Tensor* indices = n->get_input_tensor(1);
+	if( indices->data_type != onnx::TensorProto_DataType_INT64 || isInitializer(indices) == false )
+		return false;
+	for( int i=0; i<indices->data_num_elem(); i++ ) {
+		int64_t v = indices->get_data_element(i);
+		if( v < INT32_MIN || v > INT32_MAX )
+			return false;
+	}
+
+	LOG(DEBUG) << "  narrowing indices " << indices->name << " of " << n->onnx_name << " to int32" << std::endl;
+	Tensor* narrow = addConstTensor(indices->name + "_int32", onnx::TensorProto_DataType_INT32, indices->data_dim);
+	for( int i=0; i<indices->data_num_elem(); i++ )
+		((int32_t*)narrow->data_buffer)[i] = indices->get_data_element(i);
+	replaceNodeInput(n, indices, narrow);
+	return true;
+}
+
+void Graph::range_analysis(void)
+{
+	LOG(DEBUG) << "Optimisation pass: range analysis" << std::endl;
+	unsigned num_clamps = 0, num_accumulators = 0, num_indices = 0;
+	RangeMap ranges;
+
+	for( auto& [name, range] : options.input_ranges ) {
+		Tensor* t = findTensor(name);
+		if( t == nullptr || t->isIO == false || isInitializer(t) ) {
+			LOG(WARNING) << "Declared range of " << name << " is ignored, it is not a graph input" << std::endl;
+			continue;
+		}
+		ranges[t] = {range.first, range.second};
+	}
+
+	// Nodes are removed while iterating
+	std::vector<Node*> original_nodes = nodes;
+	for( auto n : original_nodes ) {
+		LOG(TRACE) << "considering node: " << n->onnx_name << std::endl;
+		if( n->get_number_of_outputs() == 0 || n->get_number_of_inputs() == 0 )
+			continue;
+		Tensor* in = n->get_input_tensor(0);
+
+		if( is_redundant_clamp(n, ranges) ) {
+			Tensor* out = n->get_output_tensor(0);
+			Range r;
+			bool known = get_range(in, ranges, r);
+			if( bypass_node(n, in) ) {
+				num_clamps++;
+				if( known )
+					ranges[out] = r;
+				continue;
+			}
+		}
+		if( (n->op_name == "QLinearConv" || n->op_name == "QLinearMatMul") && narrow_accumulator(n, ranges) )
+			num_accumulators++;
+		if( n->op_name == "Gather" && narrow_gather_indices(n) )
+			num_indices++;
+
+		Range r, type_r;
+		Tensor* out = n->get_output_tensor(0);
+		if( output_range(n, ranges, r) == false )
+			continue;
+		// QuantizeLinear saturates, the other integer results would wrap around
+		if( type_range(out->data_type, type_r) ) {
+			if( n->op_name == "QuantizeLinear" ) {
+				r.lo = std::clamp(r.lo, type_r.lo, type_r.hi);
+				r.hi = std::clamp(r.hi, type_r.lo, type_r.hi);
+			}
+			else if( r.lo < type_r.lo || r.hi > type_r.hi )
+				continue;
+		}
+		LOG(TRACE) << "  range of " << out->name << " is [" << r.lo << ", " << r.hi << "]" << std::endl;
+		ranges[out] = r;
+	}
+
+	LOG(INFO) << "Range analysis: " << num_clamps << " Relu/Clip nodes removed, "
+	          << num_accumulators << " accumulators narrowed to 16 bits, "
+	          << num_indices << " Gather indices narrowed to int32" << std::endl;
+}
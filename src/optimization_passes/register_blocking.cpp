@@ -0,0 +1,64 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'register_blocking' optimization pass.
+ *
+ * The direct loops of a convolution calculate one output at a time, so
+ * every input value and weight loaded is used for a single multiply-add.
+ * The 'im2col' pass gets around that with a packed copy of the input,
+ * but on small targets (e.g. the 128 KB of RAM of an STM32F411) there
+ * is no room for the copy.
+ *
+ * This pass makes the Conv nodes calculate their outputs in tiles of
+ * output channels times consecutive outputs along the last data dimension,
+ * in local accumulators that the C compiler can keep in registers. Each
+ * input value loaded is then used for all the channels of the tile, and
+ * each weight for all the outputs of the tile. No scratch memory is needed.
+ *
+ * The tile size is set with the '--conv-tile maps:pixels' option. The
+ * default 4x4 tile needs 16 accumulators, 4 input values and a weight,
+ * which fits the 32 single precision registers of a Cortex-M4F.
+ */
+#include "graph.h"
+#include "nodes/conv.h"
+#include "options.h"
+#include <algorithm>
+
+using namespace toC;
+
+bool Graph::register_block(Node* n)
+{
+	Conv* conv = dynamic_cast<Conv*>(n);
+	if( conv == nullptr || conv->tile_maps > 0 || conv->im2col_rows > 0 || conv->winograd )
+		return false;
+	if( conv->pool_op != "" || conv->channels_last || conv->get_numDataDim() == 0 )
+		return false;
+	// These have loops of their own
+	if( conv->is_depthwise() || conv->is_pointwise() )
+		return false;
+	const Tensor* x = conv->get_X();
+	if( x->data_type != onnx::TensorProto_DataType_FLOAT && x->data_type != onnx::TensorProto_DataType_DOUBLE )
+		return false;
+
+	int group_maps = conv->get_channel_dim(conv->get_Y()) / conv->group;
+	int out_last = conv->get_spatial_dim(conv->get_Y(), conv->get_numDataDim() - 1);
+	conv->tile_maps = std::min(options.conv_tile_maps, group_maps);
+	conv->tile_pixels = std::min(options.conv_tile_pixels, out_last);
+	LOG(DEBUG) << "  register blocking Conv " << n->onnx_name << " in tiles of " << conv->tile_maps
+	           << " output channels x " << conv->tile_pixels << " outputs" << std::endl;
+	return true;
+}
+
+void Graph::register_blocking(void)
+{
+	LOG(DEBUG) << "Optimisation pass: register blocking" << std::endl;
+	unsigned num_blocked = 0;
+
+	for( auto n : nodes ) {
+		LOG(TRACE) << "considering node: " << n->onnx_name << std::endl;
+		if( register_block(n) )
+			num_blocked++;
+	}
+
+	LOG(INFO) << "Register blocking: " << num_blocked << " Conv nodes calculated in "
+	          << options.conv_tile_maps << "x" << options.conv_tile_pixels << " tiles" << std::endl;
+}
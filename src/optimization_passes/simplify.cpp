@@ -0,0 +1,209 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'simplify' optimization pass.
+ *
+ * Exported networks contain nodes that don't change their input,
+ * but onnx2c would still print a copy loop and an output buffer for
+ * each of them. This pass removes such nodes, and makes their users
+ * read the input directly:
+ *  - Identity nodes
+ *  - Dropout nodes (onnx2c only does inference), if the mask is not used
+ *  - Casts to the type the input already has
+ *  - Mul and Div by a constant one, Add and Sub of a constant zero,
+ *    when the constant does not broadcast the other input to a larger shape
+ *  - Reshapes to the shape the input already has
+ *
+ * Chains of the nodes that only change the shape of a tensor
+ * (Reshape, Flatten, Squeeze, Unsqueeze) are shortened: a node pair
+ * that restores the original shape (e.g. Unsqueeze -> Squeeze) is
+ * removed, and a Reshape of such a node reads the node's input instead.
+ *
+ * The rules are applied until none of them matches.
+ */
+#include "graph.h"
+#include <cstdint>
+
+using namespace toC;
+
+// Nodes that copy their input as-is, and only give it new dimensions.
+static bool is_shape_op(const Node* n)
+{
+	return n->op_name == "Reshape" || n->op_name == "Flatten"
+	    || n->op_name == "Squeeze" || n->op_name == "Unsqueeze";
+}
+
+// Is t a compile time constant with all elements equal to v.
+static bool is_constant_of(const Tensor* t, int v)
+{
+	if( t->isConst == false || t->data_buffer == nullptr || t->isIO )
+		return false;
+	for( int i=0; i<t->data_num_elem(); i++ ) {
+		switch( t->data_type ) {
+			case onnx::TensorProto_DataType_FLOAT:
+				if( ((float*)t->data_buffer)[i] != v )
+					return false;
+				break;
+			case onnx::TensorProto_DataType_DOUBLE:
+				if( ((double*)t->data_buffer)[i] != v )
+					return false;
+				break;
+			case onnx::TensorProto_DataType_INT8:
+			case onnx::TensorProto_DataType_UINT8:
+			case onnx::TensorProto_DataType_INT16:
+			case onnx::TensorProto_DataType_UINT16:
+			case onnx::TensorProto_DataType_INT32:
+			case onnx::TensorProto_DataType_INT64:
+				if( t->get_data_element(i) != v )
+					return false;
+				break;
+			default:
+				return false;
+		}
+	}
+	return true;
+}
+
+// Remove node n, whose output 0 has the same contents as tensor 'in'.
+// The users of the output are given 'in' instead. Graph outputs
+// can't be replaced, so for them the node that calculates 'in' is
+// made to write to the graph output directly.
+bool Graph::bypass_node(Node* n, Tensor* in)
+{
+	Tensor* out = n->get_output_tensor(0);
+	if( out->data_type != in->data_type || out->data_num_elem() != in->data_num_elem() )
+		ERROR("onnx2c internal error: bypassing node " << n->onnx_name << " with a different tensor");
+
+	if( out->isIO == false ) {
+		LOG(DEBUG) << "  removing " << n->op_name << " node " << n->onnx_name << std::endl;
+		replaceTensorUsers(out, in);
+		removeNode(n);
+		return true;
+	}
+
+	Node* producer = findProducer(in);
+	if( producer == nullptr || in->isIO || in->isRecursive || in->data_dim != out->data_dim )
+		return false;
+	if( in->consumers.size() != 1 || in->consumers[0] != n )
+		return false;
+	LOG(DEBUG) << "  removing " << n->op_name << " node " << n->onnx_name
+	           << ", " << producer->onnx_name << " writes the graph output" << std::endl;
+	producer->replace_output(in, out);
+	in->consumers.clear();
+	removeNode(n);
+	dropTensor(in);
+	return true;
+}
+
+// Mul(X, 1), Div(X, 1), Add(X, 0), Sub(X, 0) and the commutative
+// variants with the constant as first operand. Returns X, or nullptr.
+static Tensor* neutral_operand_of(const Node* n)
+{
+	Tensor* a = n->get_input_tensor(0);
+	Tensor* b = n->get_input_tensor(1);
+	const Tensor* y = n->get_output_tensor(0);
+	bool commutative = n->op_name == "Mul" || n->op_name == "Add";
+	int neutral = (n->op_name == "Mul" || n->op_name == "Div") ? 1 : 0;
+
+	// The constant must not broadcast X to a larger shape
+	if( y->data_dim == a->data_dim && y->data_type == a->data_type && is_constant_of(b, neutral) )
+		return a;
+	if( commutative && y->data_dim == b->data_dim && y->data_type == b->data_type && is_constant_of(a, neutral) )
+		return b;
+	return nullptr;
+}
+
+void Graph::simplify(void)
+{
+	LOG(DEBUG) << "Optimisation pass: simplify" << std::endl;
+	unsigned num_identity = 0, num_dropout = 0, num_cast = 0, num_neutral = 0;
+	unsigned num_reshape = 0, num_round_trip = 0, num_chain = 0;
+
+	bool changed;
+	do {
+		changed = false;
+		for( auto n : nodes ) {
+			LOG(TRACE) << "considering node: " << n->onnx_name << std::endl;
+			if( n->get_number_of_outputs() == 0 || n->get_number_of_inputs() == 0 )
+				continue;
+			Tensor* in = n->get_input_tensor(0);
+			Tensor* out = n->get_output_tensor(0);
+
+			if( n->op_name == "Identity" && bypass_node(n, in) ) {
+				num_identity++;
+				changed = true;
+				break;
+			}
+
+			if( n->op_name == "Dropout" && n->is_output_N_used(1) == false && bypass_node(n, in) ) {
+				num_dropout++;
+				changed = true;
+				break;
+			}
+
+			if( n->op_name == "Cast" && in->data_type == out->data_type && bypass_node(n, in) ) {
+				num_cast++;
+				changed = true;
+				break;
+			}
+
+			if( n->op_name == "Mul" || n->op_name == "Div" || n->op_name == "Add" || n->op_name == "Sub" ) {
+				Tensor* x = neutral_operand_of(n);
+				if( x && bypass_node(n, x) ) {
+					num_neutral++;
+					changed = true;
+					break;
+				}
+				continue;
+			}
+
+			if( is_shape_op(n) == false )
+				continue;
+
+			if( n->op_name == "Reshape" && in->data_dim == out->data_dim && bypass_node(n, in) ) {
+				num_reshape++;
+				changed = true;
+				break;
+			}
+
+			Node* producer = findProducer(in);
+			if( producer == nullptr || is_shape_op(producer) == false || in->isIO )
+				continue;
+			Tensor* chain_input = producer->get_input_tensor(0);
+
+			// E.g. Unsqueeze -> Squeeze, that gives back the original tensor
+			if( chain_input->data_dim == out->data_dim && out->isIO == false ) {
+				LOG(DEBUG) << "  removing " << producer->op_name << " -> " << n->op_name
+				           << " pair " << producer->onnx_name << ", " << n->onnx_name << std::endl;
+				replaceTensorUsers(out, chain_input);
+				removeNode(n);
+				if( in->consumers.size() == 0 )
+					removeNode(producer);
+				num_round_trip++;
+				changed = true;
+				break;
+			}
+
+			// Reshape prints a copy of all elements, so it doesn't
+			// care what shape its input has.
+			if( n->op_name == "Reshape" ) {
+				LOG(DEBUG) << "  shortcutting " << producer->op_name << " -> Reshape chain" << std::endl;
+				n->replace_input(in, chain_input);
+				chain_input->consumers.push_back(n);
+				std::erase(in->consumers, n);
+				if( in->consumers.size() == 0 )
+					removeNode(producer);
+				num_chain++;
+				changed = true;
+				break;
+			}
+		}
+	} while( changed );
+
+	LOG(INFO) << "Simplify: " << num_identity << " Identity, "
+	          << num_dropout << " Dropout, "
+	          << num_cast << " no-op Cast, "
+	          << num_neutral << " Mul/Div by one or Add/Sub of zero, "
+	          << num_reshape << " no-op Reshape nodes removed. "
+	          << num_round_trip << " shape changing node pairs removed, "
+	          << num_chain << " Reshape chains shortcut" << std::endl;
+}
@@ -0,0 +1,95 @@
+/* This file is part of onnx2c.
+ *
+ * Implemented here is the 'winograd' optimization pass.
+ *
+ * 3x3 stride 1 convolutions are calculated with the Winograd F(2x2,3x3)
+ * algorithm: a 2x2 tile of outputs takes 16 multiplications per input
+ * channel, instead of the 36 of the direct convolution.
+ *
+ * The weights are transformed into the Winograd domain at compile time,
+ * and the transformed weights replace the original initializer. Only
+ * the transforms of the input and output tiles are done at runtime.
+ * The transformed input tiles of all channels are stored in a scratch
+ * tensor, so that each is calculated only once for all output channels.
+ * The scratch tensor is an output of the node, so that the 'unionize'
+ * pass can share its memory with the other intermediate tensors.
+ *
+ * The larger F(4x4,3x3) tiles would save more multiplications, but its
+ * transforms lose too much accuracy in single precision.
+ */
+#include "graph.h"
+#include "nodes/conv.h"
+
+using namespace toC;
+
+// The transform is calculated once per tile and input channel,
+// and used for each output channel
+static const int MIN_MAPS = 4;
+
+// U = G g G^T, for each 3x3 kernel g of w
+static void transform_weights(const Tensor* w, Tensor* u)
+{
+	const double G[4][3] = {
+		{1, 0, 0},
+		{0.5, 0.5, 0.5},
+		{0.5, -0.5, 0.5},
+		{0, 0, 1}};
+	int num_kernels = w->data_dim[0] * w->data_dim[1];
+	for( int k=0; k<num_kernels; k++ ) {
+		const float* g = (const float*)w->data_buffer + k * 9;
+		float* dst = (float*)u->data_buffer + k * 16;
+		double gt[4][3]; // G g
+		for( int i=0; i<4; i++ )
+			for( int j=0; j<3; j++ )
+				gt[i][j] = G[i][0] * g[j] + G[i][1] * g[3 + j] + G[i][2] * g[6 + j];
+		for( int i=0; i<4; i++ )
+			for( int j=0; j<4; j++ )
+				dst[i * 4 + j] = gt[i][0] * G[j][0] + gt[i][1] * G[j][1] + gt[i][2] * G[j][2];
+	}
+}
+
+bool Graph::lower_to_winograd(Node* n)
+{
+	Conv* conv = dynamic_cast<Conv*>(n);
+	if( conv == nullptr || conv->winograd || conv->im2col_rows > 0 )
+		return false;
+	if( conv->pool_op != "" || conv->channels_last || conv->group != 1 )
+		return false;
+	Tensor* w = n->get_input_tensor(1);
+	const Tensor* x = conv->get_X();
+	if( x->data_type != onnx::TensorProto_DataType_FLOAT || isInitializer(w) == false )
+		return false;
+	if( x->rank() != 4 || conv->get_Y()->isRecursive )
+		return false;
+	for( unsigned i=0; i<2; i++ )
+		if( conv->kernel_shape[i] != 3 || conv->strides[i] != 1 || conv->dilations[i] != 1 )
+			return false;
+	if( w->data_dim[2] != 3 || w->data_dim[3] != 3 || w->data_dim[0] < MIN_MAPS )
+		return false;
+
+	LOG(DEBUG) << "  lowering Conv " << n->onnx_name << " to Winograd F(2x2,3x3)" << std::endl;
+	Tensor* u = addConstTensor(w->name + "_winograd", onnx::TensorProto_DataType_FLOAT, {w->data_dim[0], w->data_dim[1], 4, 4});
+	transform_weights(w, u);
+	replaceNodeInput(n, w, u);
+
+	addScratchTensor(n, "v", "winograd_v", x->data_type, {conv->get_channel_dim(x), 4, 4});
+	conv->winograd = true;
+	return true;
+}
+
+void Graph::winograd(void)
+{
+	LOG(DEBUG) << "Optimisation pass: winograd" << std::endl;
+	unsigned num_lowered = 0;
+
+	if( scratchAllowed("Winograd") == false )
+		return;
+
+	for( auto n : nodes ) {
+		LOG(TRACE) << "considering node: " << n->onnx_name << std::endl;
+		if( lower_to_winograd(n) )
+			num_lowered++;
+	}
+
+	LOG(INFO) << "Winograd: " << num_lowered << " Conv nodes lowered to Winograd F(2x2,3x3)" << std::endl;
+}
@@ -48,29 +48,68 @@ void initialize_logging(void)
 	AixLog::Log::init<AixLog::SinkCerr>(s);
 }
 
-void store_define_option(const std::string& opt)
+void store_define_option(const std::string& opt, const std::string& flag, std::map<std::string, uint32_t>& defines)
 {
 	auto delim_pos = opt.find(':', 0);
 	if (delim_pos == std::string::npos)
-		ERROR("bad command line argument for the '-d' option");
+		ERROR("bad command line argument for the '" << flag << "' option");
 
 	std::string name = opt.substr(0, delim_pos);
 	if (name.size() < 1)
-		ERROR("bad command line argument for the '-d' option");
+		ERROR("bad command line argument for the '" << flag << "' option");
 
 	std::string val = opt.substr(delim_pos + 1, std::string::npos);
 	if (val.size() < 1)
-		ERROR("bad command line argument for the '-d' option");
+		ERROR("bad command line argument for the '" << flag << "' option");
 
 	uint32_t val_num;
 	try {
 		val_num = std::stoul(val);
 	}
 	catch (std::exception& e) {
-		ERROR("bad command line argument for the '-d' option");
+		ERROR("bad command line argument for the '" << flag << "' option");
 	}
 
-	options.dim_defines[name] = val_num;
+	defines[name] = val_num;
+}
+
+void store_range_option(const std::string& opt)
+{
+	// name:min:max, where the name may contain colons
+	auto max_pos = opt.rfind(':');
+	auto min_pos = max_pos == std::string::npos || max_pos == 0 ? std::string::npos : opt.rfind(':', max_pos - 1);
+	if (min_pos == std::string::npos || min_pos == 0)
+		ERROR("bad command line argument for the '--input-range' option");
+
+	std::string name = opt.substr(0, min_pos);
+	float min, max;
+	try {
+		min = std::stof(opt.substr(min_pos + 1, max_pos - min_pos - 1));
+		max = std::stof(opt.substr(max_pos + 1));
+	}
+	catch (std::exception& e) {
+		ERROR("bad command line argument for the '--input-range' option");
+	}
+	if (min > max)
+		ERROR("bad command line argument for the '--input-range' option");
+
+	options.input_ranges[name] = std::make_pair(min, max);
+}
+
+void store_conv_tile_option(const std::string& opt)
+{
+	auto delim_pos = opt.find(':');
+	if (delim_pos == std::string::npos)
+		ERROR("bad command line argument for the '--conv-tile' option");
+	try {
+		options.conv_tile_maps = std::stoi(opt.substr(0, delim_pos));
+		options.conv_tile_pixels = std::stoi(opt.substr(delim_pos + 1));
+	}
+	catch (std::exception& e) {
+		ERROR("bad command line argument for the '--conv-tile' option");
+	}
+	if (options.conv_tile_maps < 1 || options.conv_tile_pixels < 1)
+		ERROR("bad command line argument for the '--conv-tile' option");
 }
 
 void print_optimization_passes(void)
@@ -78,6 +117,22 @@ void print_optimization_passes(void)
 	std::cout << "Available optimization passes:" << std::endl;
 	std::cout << " - 'unionize' (defaut:on)" << std::endl;
 	std::cout << " - 'fold_casts' (defaut:on)" << std::endl;
+	std::cout << " - 'fold_transposes' (defaut:off)" << std::endl;
+	std::cout << " - 'fuse_linear' (defaut:off)" << std::endl;
+	std::cout << " - 'lower_qdq' (defaut:off)" << std::endl;
+	std::cout << " - 'fold_pads' (defaut:off)" << std::endl;
+	std::cout << " - 'simplify' (defaut:off)" << std::endl;
+	std::cout << " - 'fuse_siblings' (defaut:off)" << std::endl;
+	std::cout << " - 'fuse_attention' (defaut:off)" << std::endl;
+	std::cout << " - 'fuse_decomposed' (defaut:off)" << std::endl;
+	std::cout << " - 'fuse_conv_activation' (defaut:off)" << std::endl;
+	std::cout << " - 'fuse_conv_pool' (defaut:off)" << std::endl;
+	std::cout << " - 'channels_last' (defaut:off)" << std::endl;
+	std::cout << " - 'range_analysis' (defaut:off)" << std::endl;
+	std::cout << " - 'im2col' (defaut:off)" << std::endl;
+	std::cout << " - 'winograd' (defaut:off)" << std::endl;
+	std::cout << " - 'register_blocking' (defaut:off)" << std::endl;
+	std::cout << " - 'blocked_gemm' (defaut:off)" << std::endl;
 	std::cout << " - 'none' (disable all optimization passes)" << std::endl;
 }
 
@@ -89,6 +144,22 @@ void store_optimization_passes(const std::string& opt)
 	// then enable those that were requested
 	options.opt_unionize = false;
 	options.opt_fold_casts = false;
+	options.opt_fold_transposes = false;
+	options.opt_fuse_linear = false;
+	options.opt_lower_qdq = false;
+	options.opt_fold_pads = false;
+	options.opt_simplify = false;
+	options.opt_fuse_siblings = false;
+	options.opt_fuse_attention = false;
+	options.opt_fuse_decomposed = false;
+	options.opt_fuse_conv_activation = false;
+	options.opt_fuse_conv_pool = false;
+	options.opt_channels_last = false;
+	options.opt_range_analysis = false;
+	options.opt_im2col = false;
+	options.opt_winograd = false;
+	options.opt_register_blocking = false;
+	options.opt_blocked_gemm = false;
 	if (opt == "none") {
 		LOG(TRACE) << "Disabling all optimizations: " << opt << std::endl;
 		return;
@@ -110,6 +181,70 @@ void store_optimization_passes(const std::string& opt)
 			LOG(DEBUG) << "Enabling 'Fold casts' optimization pass" << std::endl;
 			options.opt_fold_casts = true;
 		}
+		else if (item == "fold_transposes") {
+			LOG(DEBUG) << "Enabling 'Fold transposes' optimization pass" << std::endl;
+			options.opt_fold_transposes = true;
+		}
+		else if (item == "fuse_linear") {
+			LOG(DEBUG) << "Enabling 'Fuse linear' optimization pass" << std::endl;
+			options.opt_fuse_linear = true;
+		}
+		else if (item == "lower_qdq") {
+			LOG(DEBUG) << "Enabling 'Lower QDQ' optimization pass" << std::endl;
+			options.opt_lower_qdq = true;
+		}
+		else if (item == "fold_pads") {
+			LOG(DEBUG) << "Enabling 'Fold pads' optimization pass" << std::endl;
+			options.opt_fold_pads = true;
+		}
+		else if (item == "simplify") {
+			LOG(DEBUG) << "Enabling 'Simplify' optimization pass" << std::endl;
+			options.opt_simplify = true;
+		}
+		else if (item == "fuse_siblings") {
+			LOG(DEBUG) << "Enabling 'Fuse siblings' optimization pass" << std::endl;
+			options.opt_fuse_siblings = true;
+		}
+		else if (item == "fuse_attention") {
+			LOG(DEBUG) << "Enabling 'Fuse attention' optimization pass" << std::endl;
+			options.opt_fuse_attention = true;
+		}
+		else if (item == "fuse_decomposed") {
+			LOG(DEBUG) << "Enabling 'Fuse decomposed' optimization pass" << std::endl;
+			options.opt_fuse_decomposed = true;
+		}
+		else if (item == "fuse_conv_activation") {
+			LOG(DEBUG) << "Enabling 'Fuse conv activation' optimization pass" << std::endl;
+			options.opt_fuse_conv_activation = true;
+		}
+		else if (item == "fuse_conv_pool") {
+			LOG(DEBUG) << "Enabling 'Fuse conv pool' optimization pass" << std::endl;
+			options.opt_fuse_conv_pool = true;
+		}
+		else if (item == "channels_last") {
+			LOG(DEBUG) << "Enabling 'Channels last' optimization pass" << std::endl;
+			options.opt_channels_last = true;
+		}
+		else if (item == "range_analysis") {
+			LOG(DEBUG) << "Enabling 'Range analysis' optimization pass" << std::endl;
+			options.opt_range_analysis = true;
+		}
+		else if (item == "im2col") {
+			LOG(DEBUG) << "Enabling 'im2col' optimization pass" << std::endl;
+			options.opt_im2col = true;
+		}
+		else if (item == "winograd") {
+			LOG(DEBUG) << "Enabling 'Winograd' optimization pass" << std::endl;
+			options.opt_winograd = true;
+		}
+		else if (item == "register_blocking") {
+			LOG(DEBUG) << "Enabling 'Register blocking' optimization pass" << std::endl;
+			options.opt_register_blocking = true;
+		}
+		else if (item == "blocked_gemm") {
+			LOG(DEBUG) << "Enabling 'Blocked GEMM' optimization pass" << std::endl;
+			options.opt_blocked_gemm = true;
+		}
 		else {
 			LOG(WARNING) << "Optimization pass " << item << " does not exist" << std::endl;
 		}
@@ -125,6 +260,9 @@ void parse_cmdline_options(int argc, const char* argv[])
 	args::Flag externInit(parser, "extern-init", "Declare initialized tensors as extern globals", {'e', "extern-init"});
 	args::Flag onlyInit(parser, "only-init", "Only generate initialized tensors (for use with --extern-init)", {'i', "only-init"});
 	args::ValueFlagList<std::string> define(parser, "dim:size", "Define graph input dimension. Can be given multiple times", {'d', "define"});
+	args::ValueFlagList<std::string> runtimeDim(parser, "dim:max", "Keep graph input dimension as a runtime parameter of the entry function, with the given maximum size. Can be given multiple times", {'r', "runtime-dim"});
+	args::ValueFlagList<std::string> inputRange(parser, "name:min:max", "Declare the range of values of a graph input, for the 'range_analysis' optimization pass. Can be given multiple times", {"input-range"});
+	args::ValueFlag<std::string> convTile(parser, "maps:pixels", "Tile size of the 'register_blocking' optimization pass: output channels x outputs along the last dimension (default 4:4)", {"conv-tile"});
 	args::ValueFlag<int> loglevel(parser, "level", "Logging verbosity. 0(none)-4(all)", {'l', "log"});
 	args::ValueFlag<std::string> optimizations(parser, "opt[,opt]...", "Specify optimization passes to run. ('help' to list available)", {'p', "optimizations"});
 	args::ValueFlag<std::string> funcName(parser, "func-name", "The name of the forward pass function", {'f', "func-name"});
@@ -176,9 +314,22 @@ void parse_cmdline_options(int argc, const char* argv[])
 	}
 	if (define) {
 		for (const auto& d : args::get(define)) {
-			store_define_option(d);
+			store_define_option(d, "-d", options.dim_defines);
 		}
 	}
+	if (runtimeDim) {
+		for (const auto& d : args::get(runtimeDim)) {
+			store_define_option(d, "-r", options.runtime_dims);
+		}
+	}
+	if (inputRange) {
+		for (const auto& r : args::get(inputRange)) {
+			store_range_option(r);
+		}
+	}
+	if (convTile) {
+		store_conv_tile_option(args::get(convTile));
+	}
 	if (optimizations) {
 		store_optimization_passes(args::get(optimizations));
 	}
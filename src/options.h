@@ -17,6 +17,22 @@ struct onnx2c_opts {
 	bool only_init = false;
 	bool opt_unionize = true;
 	bool opt_fold_casts = true;
+	bool opt_fold_transposes = false;
+	bool opt_fuse_linear = false;
+	bool opt_lower_qdq = false;
+	bool opt_fold_pads = false;
+	bool opt_simplify = false;
+	bool opt_fuse_siblings = false;
+	bool opt_fuse_attention = false;
+	bool opt_fuse_decomposed = false;
+	bool opt_fuse_conv_activation = false;
+	bool opt_fuse_conv_pool = false;
+	bool opt_channels_last = false;
+	bool opt_range_analysis = false;
+	bool opt_im2col = false;
+	bool opt_winograd = false;
+	bool opt_register_blocking = false;
+	bool opt_blocked_gemm = false;
 /*
  * logging levels are
  * cmd line     aixlog     Use
@@ -35,6 +51,15 @@ struct onnx2c_opts {
 	std::string input_file;
 	std::string interface_func_name = "entry";
 	std::map<std::string, uint32_t> dim_defines;
+	// Symbolic dimensions left as parameters of the entry function,
+	// with their maximum sizes
+	std::map<std::string, uint32_t> runtime_dims;
+	// Value ranges of graph inputs, as declared by the user
+	std::map<std::string, std::pair<float, float>> input_ranges;
+	// Tile size of the 'register_blocking' optimization pass:
+	// output channels x outputs along the last data dimension
+	int conv_tile_maps = 4;
+	int conv_tile_pixels = 4;
 
 	// Save the raw command line arguments such that they can be printed
 	// into the generated source file.
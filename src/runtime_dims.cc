@@ -0,0 +1,137 @@
+/* This file is part of onnx2c.
+ *
+ * Runtime sized dimensions.
+ *
+ * A symbolic first dimension of a graph input (e.g. the batch size)
+ * can be left as a parameter of the entry function with the '-r' option.
+ * The tensors with that dimension are sized for its maximum, and
+ * the nodes that use them are called once per element of the runtime
+ * dimension. The node functions are generated for a single element.
+ *
+ * This works only for nodes that calculate each element of the first
+ * dimension independently of the others. Other nodes are an error.
+ */
+#include "graph.h"
+#include "nodes/elementwise.h"
+#include "nodes/elementwise_2.h"
+#include "nodes/gemm.h"
+#include "nodes/softmax.h"
+#include "nodes/spatialfilter.h"
+#include "nodes/transpose.h"
+#include "options.h"
+
+using namespace toC;
+
+// Nodes that take their runtime sized input elementwise, broadcasting
+// the other inputs.
+static bool is_elementwise(const Node* n)
+{
+	if (dynamic_cast<const Elementwise*>(n) || dynamic_cast<const Elementwise_2*>(n))
+		return true;
+	return n->op_name == "Relu" || n->op_name == "Clip";
+}
+
+// Nodes that calculate each element of the first dimension of input 0
+// separately, with the other inputs being e.g. weights.
+static bool is_per_element(const Node* n)
+{
+	if (dynamic_cast<const SpatialFilter*>(n))
+		return true;
+	if (n->op_name == "BatchNormalization" || n->op_name == "GlobalAveragePool" || n->op_name == "GlobalMaxPool")
+		return true;
+	// Nodes that copy their input as is to a new shape
+	if (n->op_name == "Reshape" || n->op_name == "Flatten" || n->op_name == "Squeeze" || n->op_name == "Unsqueeze")
+		return true;
+	if (n->op_name == "Identity" || n->op_name == "Dropout")
+		return true;
+	if (const Gemm* gemm = dynamic_cast<const Gemm*>(n))
+		return gemm->transA == 0;
+	if (n->op_name == "MatMul")
+		return n->get_input_tensor(0)->rank() >= 2 && n->get_input_tensor(1)->rank() <= 2;
+	if (const Softmax* softmax = dynamic_cast<const Softmax*>(n)) {
+		int axis = softmax->axis;
+		if (axis < 0)
+			axis += n->get_input_tensor(0)->rank();
+		return axis > 0;
+	}
+	if (const Transpose* transpose = dynamic_cast<const Transpose*>(n))
+		return transpose->perm.size() > 0 && transpose->perm[0] == 0;
+	return false;
+}
+
+// Can node n be calculated separately for each element of runtime
+// dimension 'dim', i.e. of the first dimension of the tensors that have it.
+static bool is_separable(Node* n, const std::string& dim, int max_size)
+{
+	unsigned out_rank = 0;
+	bool outputs_ok = true;
+	n->forEachOutput([&](Tensor* o) {
+		if (o->is_used() == false)
+			return;
+		if (o->rank() == 0 || o->data_dim[0] != max_size)
+			outputs_ok = false;
+		out_rank = o->rank();
+	});
+	if (outputs_ok == false)
+		return false;
+
+	bool elementwise = is_elementwise(n);
+	if (elementwise == false && is_per_element(n) == false)
+		return false;
+	for (unsigned i = 0; i < n->get_number_of_inputs(); i++) {
+		const Tensor* t = n->get_input_tensor(i);
+		if (t->is_used() == false)
+			continue;
+		if (t->runtime_dim == dim) {
+			if (elementwise ? t->rank() != out_rank : i != 0)
+				return false;
+		}
+		// The other inputs must be the same for all elements
+		else if (t->rank() >= out_rank && t->data_dim[0] != 1) {
+			// Gemm's C would be a different bias for each row
+			if (elementwise || (n->op_name == "Gemm" && i == 2))
+				return false;
+		}
+	}
+	return true;
+}
+
+void Graph::resolve_runtime_dims(void)
+{
+	for (auto n : nodes) {
+		if (n->op_name == "graph_io")
+			continue;
+
+		std::string dim;
+		for (unsigned i = 0; i < n->get_number_of_inputs(); i++) {
+			const Tensor* t = n->get_input_tensor(i);
+			if (t->runtime_dim == "" || t->runtime_dim == dim)
+				continue;
+			if (dim != "")
+				ERROR("Unimplemented: node " << n->onnx_name << " uses two runtime dimensions, " << dim << " and " << t->runtime_dim);
+			dim = t->runtime_dim;
+		}
+		if (dim == "")
+			continue;
+
+		if (is_separable(n, dim, options.runtime_dims[dim]) == false)
+			ERROR("Unimplemented: " << n->op_name << " node " << n->onnx_name << " can't be calculated with a runtime size of dimension " << dim);
+		LOG(DEBUG) << "Node " << n->onnx_name << " is called for each element of runtime dimension " << dim << std::endl;
+		n->runtime_dim = dim;
+		n->forEachOutput([&](Tensor* o) {
+			if (o->is_used())
+				o->runtime_dim = dim;
+		});
+	}
+}
+
+void Graph::set_runtime_dim_size(Node* n, int size)
+{
+	auto set = [&](Tensor* t) {
+		if (t->runtime_dim == n->runtime_dim)
+			t->data_dim[0] = size;
+	};
+	for (unsigned i = 0; i < n->get_number_of_inputs(); i++)
+		set(n->get_input_tensor(i));
+	n->forEachOutput(set);
+}
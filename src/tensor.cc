@@ -569,6 +569,14 @@ bool Tensor::is_used(void) const
 int64_t Tensor::get_data_element(uint64_t i) const
 {
 	switch (data_type) {
+		case onnx::TensorProto_DataType_INT8:
+			return ((int8_t*)data_buffer)[i];
+		case onnx::TensorProto_DataType_UINT8:
+			return ((uint8_t*)data_buffer)[i];
+		case onnx::TensorProto_DataType_INT16:
+			return ((int16_t*)data_buffer)[i];
+		case onnx::TensorProto_DataType_UINT16:
+			return ((uint16_t*)data_buffer)[i];
 		case onnx::TensorProto_DataType_INT32:
 			return ((int32_t*)data_buffer)[i];
 		case onnx::TensorProto_DataType_INT64:
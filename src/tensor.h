@@ -22,6 +22,9 @@ class Tensor {
 	void* data_buffer; // if initialized, contains the initialization data
 	std::string name;  // NB: ONNX name. Might not be valid for C
 	std::string doc;
+	// Name of the symbolic dimension, if the first dimension's size
+	// is a parameter of the entry function. data_dim[0] is its maximum.
+	std::string runtime_dim;
 
 	std::vector<Node*> consumers;
 	int32_t union_no; // negative for no union
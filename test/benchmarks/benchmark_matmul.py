@@ -0,0 +1,74 @@
+# Generate the onnx2c matrix multiplication benchmarks
+# Each run generates one test, alter test_name and variable
+# between runs.
+
+import numpy as np
+import sclblonnx as so
+from onnx import helper, numpy_helper
+from pathlib import Path
+
+
+# A square MatMul of two run-time matrices
+test_name="benchmark_matmul_256"
+op = 'MatMul'
+attrs = {}
+a_size = [256, 256]
+b_size = [256, 256]
+c_size = None
+out_size = [256, 256]
+constant_b = False
+
+# A fully connected layer, as exported from e.g. torch.nn.Linear:
+# constant, transposed weights and a bias
+#test_name="benchmark_gemm_linear"
+#op = 'Gemm'
+#attrs = {'transB': 1}
+#a_size = [64, 512]
+#b_size = [256, 512]
+#c_size = [256]
+#out_size = [64, 256]
+#constant_b = True
+
+
+# Zero centered values keep the sums over the rows small
+A = np.random.random(a_size).astype(np.float32) * 2 - 1
+B = np.random.random(b_size).astype(np.float32) * 2 - 1
+
+g = so.empty_graph()
+
+inputs = ['A', 'B']
+if constant_b:
+	g = so.add_constant(g, 'B', B, "FLOAT")
+if c_size:
+	g = so.add_constant(g, 'C', np.random.random(c_size).astype(np.float32), "FLOAT")
+	inputs.append('C')
+n1 = so.node(op, inputs=inputs, outputs=['Y'], **attrs)
+g = so.add_node(g, n1)
+g = so.add_input(g, 'A', "FLOAT", A.shape)
+if not constant_b:
+	g = so.add_input(g, 'B', "FLOAT", B.shape)
+g = so.add_output(g, 'Y', "FLOAT", out_size)
+
+
+so.check(g)
+
+example = {
+	"A": A,
+}
+if not constant_b:
+	example["B"] = B
+Path(test_name + "/test_data_set_0").mkdir(parents=True, exist_ok=True)
+so.graph_to_file(g, test_name + "/model.onnx")
+result = so.run(g,
+                inputs=example,
+                outputs=["Y"]
+                )
+
+def save_tensor(t, fn):
+	with open(fn, 'wb') as f:
+		npt = numpy_helper.from_array(t)
+		f.write(npt.SerializeToString(npt))
+
+for i, name in enumerate(example):
+	save_tensor(example[name], test_name + "/test_data_set_0/input_" + str(i) + ".pb")
+save_tensor(result[0], test_name + "/test_data_set_0/output_0.pb")
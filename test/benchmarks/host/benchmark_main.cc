@@ -52,7 +52,7 @@ BENCHMARK(BM_yolov6n_lastconv);
 namespace conv_fits_128k{
 #include "conv_fits_128k.c"
 float X[1][28][20][20];
-float W[1][28][3][3];
+float W[28][28][3][3];
 float Y[1][28][20][20];
 static void BM_conv_fits_128k(benchmark::State& state) {
 
@@ -64,6 +64,79 @@ static void BM_conv_fits_128k(benchmark::State& state) {
 BENCHMARK(BM_conv_fits_128k);
 }
 
+namespace conv_fits_128k_register_blocking{
+#include "conv_fits_128k_register_blocking.c"
+float X[1][28][20][20];
+float W[28][28][3][3];
+float Y[1][28][20][20];
+static void BM_conv_fits_128k_register_blocking(benchmark::State& state) {
+
+	for (auto _ : state) {
+		entry(X, W, Y);
+	}
+}
+// Register the function as a benchmark
+BENCHMARK(BM_conv_fits_128k_register_blocking);
+}
+
+namespace matmul_256{
+#include "matmul_256.c"
+float A[256][256];
+float B[256][256];
+float Y[256][256];
+static void BM_matmul_256(benchmark::State& state) {
+
+	for (auto _ : state) {
+		entry(A, B, Y);
+	}
+}
+// Register the function as a benchmark
+BENCHMARK(BM_matmul_256);
+}
+
+namespace matmul_256_blocked_gemm{
+#include "matmul_256_blocked_gemm.c"
+float A[256][256];
+float B[256][256];
+float Y[256][256];
+static void BM_matmul_256_blocked_gemm(benchmark::State& state) {
+
+	for (auto _ : state) {
+		entry(A, B, Y);
+	}
+}
+// Register the function as a benchmark
+BENCHMARK(BM_matmul_256_blocked_gemm);
+}
+
+namespace gemm_linear{
+#include "gemm_linear.c"
+float A[64][512];
+float Y[64][256];
+static void BM_gemm_linear(benchmark::State& state) {
+
+	for (auto _ : state) {
+		entry(A, Y);
+	}
+}
+// Register the function as a benchmark
+BENCHMARK(BM_gemm_linear);
+}
+
+namespace gemm_linear_blocked_gemm{
+#include "gemm_linear_blocked_gemm.c"
+float A[64][512];
+float Y[64][256];
+static void BM_gemm_linear_blocked_gemm(benchmark::State& state) {
+
+	for (auto _ : state) {
+		entry(A, Y);
+	}
+}
+// Register the function as a benchmark
+BENCHMARK(BM_gemm_linear_blocked_gemm);
+}
+
 
 
 // Run the benchmark
@@ -27,3 +27,6 @@ conv_fits_baseline="37712 120412 333"
 conv_fits=$($1/scripts/measure_stm32f411_nucleo.sh $1/test/benchmarks/benchmark_conv_fits_128k/model.onnx |tail -n 3)
 print_results $conv_fits_baseline $conv_fits
 
+echo  -e "\n Running benchmark_conv_fits_128k with register_blocking, compared to the above baseline"
+conv_fits_rb=$($1/scripts/measure_stm32f411_nucleo.sh $1/test/benchmarks/benchmark_conv_fits_128k/model.onnx -p register_blocking |tail -n 3)
+print_results $conv_fits_baseline $conv_fits_rb
@@ -0,0 +1,63 @@
+import numpy as np
+import onnx
+from onnx.helper import make_model, make_node, make_graph, make_tensor_value_info
+from onnx.checker import check_model
+from onnx import numpy_helper
+import os
+
+np.random.seed(0)
+
+# Pointwise (1x1, stride 1, unpadded) Convs, printed as a GEMM
+# of the weights and the input channels.
+tests = [
+    # name, X shape, M (output channels), group, bias, type
+    # 18 maps and 35 positions leave partial GEMM blocks of both
+    ("conv_pointwise_grouped", [2, 6, 5, 7], 18, 3, True, np.float32),
+    ("conv_pointwise_double", [1, 5, 3, 4], 7, 1, False, np.float64),
+]
+
+def save_tensor(t, fn):
+    with open(fn, 'wb') as f:
+        npt = numpy_helper.from_array(t)
+        f.write(npt.SerializeToString())
+
+for (name, x_shape, M, group, has_bias, dtype) in tests:
+    dir_name = "test_" + name
+    os.makedirs(f"{dir_name}/test_data_set_0", exist_ok=True)
+    elem_type = onnx.helper.np_dtype_to_tensor_dtype(np.dtype(dtype))
+
+    N, C = x_shape[0], x_shape[1]
+    x_array = (np.random.rand(*x_shape) * 2 - 1).astype(dtype)
+    w_array = (np.random.rand(M, C // group, 1, 1) * 2 - 1).astype(dtype)
+    b_array = (np.random.rand(M) * 2 - 1).astype(dtype)
+
+    # Each group is a matrix product of its weights and input channels
+    x_g = x_array.reshape(N, group, C // group, -1)
+    w_g = w_array.reshape(group, M // group, C // group)
+    y_array = np.einsum("gmk,ngkp->ngmp", w_g, x_g).reshape(N, M, *x_shape[2:])
+    if has_bias:
+        y_array += b_array.reshape(1, M, 1, 1)
+    y_array = y_array.astype(dtype)
+
+    inputs = ["X", "W"]
+    initializers = [numpy_helper.from_array(w_array, "W")]
+    if has_bias:
+        inputs.append("B")
+        initializers.append(numpy_helper.from_array(b_array, "B"))
+
+    X = make_tensor_value_info("X", elem_type, x_shape)
+    Y = make_tensor_value_info("Y", elem_type, y_array.shape)
+
+    node = make_node("Conv", inputs, ["Y"], kernel_shape=[1, 1], group=group)
+
+    graph = make_graph([node], name, [X], [Y], initializers)
+    model = make_model(graph, producer_name="conv.py")
+
+    check_model(model)
+
+    onnx.save(model, f"{dir_name}/model.onnx")
+
+    save_tensor(x_array, f"{dir_name}/test_data_set_0/input_0.pb")
+    save_tensor(y_array, f"{dir_name}/test_data_set_0/output_0.pb")
+
+    print(f"local_node_test({name})")
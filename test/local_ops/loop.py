@@ -0,0 +1,110 @@
+# Generate the onnx2c local tests for the Loop and Scan nodes.
+# Each function generates one test directory.
+
+import numpy as np
+import onnx
+import onnxruntime as ort
+from onnx import helper, numpy_helper, TensorProto
+from pathlib import Path
+
+
+def save(model, test_name, inputs):
+	onnx.checker.check_model(model)
+	Path(test_name + "/test_data_set_0").mkdir(parents=True, exist_ok=True)
+	onnx.save(model, test_name + "/model.onnx")
+	sess = ort.InferenceSession(model.SerializeToString())
+	outputs = sess.run(None, inputs)
+	for i, name in enumerate(inputs):
+		t = numpy_helper.from_array(inputs[name], name)
+		Path(test_name + "/test_data_set_0/input_" + str(i) + ".pb").write_bytes(t.SerializeToString())
+	for i, o in enumerate(sess.get_outputs()):
+		t = numpy_helper.from_array(outputs[i], o.name)
+		Path(test_name + "/test_data_set_0/output_" + str(i) + ".pb").write_bytes(t.SerializeToString())
+
+
+def rand(*shape):
+	return np.random.uniform(-1, 1, shape).astype(np.float32)
+
+
+# Loop with a constant trip count: a loop carried accumulator, a scan output
+# using the iteration number, the outer scope tensors x and w, and the
+# condition passed through the body as is.
+def loop_static():
+	body = helper.make_graph(
+		[
+			helper.make_node("Add", ["acc", "x"], ["acc_out"]),
+			helper.make_node("Mul", ["acc_out", "w"], ["s"]),
+			helper.make_node("Cast", ["iter"], ["itf"], to=TensorProto.FLOAT),
+			helper.make_node("Add", ["s", "itf"], ["s2"]),
+		],
+		"body",
+		[
+			helper.make_tensor_value_info("iter", TensorProto.INT64, []),
+			helper.make_tensor_value_info("cond", TensorProto.BOOL, []),
+			helper.make_tensor_value_info("acc", TensorProto.FLOAT, [2, 3]),
+		],
+		[
+			helper.make_tensor_value_info("cond", TensorProto.BOOL, []),
+			helper.make_tensor_value_info("acc_out", TensorProto.FLOAT, [2, 3]),
+			helper.make_tensor_value_info("s2", TensorProto.FLOAT, [2, 3]),
+		])
+	graph = helper.make_graph(
+		[
+			helper.make_node("Loop", ["M", "", "a0"], ["acc_f", "scans"], body=body),
+			helper.make_node("Relu", ["acc_f"], ["y"]),
+		],
+		"loop_static",
+		[helper.make_tensor_value_info("x", TensorProto.FLOAT, [2, 3])],
+		[
+			helper.make_tensor_value_info("y", TensorProto.FLOAT, [2, 3]),
+			helper.make_tensor_value_info("scans", TensorProto.FLOAT, [4, 2, 3]),
+		],
+		[
+			numpy_helper.from_array(np.array(4, dtype=np.int64), "M"),
+			numpy_helper.from_array(rand(2, 3), "w"),
+			numpy_helper.from_array(rand(2, 3), "a0"),
+		])
+	model = helper.make_model(graph, opset_imports=[helper.make_opsetid("", 13)])
+	save(model, "test_loop_static", {"x": rand(2, 3)})
+
+
+# Scan with a running sum as the state, and the state also as a
+# reversed scan output.
+def scan_reverse():
+	body = helper.make_graph(
+		[
+			helper.make_node("Add", ["s", "xt"], ["s_out"]),
+			helper.make_node("Mul", ["s_out", "k"], ["yt"]),
+		],
+		"sbody",
+		[
+			helper.make_tensor_value_info("s", TensorProto.FLOAT, [3]),
+			helper.make_tensor_value_info("xt", TensorProto.FLOAT, [3]),
+		],
+		[
+			helper.make_tensor_value_info("s_out", TensorProto.FLOAT, [3]),
+			helper.make_tensor_value_info("yt", TensorProto.FLOAT, [3]),
+			helper.make_tensor_value_info("s_out", TensorProto.FLOAT, [3]),
+		])
+	graph = helper.make_graph(
+		[
+			helper.make_node("Scan", ["s0", "xs"], ["sf", "ys", "ys_rev"], body=body,
+			                 num_scan_inputs=1, scan_output_directions=[0, 1]),
+		],
+		"scan_reverse",
+		[helper.make_tensor_value_info("xs", TensorProto.FLOAT, [5, 3])],
+		[
+			helper.make_tensor_value_info("sf", TensorProto.FLOAT, [3]),
+			helper.make_tensor_value_info("ys", TensorProto.FLOAT, [5, 3]),
+			helper.make_tensor_value_info("ys_rev", TensorProto.FLOAT, [5, 3]),
+		],
+		[
+			numpy_helper.from_array(rand(3), "k"),
+			numpy_helper.from_array(rand(3), "s0"),
+		])
+	model = helper.make_model(graph, opset_imports=[helper.make_opsetid("", 11)])
+	save(model, "test_scan_reverse", {"xs": rand(5, 3)})
+
+
+loop_static()
+scan_reverse()
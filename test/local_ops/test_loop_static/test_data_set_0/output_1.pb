@@ -0,0 +1 @@
+BscansJ`h>ڤ<ZwV>s1D8E=֕?jy?\c?=?R?_?(@???@cO?3c?d]C@|8@F*@gL@k,@!@
\ No newline at end of file
@@ -0,0 +1 @@
+BsfJ2U>?@
\ No newline at end of file
@@ -0,0 +1 @@
+BysJ<M?Eҽg:?#g$?%M!;>mF1H#PbWF?
\ No newline at end of file
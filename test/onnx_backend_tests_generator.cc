@@ -171,8 +171,9 @@ int main(int argc, char *argv[])
 	// the other approach is more appropriate. (e.g. the unit tests return
 	// a constant tensor, or the nodes expect the input to be compile time
 	// constants)
-#if defined TESTGEN_SINGLEFILE
+	// Print the inputs and references with all their digits, so exact tests can be made
 	std::cout.precision(20);
+#if defined TESTGEN_SINGLEFILE
 	toCgraph.unionize_tensors();
 	toCgraph.print_source(std::cout, "entry");
 	std::cout << std::endl << std::endl;
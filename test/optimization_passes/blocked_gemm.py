@@ -0,0 +1,85 @@
+# Generate the regression tests for the blocked_gemm optimization pass.
+# Each function generates one test directory.
+
+import sclblonnx as so
+from passtest import save, rand
+
+
+# Small weights keep the sums over the long rows near one
+def weights(*shape):
+	return rand(*shape) * 0.05
+
+
+# The Gemm has transposed A and B, alpha, beta and a broadcast bias.
+# Its K of 300 is more than one block of the blocked GEMM, and the
+# constant B is packed at compile time. The first MatMul broadcasts
+# the Gemm output over a batch, and packs it at run time. The second
+# MatMul has a constant B, and has partial tiles of both rows and columns.
+def blocked_gemm():
+	a = rand(300, 6)
+	x = rand(2, 5, 6)
+	g = so.empty_graph()
+	for name, value in [('b', weights(11, 300)), ('c', rand(11)), ('w', weights(11, 9) * 6)]:
+		g = so.add_constant(g, name, value, "FLOAT")
+	for op, inputs, outputs, attrs in [
+		('Gemm', ['a', 'b', 'c'], ['g'], {'transA': 1, 'transB': 1, 'alpha': 0.5, 'beta': 2.0}),
+		('MatMul', ['x', 'g'], ['m'], {}),
+		('MatMul', ['m', 'w'], ['y'], {}),
+	]:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	g = so.add_input(g, 'a', "FLOAT", a.shape)
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y', "FLOAT", (2, 5, 9))
+	save(g, "test_blocked_gemm", {"a": a, "x": x}, ["y"])
+
+
+# A single row of A is calculated as a matrix-vector product.
+# The first Gemm has a constant, transposed B that is transposed back
+# at compile time, and K is not a multiple of the four rows read at a time.
+# The second Gemm reads the rows of a transposed B given at run time,
+# with the last two columns of K and rows of B past the full blocks.
+# The MatMul has a vector for A.
+def blocked_gemm_gemv():
+	x = rand(1, 37)
+	w2 = rand(10, 26)
+	u = rand(26)
+	g = so.empty_graph()
+	for name, value in [('w1', rand(26, 37) * 0.3), ('b1', rand(26)), ('w3', rand(26, 5) * 0.3)]:
+		g = so.add_constant(g, name, value, "FLOAT")
+	for op, inputs, outputs, attrs in [
+		('Gemm', ['x', 'w1', 'b1'], ['h'], {'transB': 1}),
+		('Gemm', ['h', 'w2'], ['y1'], {'transB': 1, 'alpha': 0.5}),
+		('MatMul', ['u', 'w3'], ['y2'], {}),
+	]:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_input(g, 'w2', "FLOAT", w2.shape)
+	g = so.add_input(g, 'u', "FLOAT", u.shape)
+	g = so.add_output(g, 'y1', "FLOAT", (1, 10))
+	g = so.add_output(g, 'y2', "FLOAT", (5,))
+	save(g, "test_blocked_gemm_gemv", {"x": x, "w2": w2, "u": u}, ["y1", "y2"])
+
+
+# Batched MatMuls. The first one has the same constant B for all the
+# matrices of A, and is calculated as one GEMM of all their rows.
+# The second one broadcasts the batch dimensions of A and B against
+# each other, and calculates a GEMM for each matrix of Y.
+def blocked_gemm_batched():
+	x = rand(3, 5, 40)
+	v = rand(2, 1, 12, 9)
+	g = so.empty_graph()
+	g = so.add_constant(g, 'w', weights(40, 12) * 6, "FLOAT")
+	for op, inputs, outputs, attrs in [
+		('MatMul', ['x', 'w'], ['m'], {}),
+		('MatMul', ['m', 'v'], ['y'], {}),
+	]:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_input(g, 'v', "FLOAT", v.shape)
+	g = so.add_output(g, 'y', "FLOAT", (2, 3, 5, 9))
+	save(g, "test_blocked_gemm_batched", {"x": x, "v": v}, ["y"])
+
+
+blocked_gemm()
+blocked_gemm_batched()
+blocked_gemm_gemv()
@@ -0,0 +1,40 @@
+# Generate the regression test for the channels_last optimization pass.
+
+import sclblonnx as so
+from passtest import save, rand
+
+
+# A small residual network. The Convs (one grouped, one dilated and strided),
+# the MaxPool and the AveragePool are converted to channels last, and the
+# Transposes are sunk through the Relus, the residual Add and the Mul by a
+# per-channel constant. Transposes are left before the Flatten, after the
+# graph input, and before the second graph output.
+test_name = "test_channels_last"
+x = rand(2, 3, 8, 7)
+
+g = so.empty_graph()
+for name, value in [('w1', rand(4, 3, 3, 3)), ('b1', rand(4)), ('w2', rand(4, 2, 3, 3)), ('b2', rand(4)),
+                    ('w3', rand(4, 4, 2, 3)), ('scale', rand(4, 1, 1)), ('w4', rand(5, 4, 3, 3)), ('b4', rand(5)),
+                    ('wg', rand(45, 6) * 0.2), ('w5', rand(2, 3, 1, 1))]:
+	g = so.add_constant(g, name, value, "FLOAT")
+for op, inputs, outputs, attrs in [
+	('Conv', ['x', 'w1', 'b1'], ['c1'], {'pads': [1, 1, 1, 1]}),
+	('Relu', ['c1'], ['r1'], {}),
+	('Conv', ['r1', 'w2', 'b2'], ['c2'], {'pads': [1, 1, 1, 1], 'group': 2}),
+	('Relu', ['c2'], ['r2'], {}),
+	('Conv', ['r2', 'w3'], ['c3'], {'pads': [0, 1, 1, 1]}),
+	('Add', ['c3', 'r1'], ['a'], {}),
+	('Mul', ['a', 'scale'], ['s'], {}),
+	('MaxPool', ['s'], ['p'], {'kernel_shape': [3, 3], 'strides': [2, 2], 'pads': [1, 1, 1, 1]}),
+	('Conv', ['p', 'w4', 'b4'], ['c4'], {'strides': [2, 1], 'dilations': [1, 2], 'pads': [1, 1, 1, 1]}),
+	('AveragePool', ['c4'], ['q'], {'kernel_shape': [2, 2], 'pads': [0, 0, 1, 1]}),
+	('Flatten', ['q'], ['f'], {}),
+	('Gemm', ['f', 'wg'], ['y'], {}),
+	('Conv', ['x', 'w5'], ['y2'], {'kernel_shape': [1, 1]}),
+]:
+	g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+g = so.add_input(g, 'x', "FLOAT", x.shape)
+g = so.add_output(g, 'y', "FLOAT", (2, 6))
+g = so.add_output(g, 'y2', "FLOAT", (2, 2, 8, 7))
+
+save(g, test_name, {"x": x}, ["y", "y2"])
@@ -0,0 +1,98 @@
+# Generate the regression test for the fold_casts optimization pass.
+
+import numpy as np
+import sclblonnx as so
+from passtest import save, rand, add_nodes
+
+
+# Casts of a shared constant, a Cast chain, a Cast of an
+# elementwise node to a graph output, a Cast of a Relu that
+# is left in place and a Cast chain starting from a graph input.
+test_name = "test_fold_casts_mixed"
+x = np.random.rand(3, 4).astype(np.float32) * 2 - 1
+xi = np.random.randint(-100, 100, (3)).astype(np.int8)
+
+g = so.empty_graph()
+g = so.add_constant(g, 'idx', np.array([1, 2, 3, 4], dtype=np.int64), "INT64")
+g = so.add_constant(g, 'k', np.array([5, 6, 7, 8], dtype=np.int32), "INT32")
+for op, inputs, outputs, attrs in [
+	('Cast', ['idx'], ['i1'], {'to': 1}),
+	('Cast', ['idx'], ['i2'], {'to': 1}),
+	('Cast', ['idx'], ['i3'], {'to': 6}),
+	('Add', ['x', 'i1'], ['a'], {}),
+	('Mul', ['a', 'i2'], ['b'], {}),
+	('Cast', ['i3'], ['i4'], {'to': 1}),
+	('Sub', ['b', 'i4'], ['c'], {}),
+	('Cast', ['c'], ['c2'], {'to': 1}),
+	('Cast', ['c2'], ['c3'], {'to': 11}),
+	('Cast', ['c3'], ['y'], {'to': 1}),
+	('Relu', ['x'], ['r'], {}),
+	('Cast', ['r'], ['y2'], {'to': 6}),
+	('Cast', ['k'], ['kc'], {'to': 1}),
+	('Add', ['kc', 'y'], ['y3'], {}),
+	('Cast', ['xi'], ['xf'], {'to': 1}),
+	('Cast', ['xf'], ['y4'], {'to': 11}),
+]:
+	g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+g = so.add_input(g, 'x', "FLOAT", x.shape)
+g = so.add_input(g, 'xi', "INT8", xi.shape)
+g = so.add_output(g, 'y', "FLOAT", (3, 4))
+g = so.add_output(g, 'y2', "INT32", (3, 4))
+g = so.add_output(g, 'y3', "FLOAT", (3, 4))
+g = so.add_output(g, 'y4', "DOUBLE", (3,))
+
+save(g, test_name, {"x": x, "xi": xi}, ["y", "y2", "y3", "y4"])
+
+
+
+# Two Casts of a runtime tensor to the same type, both to internal tensors.
+test_name = "test_fold_casts_merge"
+x = rand(3, 4)
+
+g = so.empty_graph()
+g = add_nodes(g, [
+	('Relu', ['x'], ['r'], {}),
+	('Cast', ['r'], ['e1'], {'to': 11}),
+	('Cast', ['r'], ['e2'], {'to': 11}),
+	('Mul', ['e1', 'e1'], ['m'], {}),
+	('Add', ['m', 'e2'], ['y'], {}),
+])
+g = so.add_input(g, 'x', "FLOAT", x.shape)
+g = so.add_output(g, 'y', "DOUBLE", (3, 4))
+
+save(g, test_name, {"x": x}, ["y"])
+
+
+# An internal Cast followed by a duplicate Cast to a graph output.
+# The users of the earlier Cast must not read the later one's output.
+test_name = "test_fold_casts_merge_output"
+x = rand(3, 4)
+
+g = so.empty_graph()
+g = add_nodes(g, [
+	('Relu', ['x'], ['r'], {}),
+	('Cast', ['r'], ['e'], {'to': 11}),
+	('Add', ['e', 'e'], ['f'], {}),
+	('Cast', ['r'], ['y'], {'to': 11}),
+])
+g = so.add_input(g, 'x', "FLOAT", x.shape)
+g = so.add_output(g, 'f', "DOUBLE", (3, 4))
+g = so.add_output(g, 'y', "DOUBLE", (3, 4))
+
+save(g, test_name, {"x": x}, ["f", "y"])
+
+
+# Cast of an initializer to INT64, calculated at compile time.
+test_name = "test_fold_casts_const_int64"
+x = np.random.randint(-100, 100, (4)).astype(np.int64)
+
+g = so.empty_graph()
+g = so.add_constant(g, 'k', np.array([5, -6, 7, 8], dtype=np.int32), "INT32")
+g = add_nodes(g, [
+	('Cast', ['k'], ['kc'], {'to': 7}),
+	('Add', ['x', 'kc'], ['y'], {}),
+])
+g = so.add_input(g, 'x', "INT64", x.shape)
+g = so.add_output(g, 'y', "INT64", (4,))
+
+save(g, test_name, {"x": x}, ["y"])
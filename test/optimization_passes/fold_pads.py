@@ -0,0 +1,35 @@
+# Generate the regression test for the fold_pads optimization pass.
+
+import numpy as np
+import sclblonnx as so
+from passtest import save
+
+
+# Zero padding before a Conv (that has pads of its own),
+# -inf padding before a MaxPool and zero padding before an AveragePool
+# are folded. The Pad of a graph output is left in place.
+test_name = "test_fold_pads"
+x = np.random.rand(1, 2, 6, 7).astype(np.float32) * 2 - 1
+
+g = so.empty_graph()
+g = so.add_constant(g, 'p1', np.array([0, 0, 1, 2, 0, 0, 2, 1], dtype=np.int64), "INT64")
+g = so.add_constant(g, 'w', np.random.rand(3, 2, 3, 3).astype(np.float32) * 2 - 1, "FLOAT")
+g = so.add_constant(g, 'b', np.random.rand(3).astype(np.float32) * 2 - 1, "FLOAT")
+g = so.add_constant(g, 'p2', np.array([0, 0, 1, 1, 0, 0, 1, 1], dtype=np.int64), "INT64")
+g = so.add_constant(g, 'ninf', np.array(-np.inf, dtype=np.float32), "FLOAT")
+g = so.add_constant(g, 'p3', np.array([0, 0, 0, 1, 0, 0, 1, 0], dtype=np.int64), "INT64")
+for op, inputs, outputs, attrs in [
+	('Pad', ['x', 'p1'], ['xp'], {'mode': 'constant'}),
+	('Conv', ['xp', 'w', 'b'], ['c'], {'pads': [0, 1, 1, 0], 'strides': [2, 1]}),
+	('Pad', ['c', 'p2', 'ninf'], ['cp'], {}),
+	('MaxPool', ['cp'], ['m'], {'kernel_shape': [3, 3]}),
+	('Pad', ['m', 'p3'], ['mp'], {}),
+	('AveragePool', ['mp'], ['y'], {'kernel_shape': [2, 2]}),
+	('Pad', ['x', 'p1'], ['y2'], {'mode': 'constant'}),
+]:
+	g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+g = so.add_input(g, 'x', "FLOAT", x.shape)
+g = so.add_output(g, 'y', "FLOAT", (1, 3, 4, 9))
+g = so.add_output(g, 'y2', "FLOAT", (1, 2, 9, 10))
+
+save(g, test_name, {"x": x}, ["y", "y2"])
@@ -0,0 +1,71 @@
+# Generate the regression tests for the fold_transposes optimization pass.
+# Each function generates one test directory.
+
+import numpy as np
+import sclblonnx as so
+from passtest import save
+
+
+# NCHW network wrapped in NHWC Transposes, as converted from TF.
+# The Transposes are sunk below the elementwise nodes and cancel out.
+def nhwc():
+	x = np.random.rand(1, 4, 3, 5).astype(np.float32)
+	c = np.random.rand(4).astype(np.float32)
+	g = so.empty_graph()
+	g = so.add_constant(g, 'c', c, "FLOAT")
+	g = so.add_constant(g, 's', np.array([0.5], dtype=np.float32), "FLOAT")
+	g = so.add_node(g, so.node('Transpose', inputs=['x'], outputs=['a'], perm=[0, 2, 3, 1]))
+	g = so.add_node(g, so.node('Relu', inputs=['a'], outputs=['b']))
+	g = so.add_node(g, so.node('Add', inputs=['b', 'c'], outputs=['d']))
+	g = so.add_node(g, so.node('Mul', inputs=['d', 's'], outputs=['e']))
+	g = so.add_node(g, so.node('Transpose', inputs=['e'], outputs=['f'], perm=[0, 3, 1, 2]))
+	g = so.add_node(g, so.node('Sigmoid', inputs=['f'], outputs=['y']))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y', "FLOAT", (1, 4, 3, 5))
+	save(g, "test_fold_transposes_nhwc", {"x": x}, ["y"])
+
+
+# Binary elementwise nodes with both inputs transposed, a broadcast
+# constant input and a type changing Cast in the sunk path.
+def binary():
+	x = np.random.rand(2, 3, 4, 5).astype(np.float32)
+	z = np.random.rand(2, 3, 1, 5).astype(np.float32)
+	k = np.random.rand(5, 1).astype(np.float32)
+	g = so.empty_graph()
+	g = so.add_constant(g, 'k', k, "FLOAT")
+	g = so.add_node(g, so.node('Transpose', inputs=['x'], outputs=['a'], perm=[0, 2, 3, 1]))
+	g = so.add_node(g, so.node('Transpose', inputs=['z'], outputs=['bz'], perm=[0, 2, 3, 1]))
+	g = so.add_node(g, so.node('Mul', inputs=['a', 'bz'], outputs=['c']))
+	g = so.add_node(g, so.node('Sub', inputs=['c', 'k'], outputs=['c2']))
+	g = so.add_node(g, so.node('Cast', inputs=['c2'], outputs=['c3'], to=11))
+	g = so.add_node(g, so.node('Transpose', inputs=['c3'], outputs=['y'], perm=[0, 3, 1, 2]))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_input(g, 'z', "FLOAT", z.shape)
+	g = so.add_output(g, 'y', "DOUBLE", (2, 3, 4, 5))
+	save(g, "test_fold_transposes_binary", {"x": x, "z": z}, ["y"])
+
+
+# Transposes folded into the transA/transB of Gemm, a MatMul converted to Gemm,
+# and a Transpose of a constant calculated at compile time.
+def gemm():
+	x = np.random.rand(3, 4).astype(np.float32)
+	w = np.random.rand(3, 6).astype(np.float32)
+	w2 = np.random.rand(5, 6).astype(np.float32)
+	bias = np.random.rand(5).astype(np.float32)
+	g = so.empty_graph()
+	g = so.add_constant(g, 'w', w, "FLOAT")
+	g = so.add_constant(g, 'w2', w2, "FLOAT")
+	g = so.add_constant(g, 'bias', bias, "FLOAT")
+	g = so.add_node(g, so.node('Transpose', inputs=['x'], outputs=['xt'], perm=[1, 0]))
+	g = so.add_node(g, so.node('MatMul', inputs=['xt', 'w'], outputs=['m']))
+	g = so.add_node(g, so.node('Transpose', inputs=['w2'], outputs=['w2t'], perm=[1, 0]))
+	g = so.add_node(g, so.node('Gemm', inputs=['m', 'w2t', 'bias'], outputs=['g']))
+	g = so.add_node(g, so.node('Transpose', inputs=['g'], outputs=['y'], perm=[1, 0]))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y', "FLOAT", (5, 4))
+	save(g, "test_fold_transposes_gemm", {"x": x}, ["y"])
+
+
+nhwc()
+binary()
+gemm()
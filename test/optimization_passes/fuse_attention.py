@@ -0,0 +1,55 @@
+# Generate the regression tests for the fuse_attention optimization pass.
+# Each function generates one test directory.
+
+import numpy as np
+import sclblonnx as so
+from passtest import save, rand
+
+
+# Two heads, K transposed with a Transpose node, scaled with a Div
+# and a constant mask that hides the keys after the next one.
+def attention_4d():
+	q = rand(1, 2, 5, 4)
+	k = rand(1, 2, 6, 4)
+	v = rand(1, 2, 6, 3)
+	mask = np.array([[0 if j <= i + 1 else -10000 for j in range(6)] for i in range(5)], dtype=np.float32)
+	g = so.empty_graph()
+	g = so.add_constant(g, 'd', np.array(2, dtype=np.float32), "FLOAT")
+	g = so.add_constant(g, 'mask', mask, "FLOAT")
+	g = so.add_node(g, so.node('Transpose', inputs=['k'], outputs=['kt'], perm=[0, 1, 3, 2]))
+	g = so.add_node(g, so.node('MatMul', inputs=['q', 'kt'], outputs=['s']))
+	g = so.add_node(g, so.node('Div', inputs=['s', 'd'], outputs=['s2']))
+	g = so.add_node(g, so.node('Add', inputs=['s2', 'mask'], outputs=['s3']))
+	g = so.add_node(g, so.node('Softmax', inputs=['s3'], outputs=['p'], axis=-1))
+	g = so.add_node(g, so.node('MatMul', inputs=['p', 'v'], outputs=['y']))
+	g = so.add_input(g, 'q', "FLOAT", q.shape)
+	g = so.add_input(g, 'k', "FLOAT", k.shape)
+	g = so.add_input(g, 'v', "FLOAT", v.shape)
+	g = so.add_output(g, 'y', "FLOAT", (1, 2, 5, 3))
+	save(g, "test_fuse_attention_4d", {"q": q, "k": k, "v": v}, ["y"])
+
+
+# K^T given as an input, so the pass transposes it back.
+# The scale is a Mul, and the mask a graph input broadcast over the queries.
+def attention_3d():
+	q = rand(2, 5, 4)
+	kt = rand(2, 4, 6)
+	v = rand(2, 6, 3)
+	m = rand(2, 1, 6)
+	g = so.empty_graph()
+	g = so.add_constant(g, 'c', np.array([0.5], dtype=np.float32), "FLOAT")
+	g = so.add_node(g, so.node('MatMul', inputs=['q', 'kt'], outputs=['s']))
+	g = so.add_node(g, so.node('Mul', inputs=['c', 's'], outputs=['s2']))
+	g = so.add_node(g, so.node('Add', inputs=['m', 's2'], outputs=['s3']))
+	g = so.add_node(g, so.node('Softmax', inputs=['s3'], outputs=['p']))
+	g = so.add_node(g, so.node('MatMul', inputs=['p', 'v'], outputs=['y']))
+	g = so.add_input(g, 'q', "FLOAT", q.shape)
+	g = so.add_input(g, 'kt', "FLOAT", kt.shape)
+	g = so.add_input(g, 'v', "FLOAT", v.shape)
+	g = so.add_input(g, 'm', "FLOAT", m.shape)
+	g = so.add_output(g, 'y', "FLOAT", (2, 5, 3))
+	save(g, "test_fuse_attention_3d", {"q": q, "kt": kt, "v": v, "m": m}, ["y"])
+
+
+attention_4d()
+attention_3d()
@@ -0,0 +1,57 @@
+# Generate the regression tests for the fuse_conv_activation optimization pass.
+# Each function generates one test directory.
+
+import numpy as np
+import sclblonnx as so
+from passtest import save, rand
+
+
+# Run with 'fuse_conv_activation,fuse_conv_pool,unionize'.
+# The Clip after the 3x3 depthwise Conv, the Relu after the strided 5x5
+# depthwise Conv and the Relu between the last Conv and the MaxPool are
+# fused. The MaxPool is then fused too.
+def fuse_conv_activation():
+	x = rand(1, 8, 10, 11)
+	g = so.empty_graph()
+	for name, value in [('w1', rand(8, 1, 3, 3)), ('b1', rand(8)), ('lo', np.array(0, dtype=np.float32)),
+	                    ('hi', np.array(0.5, dtype=np.float32)), ('w2', rand(8, 1, 5, 5) * 0.3),
+	                    ('w3', rand(4, 8, 3, 3) * 0.3), ('b3', rand(4))]:
+		g = so.add_constant(g, name, value, "FLOAT")
+	for op, inputs, outputs, attrs in [
+		('Conv', ['x', 'w1', 'b1'], ['c1'], {'group': 8, 'pads': [1, 1, 1, 1]}),
+		('Clip', ['c1', 'lo', 'hi'], ['a1'], {}),
+		('Conv', ['a1', 'w2'], ['c2'], {'group': 8, 'strides': [2, 2], 'pads': [2, 2, 2, 2]}),
+		('Relu', ['c2'], ['a2'], {}),
+		('Conv', ['a2', 'w3', 'b3'], ['c3'], {'pads': [1, 1, 1, 1]}),
+		('Relu', ['c3'], ['a3'], {}),
+		('MaxPool', ['a3'], ['y'], {'kernel_shape': [2, 2], 'strides': [2, 2]}),
+	]:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y', "FLOAT", (1, 4, 2, 3))
+	save(g, "test_fuse_conv_activation", {"x": x}, ["y"])
+
+
+# The limits of the Clip are not exact in decimal. The kernels have a
+# single one in the middle, so the Conv passes x through exactly, and the
+# outputs of the fused and unfused Clip are compared for exact equality.
+def fuse_conv_activation_limits():
+	x = rand(1, 2, 5, 6)
+	w = np.zeros((2, 2, 3, 3), dtype=np.float32)
+	w[0, 0, 1, 1] = w[1, 1, 1, 1] = 1
+	g = so.empty_graph()
+	for name, value in [('w', w), ('lo', np.array(-0.123456789, dtype=np.float32)),
+	                    ('hi', np.array(1 / 3, dtype=np.float32))]:
+		g = so.add_constant(g, name, value, "FLOAT")
+	for op, inputs, outputs, attrs in [
+		('Conv', ['x', 'w'], ['c'], {'pads': [1, 1, 1, 1]}),
+		('Clip', ['c', 'lo', 'hi'], ['y'], {}),
+	]:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y', "FLOAT", (1, 2, 5, 6))
+	save(g, "test_fuse_conv_activation_limits", {"x": x}, ["y"])
+
+
+fuse_conv_activation()
+fuse_conv_activation_limits()
@@ -0,0 +1,67 @@
+# Generate the regression tests for the fuse_conv_pool optimization pass.
+# Each function generates one test directory.
+
+import sclblonnx as so
+from passtest import save, rand
+
+
+# A padded Conv -> 2x2 MaxPool, a Conv -> AveragePool whose windows reach
+# into the pooling's padding, and a grouped Conv -> AveragePool counting
+# the padding are fused. The overlapping 3x3/2 MaxPool is not.
+def pool():
+	x = rand(1, 3, 9, 9)
+	x2 = rand(2, 4, 7, 7)
+	g = so.empty_graph()
+	for name, value in [('w1', rand(4, 3, 3, 3)), ('b1', rand(4)), ('w2', rand(2, 3, 3, 3)),
+	                    ('w4', rand(4, 2, 3, 3)), ('b4', rand(4))]:
+		g = so.add_constant(g, name, value, "FLOAT")
+	for op, inputs, outputs, attrs in [
+		('Conv', ['x', 'w1', 'b1'], ['c1'], {'pads': [1, 1, 1, 1]}),
+		('MaxPool', ['c1'], ['y1'], {'kernel_shape': [2, 2], 'strides': [2, 2]}),
+		('Conv', ['x', 'w2'], ['c2'], {}),
+		('AveragePool', ['c2'], ['y2'], {'kernel_shape': [3, 3], 'strides': [3, 3], 'pads': [1, 1, 0, 1]}),
+		('Conv', ['x', 'w1', 'b1'], ['c3'], {'strides': [2, 2]}),
+		('MaxPool', ['c3'], ['y3'], {'kernel_shape': [3, 3], 'strides': [2, 2]}),
+		('Conv', ['x2', 'w4', 'b4'], ['c4'], {'group': 2}),
+		('AveragePool', ['c4'], ['y4'], {'kernel_shape': [2, 2], 'strides': [2, 2], 'pads': [0, 0, 1, 1], 'count_include_pad': 1}),
+	]:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_input(g, 'x2', "FLOAT", x2.shape)
+	g = so.add_output(g, 'y1', "FLOAT", (1, 4, 4, 4))
+	g = so.add_output(g, 'y2', "FLOAT", (1, 2, 2, 3))
+	g = so.add_output(g, 'y3', "FLOAT", (1, 4, 1, 1))
+	g = so.add_output(g, 'y4', "FLOAT", (2, 4, 3, 3))
+	save(g, "test_fuse_conv_pool", {"x": x, "x2": x2}, ["y1", "y2", "y3", "y4"])
+
+
+# GlobalAveragePool, GlobalMaxPool and ReduceMeans over the spatial
+# dimensions (with and without keepdims) are fused. The ReduceMean that
+# also reduces the channels is not.
+def global_pool():
+	x = rand(2, 3, 7, 6)
+	g = so.empty_graph()
+	for name, value in [('w1', rand(4, 3, 3, 3)), ('b1', rand(4)), ('w2', rand(2, 3, 3, 3)),
+	                    ('b2', rand(2) + 3)]:
+		g = so.add_constant(g, name, value, "FLOAT")
+	for op, inputs, outputs, attrs in [
+		('Conv', ['x', 'w1', 'b1'], ['c1'], {'pads': [1, 1, 1, 1]}),
+		('GlobalAveragePool', ['c1'], ['y1'], {}),
+		('Conv', ['x', 'w2', 'b2'], ['c2'], {'strides': [2, 2]}),
+		('GlobalMaxPool', ['c2'], ['y2'], {}),
+		('Conv', ['x', 'w1'], ['c3'], {}),
+		('ReduceMean', ['c3'], ['y3'], {'axes': [-1, 2], 'keepdims': 0}),
+		('Conv', ['x', 'w2'], ['c4'], {}),
+		('ReduceMean', ['c4'], ['y4'], {'axes': [1, 2, 3]}),
+	]:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y1', "FLOAT", (2, 4, 1, 1))
+	g = so.add_output(g, 'y2', "FLOAT", (2, 2, 1, 1))
+	g = so.add_output(g, 'y3', "FLOAT", (2, 4))
+	g = so.add_output(g, 'y4', "FLOAT", (2, 1, 1, 1))
+	save(g, "test_fuse_conv_pool_global", {"x": x}, ["y1", "y2", "y3", "y4"])
+
+
+pool()
+global_pool()
@@ -0,0 +1,57 @@
+# Generate the regression test for the fuse_decomposed optimization pass.
+
+import numpy as np
+import sclblonnx as so
+from passtest import save
+
+
+# Two GELUs with the Muls in different orders, a SiLU, a LayerNorm over
+# the last axis with scale and bias, and one over two axes without them,
+# with the variance calculated with a Mul instead of a Pow.
+test_name = "test_fuse_decomposed"
+x = np.random.rand(2, 3, 8).astype(np.float32) * 2 - 1
+
+g = so.empty_graph()
+g = so.add_constant(g, 'sq2', np.array(np.sqrt(2), dtype=np.float32), "FLOAT")
+g = so.add_constant(g, 'isq2', np.array(1 / np.sqrt(2), dtype=np.float32), "FLOAT")
+g = so.add_constant(g, 'one', np.array(1, dtype=np.float32), "FLOAT")
+g = so.add_constant(g, 'half', np.array(0.5, dtype=np.float32), "FLOAT")
+g = so.add_constant(g, 'two', np.array(2, dtype=np.float32), "FLOAT")
+g = so.add_constant(g, 'eps', np.array(1e-5, dtype=np.float32), "FLOAT")
+g = so.add_constant(g, 'gamma', np.random.rand(8).astype(np.float32) * 2 - 1, "FLOAT")
+g = so.add_constant(g, 'beta', np.random.rand(8).astype(np.float32) * 2 - 1, "FLOAT")
+for op, inputs, outputs, attrs in [
+	('Div', ['x', 'sq2'], ['g1'], {}),
+	('Erf', ['g1'], ['g2'], {}),
+	('Add', ['g2', 'one'], ['g3'], {}),
+	('Mul', ['x', 'g3'], ['g4'], {}),
+	('Mul', ['g4', 'half'], ['a'], {}),
+	('Mul', ['a', 'isq2'], ['h1'], {}),
+	('Erf', ['h1'], ['h2'], {}),
+	('Add', ['one', 'h2'], ['h3'], {}),
+	('Mul', ['a', 'half'], ['h0'], {}),
+	('Mul', ['h0', 'h3'], ['b'], {}),
+	('Sigmoid', ['b'], ['s1'], {}),
+	('Mul', ['s1', 'b'], ['c'], {}),
+	('ReduceMean', ['c'], ['m'], {'axes': [-1]}),
+	('Sub', ['c', 'm'], ['d'], {}),
+	('Pow', ['d', 'two'], ['d2'], {}),
+	('ReduceMean', ['d2'], ['v'], {'axes': [-1]}),
+	('Add', ['v', 'eps'], ['v2'], {}),
+	('Sqrt', ['v2'], ['sd'], {}),
+	('Div', ['d', 'sd'], ['n'], {}),
+	('Mul', ['n', 'gamma'], ['n2'], {}),
+	('Add', ['n2', 'beta'], ['y'], {}),
+	('ReduceMean', ['x'], ['m_'], {'axes': [1, 2]}),
+	('Sub', ['x', 'm_'], ['d_'], {}),
+	('Mul', ['d_', 'd_'], ['d2_'], {}),
+	('ReduceMean', ['d2_'], ['v_'], {'axes': [1, 2]}),
+	('Add', ['eps', 'v_'], ['v2_'], {}),
+	('Sqrt', ['v2_'], ['sd_'], {}),
+	('Div', ['d_', 'sd_'], ['y2'], {}),
+]:
+	g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+g = so.add_input(g, 'x', "FLOAT", x.shape)
+g = so.add_output(g, 'y', "FLOAT", x.shape)
+g = so.add_output(g, 'y2', "FLOAT", x.shape)
+save(g, test_name, {"x": x}, ["y", "y2"])
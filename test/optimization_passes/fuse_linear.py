@@ -0,0 +1,45 @@
+# Generate the regression tests for the fuse_linear optimization pass.
+# Each function generates one test directory.
+
+import numpy as np
+import sclblonnx as so
+from passtest import save
+
+
+# Linear layer on a 3D input, as exported by PyTorch:
+# flatten, MatMul, bias Add and restore the leading dimensions.
+def reshape():
+	x = np.random.rand(2, 4, 6).astype(np.float32)
+	w = np.random.rand(6, 5).astype(np.float32)
+	b = np.random.rand(1, 5).astype(np.float32)
+	g = so.empty_graph()
+	g = so.add_constant(g, 'w', w, "FLOAT")
+	g = so.add_constant(g, 'b', b, "FLOAT")
+	g = so.add_constant(g, 's1', np.array([-1, 6], dtype=np.int64), "INT64")
+	g = so.add_constant(g, 's2', np.array([2, 4, 5], dtype=np.int64), "INT64")
+	g = so.add_node(g, so.node('Reshape', inputs=['x', 's1'], outputs=['xf']))
+	g = so.add_node(g, so.node('MatMul', inputs=['xf', 'w'], outputs=['m']))
+	g = so.add_node(g, so.node('Add', inputs=['m', 'b'], outputs=['mb']))
+	g = so.add_node(g, so.node('Reshape', inputs=['mb', 's2'], outputs=['y']))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y', "FLOAT", (2, 4, 5))
+	save(g, "test_fuse_linear_reshape", {"x": x}, ["y"])
+
+
+# Batched MatMul, with a bias that is a graph input and broadcast over columns.
+def batched():
+	x = np.random.rand(2, 3, 6).astype(np.float32)
+	w = np.random.rand(6, 5).astype(np.float32)
+	b = np.random.rand(3, 1).astype(np.float32)
+	g = so.empty_graph()
+	g = so.add_constant(g, 'w', w, "FLOAT")
+	g = so.add_node(g, so.node('MatMul', inputs=['x', 'w'], outputs=['m']))
+	g = so.add_node(g, so.node('Add', inputs=['m', 'b'], outputs=['y']))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_input(g, 'b', "FLOAT", b.shape)
+	g = so.add_output(g, 'y', "FLOAT", (2, 3, 5))
+	save(g, "test_fuse_linear_batched", {"x": x, "b": b}, ["y"])
+
+
+reshape()
+batched()
@@ -0,0 +1,68 @@
+# Generate the regression tests for the fuse_siblings optimization pass.
+# Each function generates one test directory.
+
+import numpy as np
+import sclblonnx as so
+from passtest import save, rand
+
+
+# Q/K/V projections of an attention layer. Run together with fuse_linear,
+# so the bias Adds are in the MatMuls before they are fused.
+# V has no bias, K has a broadcast scalar bias.
+def attention():
+	x = rand(2, 4, 8)
+	g = so.empty_graph()
+	for name, value in [('wq', rand(8, 6)), ('wk', rand(8, 6)), ('wv', rand(8, 5)), ('bq', rand(6)), ('bk', rand(1))]:
+		g = so.add_constant(g, name, value, "FLOAT")
+	g = so.add_node(g, so.node('MatMul', inputs=['x', 'wq'], outputs=['q0']))
+	g = so.add_node(g, so.node('Add', inputs=['q0', 'bq'], outputs=['q']))
+	g = so.add_node(g, so.node('MatMul', inputs=['x', 'wk'], outputs=['k0']))
+	g = so.add_node(g, so.node('Add', inputs=['k0', 'bk'], outputs=['k']))
+	g = so.add_node(g, so.node('MatMul', inputs=['x', 'wv'], outputs=['v']))
+	g = so.add_node(g, so.node('Relu', inputs=['q'], outputs=['y1']))
+	g = so.add_node(g, so.node('Sigmoid', inputs=['k'], outputs=['y2']))
+	g = so.add_node(g, so.node('Tanh', inputs=['v'], outputs=['y3']))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y1', "FLOAT", (2, 4, 6))
+	g = so.add_output(g, 'y2', "FLOAT", (2, 4, 6))
+	g = so.add_output(g, 'y3', "FLOAT", (2, 4, 5))
+	save(g, "test_fuse_siblings_attention", {"x": x}, ["y1", "y2", "y3"])
+
+
+# Two 1x1 Convs are fused, the 3x3 Convs with different strides are not.
+# Three Gemms with the same alpha and beta are fused, the one with
+# transB set is not.
+def conv():
+	x = rand(1, 3, 6, 6)
+	g = so.empty_graph()
+	for name, value in [('w1', rand(4, 3, 1, 1)), ('b1', rand(4)), ('w2', rand(2, 3, 1, 1)),
+	                    ('w3', rand(4, 3, 3, 3)), ('b3', rand(4)), ('w4', rand(2, 3, 3, 3)), ('b4', rand(2)),
+	                    ('g1', rand(108, 4)), ('gc1', rand(4)), ('g2', rand(108, 3)),
+	                    ('gc2', np.array(0.25, dtype=np.float32)), ('g3', rand(108, 2)), ('g4', rand(5, 108))]:
+		g = so.add_constant(g, name, value, "FLOAT")
+	for op, inputs, outputs, attrs in [
+		('Conv', ['x', 'w1', 'b1'], ['c1'], {}),
+		('Relu', ['c1'], ['y1'], {}),
+		('Conv', ['x', 'w2'], ['y2'], {}),
+		('Conv', ['x', 'w3', 'b3'], ['c3'], {'pads': [1, 1, 1, 1]}),
+		('Conv', ['x', 'w4', 'b4'], ['c4'], {'pads': [1, 1, 1, 1], 'strides': [2, 2]}),
+		('Add', ['c3', 'c1'], ['y3'], {}),
+		('Flatten', ['x'], ['xf'], {}),
+		('Gemm', ['xf', 'g1', 'gc1'], ['z1'], {'alpha': 0.5, 'beta': 2.0}),
+		('Gemm', ['xf', 'g2', 'gc2'], ['z2'], {'alpha': 0.5, 'beta': 2.0}),
+		('Gemm', ['xf', 'g3'], ['z3'], {'alpha': 0.5, 'beta': 2.0}),
+		('Gemm', ['xf', 'g4'], ['z4'], {'transB': 1}),
+		('Concat', ['z1', 'z2', 'z3', 'z4'], ['y4'], {'axis': 1}),
+	]:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y1', "FLOAT", (1, 4, 6, 6))
+	g = so.add_output(g, 'y2', "FLOAT", (1, 2, 6, 6))
+	g = so.add_output(g, 'y3', "FLOAT", (1, 4, 6, 6))
+	g = so.add_output(g, 'c4', "FLOAT", (1, 2, 3, 3))
+	g = so.add_output(g, 'y4', "FLOAT", (1, 14))
+	save(g, "test_fuse_siblings_conv", {"x": x}, ["y1", "y2", "y3", "c4", "y4"])
+
+
+attention()
+conv()
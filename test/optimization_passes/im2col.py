@@ -0,0 +1,34 @@
+# Generate the regression tests for the im2col optimization pass.
+# Each function generates one test directory.
+
+import sclblonnx as so
+from passtest import save, rand
+
+
+# Small weights keep the outputs of the four layers near one
+def weights(*shape):
+	return rand(*shape) / 4
+
+
+# A padded Conv, packed 5 output rows at a time, and a grouped, strided
+# and dilated Conv with asymmetric pads, packed one row at a time, are
+# lowered. The depthwise and the pointwise Conv are not.
+def im2col():
+	x = rand(1, 3, 9, 11)
+	g = so.empty_graph()
+	for name, value in [('w1', weights(16, 3, 3, 3)), ('b1', rand(16)), ('w2', weights(32, 8, 3, 3)), ('b2', rand(32)),
+	                    ('w3', weights(32, 1, 3, 3)), ('w4', weights(8, 32, 1, 1))]:
+		g = so.add_constant(g, name, value, "FLOAT")
+	for op, inputs, outputs, attrs in [
+		('Conv', ['x', 'w1', 'b1'], ['c1'], {'pads': [1, 1, 1, 1]}),
+		('Conv', ['c1', 'w2', 'b2'], ['c2'], {'group': 2, 'strides': [2, 2], 'dilations': [1, 2], 'pads': [1, 2, 0, 1]}),
+		('Conv', ['c2', 'w3'], ['c3'], {'group': 32, 'pads': [1, 1, 1, 1]}),
+		('Conv', ['c3', 'w4'], ['y'], {}),
+	]:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y', "FLOAT", (1, 8, 4, 5))
+	save(g, "test_im2col", {"x": x}, ["y"])
+
+
+im2col()
@@ -0,0 +1,73 @@
+# Generate the regression tests for the lower_qdq optimization pass.
+# Each function generates one test directory.
+
+import numpy as np
+import sclblonnx as so
+from passtest import save, add_nodes
+
+
+# QDQ Conv with a quantized bias (with an explicit zero point), followed
+# by a QDQ Add and a DequantizeLinear/QuantizeLinear pair that cancels out.
+def conv():
+	x = np.random.rand(1, 2, 5, 5).astype(np.float32) * 2 - 1
+	g = so.empty_graph()
+	g = so.add_constant(g, 'xs', np.array(0.01, dtype=np.float32), "FLOAT")
+	g = so.add_constant(g, 'xz', np.array(128, dtype=np.uint8), "UINT8")
+	g = so.add_constant(g, 'w', np.random.randint(-127, 127, (3, 2, 3, 3)).astype(np.int8), "INT8")
+	g = so.add_constant(g, 'ws', np.array(0.005, dtype=np.float32), "FLOAT")
+	g = so.add_constant(g, 'b', np.random.randint(-2000, 2000, (3)).astype(np.int32), "INT32")
+	g = so.add_constant(g, 'bs', np.array(0.00005, dtype=np.float32), "FLOAT")
+	g = so.add_constant(g, 'bz', np.array(0, dtype=np.int32), "INT32")
+	g = so.add_constant(g, 'cs', np.array(0.03, dtype=np.float32), "FLOAT")
+	g = so.add_constant(g, 'cz', np.array(100, dtype=np.uint8), "UINT8")
+	g = so.add_constant(g, 'ss', np.array(0.06, dtype=np.float32), "FLOAT")
+	g = add_nodes(g, [
+		('QuantizeLinear', ['x', 'xs', 'xz'], ['xq'], {}),
+		('DequantizeLinear', ['xq', 'xs', 'xz'], ['xd'], {}),
+		('DequantizeLinear', ['w', 'ws'], ['wd'], {}),
+		('DequantizeLinear', ['b', 'bs', 'bz'], ['bd'], {}),
+		('Conv', ['xd', 'wd', 'bd'], ['c'], {'pads': [1, 1, 1, 1]}),
+		('QuantizeLinear', ['c', 'cs', 'cz'], ['cq'], {}),
+		('DequantizeLinear', ['cq', 'cs', 'cz'], ['cd'], {}),
+		('Add', ['cd', 'cd'], ['s'], {}),
+		('QuantizeLinear', ['s', 'ss', 'cz'], ['sq'], {}),
+		('DequantizeLinear', ['sq', 'ss', 'cz'], ['sd'], {}),
+		('QuantizeLinear', ['sd', 'ss', 'cz'], ['sq2'], {}),
+		('DequantizeLinear', ['sq2', 'ss', 'cz'], ['y'], {}),
+	])
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y', "FLOAT", (1, 3, 5, 5))
+	save(g, "test_lower_qdq_conv", {"x": x}, ["y"])
+
+
+# QDQ MatMul with int8 output, followed by a Mul that is left in float.
+def matmul():
+	x = np.random.rand(3, 6).astype(np.float32) * 2 - 1
+	g = so.empty_graph()
+	g = so.add_constant(g, 'xs', np.array(0.01, dtype=np.float32), "FLOAT")
+	g = so.add_constant(g, 'xz', np.array(0, dtype=np.int8), "INT8")
+	g = so.add_constant(g, 'w', np.random.randint(-127, 127, (6, 5)).astype(np.int8), "INT8")
+	g = so.add_constant(g, 'ws', np.array([0.01], dtype=np.float32), "FLOAT")
+	g = so.add_constant(g, 'wz', np.array(3, dtype=np.int8), "INT8")
+	g = so.add_constant(g, 'ms', np.array(0.002, dtype=np.float32), "FLOAT")
+	g = so.add_constant(g, 'mz', np.array(-5, dtype=np.int8), "INT8")
+	g = so.add_constant(g, 'ps', np.array(0.001, dtype=np.float32), "FLOAT")
+	g = so.add_constant(g, 'xm', np.array(0.5, dtype=np.float32), "FLOAT")
+	g = add_nodes(g, [
+		('QuantizeLinear', ['x', 'xs', 'xz'], ['xq'], {}),
+		('DequantizeLinear', ['xq', 'xs', 'xz'], ['xd'], {}),
+		('DequantizeLinear', ['w', 'ws', 'wz'], ['wd'], {}),
+		('MatMul', ['xd', 'wd'], ['m'], {}),
+		('QuantizeLinear', ['m', 'ms', 'mz'], ['mq'], {}),
+		('DequantizeLinear', ['mq', 'ms', 'mz'], ['md'], {}),
+		('Mul', ['md', 'xm'], ['p'], {}),
+		('QuantizeLinear', ['p', 'ps', 'mz'], ['pq'], {}),
+		('DequantizeLinear', ['pq', 'ps', 'mz'], ['y'], {}),
+	])
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y', "FLOAT", (3, 5))
+	save(g, "test_lower_qdq_matmul", {"x": x}, ["y"])
+
+
+conv()
+matmul()
@@ -0,0 +1,38 @@
+# Helpers shared by the scripts generating the optimization pass
+# regression tests. Each script builds one or more networks and saves
+# them with save(). The tests are run with the pass enabled, and
+# compared to onnxruntime's results of the unoptimized network.
+
+import numpy as np
+import sclblonnx as so
+from onnx import numpy_helper
+from pathlib import Path
+
+
+def save_tensor(t, fn):
+	with open(fn, 'wb') as f:
+		npt = numpy_helper.from_array(t)
+		f.write(npt.SerializeToString(npt))
+
+
+# Write the network g, its inputs in 'example' (in the order of the
+# graph inputs) and onnxruntime's results for 'outputs' as test 'test_name'
+def save(g, test_name, example, outputs):
+	so.check(g)
+	Path(test_name + "/test_data_set_0").mkdir(parents=True, exist_ok=True)
+	so.graph_to_file(g, test_name + "/model.onnx")
+	result = so.run(g, inputs=example, outputs=outputs)
+	for i, name in enumerate(example):
+		save_tensor(example[name], test_name + "/test_data_set_0/input_" + str(i) + ".pb")
+	for i in range(len(outputs)):
+		save_tensor(result[i], test_name + "/test_data_set_0/output_" + str(i) + ".pb")
+
+
+def rand(*shape):
+	return np.random.rand(*shape).astype(np.float32) * 2 - 1
+
+
+def add_nodes(g, nodes):
+	for op, inputs, outputs, attrs in nodes:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	return g
@@ -0,0 +1,69 @@
+# Generate the regression tests for the range_analysis optimization pass.
+# Each function generates one test directory.
+
+import numpy as np
+import sclblonnx as so
+from passtest import save, add_nodes
+
+
+# Run with '--input-range x:-1:1'.
+# The Relu and Clip after the Sigmoid, the Clip of x and the second of
+# the two Relus are removed. The QLinearConv with small weights and the
+# QLinearMatMul get 16 bit accumulators, the QLinearConv with large
+# weights does not. The Gather indices are stored as int32.
+def range_analysis():
+	x = np.random.rand(1, 2, 4, 4).astype(np.float32) * 2 - 1
+	q = np.random.randint(0, 256, (1, 2, 5, 5)).astype(np.uint8)
+	a = np.random.randint(0, 256, (3, 6)).astype(np.uint8)
+	gd = np.random.rand(5, 3).astype(np.float32)
+	g = so.empty_graph()
+	for name, value, dtype in [
+		('zero', np.array(0, dtype=np.float32), "FLOAT"),
+		('one', np.array(1, dtype=np.float32), "FLOAT"),
+		('mone', np.array(-1, dtype=np.float32), "FLOAT"),
+		('qs', np.array(0.01, dtype=np.float32), "FLOAT"),
+		('qz', np.array(128, dtype=np.uint8), "UINT8"),
+		('w1', np.random.randint(-3, 4, (3, 2, 3, 3)).astype(np.int8), "INT8"),
+		('ws', np.array(0.01, dtype=np.float32), "FLOAT"),
+		('wz', np.array(0, dtype=np.int8), "INT8"),
+		('ys', np.array(0.01, dtype=np.float32), "FLOAT"),
+		('yz', np.array(128, dtype=np.uint8), "UINT8"),
+		('b1', np.random.randint(-500, 501, (3)).astype(np.int32), "INT32"),
+		('w2', np.random.randint(-127, 128, (3, 2, 3, 3)).astype(np.int8), "INT8"),
+		('ys2', np.array(0.5, dtype=np.float32), "FLOAT"),
+		('as', np.array(0.01, dtype=np.float32), "FLOAT"),
+		('az', np.array(0, dtype=np.uint8), "UINT8"),
+		('b', np.random.randint(-10, 11, (6, 4)).astype(np.int8), "INT8"),
+		('bs', np.array(0.02, dtype=np.float32), "FLOAT"),
+		('bz', np.array(0, dtype=np.int8), "INT8"),
+		('mys', np.array(0.05, dtype=np.float32), "FLOAT"),
+		('idx', np.array([[0, 4], [-1, 2]], dtype=np.int64), "INT64")]:
+		g = so.add_constant(g, name, value, dtype)
+	g = add_nodes(g, [
+		('Sigmoid', ['x'], ['s'], {}),
+		('Relu', ['s'], ['r1'], {}),
+		('Clip', ['r1', 'zero', 'one'], ['y1'], {}),
+		('Clip', ['x', 'mone', 'one'], ['c'], {}),
+		('Mul', ['c', 'x'], ['y2'], {}),
+		('Relu', ['x'], ['r2'], {}),
+		('Relu', ['r2'], ['y3'], {}),
+		('QLinearConv', ['q', 'qs', 'qz', 'w1', 'ws', 'wz', 'ys', 'yz', 'b1'], ['y4'], {'pads': [1, 1, 1, 1]}),
+		('QLinearConv', ['q', 'qs', 'qz', 'w2', 'ws', 'wz', 'ys2', 'yz'], ['y5'], {}),
+		('QLinearMatMul', ['a', 'as', 'az', 'b', 'bs', 'bz', 'mys', 'yz'], ['y6'], {}),
+		('Gather', ['gd', 'idx'], ['y7'], {}),
+	])
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_input(g, 'q', "UINT8", q.shape)
+	g = so.add_input(g, 'a', "UINT8", a.shape)
+	g = so.add_input(g, 'gd', "FLOAT", gd.shape)
+	g = so.add_output(g, 'y1', "FLOAT", (1, 2, 4, 4))
+	g = so.add_output(g, 'y2', "FLOAT", (1, 2, 4, 4))
+	g = so.add_output(g, 'y3', "FLOAT", (1, 2, 4, 4))
+	g = so.add_output(g, 'y4', "UINT8", (1, 3, 5, 5))
+	g = so.add_output(g, 'y5', "UINT8", (1, 3, 3, 3))
+	g = so.add_output(g, 'y6', "UINT8", (3, 4))
+	g = so.add_output(g, 'y7', "FLOAT", (2, 2, 3))
+	save(g, "test_range_analysis", {"x": x, "q": q, "a": a, "gd": gd}, ["y1", "y2", "y3", "y4", "y5", "y6", "y7"])
+
+
+range_analysis()
@@ -0,0 +1,32 @@
+# Generate the regression tests for the register_blocking optimization pass.
+# Each function generates one test directory.
+
+import sclblonnx as so
+from passtest import save, rand
+
+
+# Small weights keep the outputs of the two layers near one
+def weights(*shape):
+	return rand(*shape) * 0.3
+
+
+# Run with '--conv-tile 4:5'.
+# The padded Conv has partial tiles of both output channels and outputs.
+# The tile of the grouped, strided and dilated Conv is cut to its two
+# output channels per group and four outputs per row.
+def register_blocking():
+	x = rand(2, 4, 7, 9)
+	g = so.empty_graph()
+	for name, value in [('w1', weights(6, 4, 3, 3)), ('b1', rand(6)), ('w2', weights(4, 3, 3, 3)), ('b2', rand(4))]:
+		g = so.add_constant(g, name, value, "FLOAT")
+	for op, inputs, outputs, attrs in [
+		('Conv', ['x', 'w1', 'b1'], ['c1'], {'pads': [1, 1, 1, 1]}),
+		('Conv', ['c1', 'w2', 'b2'], ['y'], {'group': 2, 'strides': [2, 2], 'dilations': [1, 2], 'pads': [0, 2, 1, 1]}),
+	]:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y', "FLOAT", (2, 4, 3, 4))
+	save(g, "test_register_blocking", {"x": x}, ["y"])
+
+
+register_blocking()
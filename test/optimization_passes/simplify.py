@@ -0,0 +1,44 @@
+# Generate the regression test for the simplify optimization pass.
+
+import numpy as np
+import sclblonnx as so
+from passtest import save
+
+
+# Identity, Dropout, Mul by one, Add of zero, an Unsqueeze -> Squeeze pair,
+# a Reshape chain and a same-type Cast are removed. The Identity of a graph
+# output is removed by making Tanh write the output directly. The Mul by
+# a ones tensor that broadcasts to a larger shape is kept.
+test_name = "test_simplify"
+x = np.random.rand(2, 3, 4).astype(np.float32) * 2 - 1
+
+g = so.empty_graph()
+g = so.add_constant(g, 'one', np.array([1], dtype=np.float32), "FLOAT")
+g = so.add_constant(g, 'zeros', np.zeros(4, dtype=np.float32), "FLOAT")
+g = so.add_constant(g, 'ax', np.array([1], dtype=np.int64), "INT64")
+g = so.add_constant(g, 's1', np.array([6, 4], dtype=np.int64), "INT64")
+g = so.add_constant(g, 's2', np.array([2, 12], dtype=np.int64), "INT64")
+g = so.add_constant(g, 'ones', np.ones((2, 1, 1, 1), dtype=np.float32), "FLOAT")
+for op, inputs, outputs, attrs in [
+	('Identity', ['x'], ['a'], {}),
+	('Dropout', ['a'], ['b'], {}),
+	('Mul', ['one', 'b'], ['c'], {}),
+	('Add', ['c', 'zeros'], ['d'], {}),
+	('Unsqueeze', ['d', 'ax'], ['e'], {}),
+	('Squeeze', ['e', 'ax'], ['f'], {}),
+	('Relu', ['f'], ['g'], {}),
+	('Reshape', ['g', 's1'], ['h'], {}),
+	('Reshape', ['h', 's2'], ['i'], {}),
+	('Cast', ['i'], ['j'], {'to': 1}),
+	('Sigmoid', ['j'], ['y'], {}),
+	('Tanh', ['x'], ['t'], {}),
+	('Identity', ['t'], ['y2'], {}),
+	('Mul', ['g', 'ones'], ['y3'], {}),
+]:
+	g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+g = so.add_input(g, 'x', "FLOAT", x.shape)
+g = so.add_output(g, 'y', "FLOAT", (2, 12))
+g = so.add_output(g, 'y2', "FLOAT", (2, 3, 4))
+g = so.add_output(g, 'y3', "FLOAT", (2, 2, 3, 4))
+
+save(g, test_name, {"x": x}, ["y", "y2", "y3"])
@@ -0,0 +1 @@
+BuJhsPnz>"_R?]>&rAii?z?$o?؍>>>x>A`9P˾>g?4de@3|R
\ No newline at end of file
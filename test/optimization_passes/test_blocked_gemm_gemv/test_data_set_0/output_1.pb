@@ -0,0 +1 @@
+By2JP5ؽ>xǾ#;?<^
\ No newline at end of file
@@ -0,0 +1 @@
+ByJ0,>:Rb>AUܿ]_5Xթ?P+At
\ No newline at end of file
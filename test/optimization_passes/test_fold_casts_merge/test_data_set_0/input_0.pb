@@ -0,0 +1 @@
+BxJ0|=CޝR0?yؾ/~<&-r?J~9
\ No newline at end of file
@@ -0,0 +1 @@
+BxiJ
\ No newline at end of file
@@ -0,0 +1 @@
+By3J0la@ZXAHopAJ~Ar@0Ay8AjAJ@E@	@A5A
\ No newline at end of file
@@ -0,0 +1 @@
+BzJxݾ`?=0.> N?g?h/?p=t<0?y>PRh?A?l60F?/???n6<]+v>Z~>i=>$z?`t
\ No newline at end of file
@@ -0,0 +1 @@
+ByJT>>|q>>>U>>>>>>H>>>>q ?"?	?	?N ?	?Kv+?	?U1?	?*E???0"?{0'?,)??&?O?9 ??g?$'?g?g?g?g?g?g?g?`>n>y?>y	>?>`>`>T?]5?`>`>`>`>[|?
\ No newline at end of file
@@ -0,0 +1 @@
+BmJ0 N?g?h/?p=t<0?y>PRh?A?l60F?
\ No newline at end of file
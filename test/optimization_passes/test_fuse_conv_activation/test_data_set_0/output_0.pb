@@ -0,0 +1,2 @@
+ByJ`մ>Vr>SV=>7=]=z>m>
+h>a>v?l?{DQ?2?&v?=?T?pI?z{??`?	[\?q?e?
\ No newline at end of file
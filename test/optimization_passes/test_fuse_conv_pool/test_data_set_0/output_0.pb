@@ -0,0 +1 @@
+By1JO@>r?@S@à?~@ ne@(d@=@z??9E@S@E1^??۽X@&?6	@>?Ѻ??.K?*q?c?~>b?k@wY?޿?	8@ā?@b+@g@??g]@Җ?p@a9@U@@_?o@#@x@?8@\?)-@Y?@|?,D"?z?3?
\ No newline at end of file
@@ -0,0 +1 @@
+By2J0@D?ܔ>^e3-N1`R?pj>><g>
\ No newline at end of file
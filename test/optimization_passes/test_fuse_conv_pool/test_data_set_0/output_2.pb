@@ -0,0 +1 @@
+By3J@?k@o@
\ No newline at end of file
@@ -0,0 +1 @@
+By2J䀏@Ι@A^@B0@
\ No newline at end of file
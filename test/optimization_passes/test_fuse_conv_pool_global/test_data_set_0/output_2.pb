@@ -0,0 +1 @@
+By3J *>uo1bøO}>
\ No newline at end of file
@@ -0,0 +1 @@
+By4J{<ɽ
\ No newline at end of file
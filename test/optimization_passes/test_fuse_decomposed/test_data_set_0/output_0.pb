@@ -0,0 +1 @@
+ByJ5оc{?Hx>Z?΢6zFT*S?z>@h>QžK8u.IdqjmtД[;>Im彐zfb<W	$@?f >uRq% ?EҾ3d+v4M[>j2>p=
\ No newline at end of file
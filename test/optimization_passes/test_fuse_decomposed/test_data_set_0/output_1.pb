@@ -0,0 +1 @@
+By2JC;n??j.&x>a:CU?b6ESxi?a>}n?;?0%O?=?	Cƿd?(Y=	k?>6?필?8?\$Q=?ۺ~<c?q>:ɿ?NxBj.tgԙUPL[SX4=?
\ No newline at end of file
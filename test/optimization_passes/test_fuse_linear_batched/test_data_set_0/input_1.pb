@@ -0,0 +1 @@
+BbJ28*T <?H\
\ No newline at end of file
@@ -0,0 +1 @@
+By3J?iJ![>?om?t]?&>Rs?>I55J8?'>[[?W꾟"?@@_?z9->>}9~݉Y=}O=^?Wg6zJu?@?>5>yh3l?+As>
\ No newline at end of file
@@ -0,0 +1,3 @@
+By4J8?k#?
+>@	"?]rt>>SI?
+(?#}#kVn
\ No newline at end of file
@@ -0,0 +1 @@
+ByJ<+>+>+>+>mm+>+>+>m+>mmm+>
\ No newline at end of file
@@ -0,0 +1 @@
+BqJ2݋*h`SdEVx켤>[ k'7XAzqC
\ No newline at end of file
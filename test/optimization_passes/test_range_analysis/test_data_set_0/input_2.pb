@@ -0,0 +1 @@
+BaJ*-qxHn
\ No newline at end of file
@@ -0,0 +1,2 @@
+By2JaX;ה>>#{<k>*=l>*9>d>"=->R=C5<<s=^(2>V?|\=_
+=55?>]?<Δ>v5<pb=a=:2>b>i)-?{2<
\ No newline at end of file
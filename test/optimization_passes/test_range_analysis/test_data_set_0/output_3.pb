@@ -0,0 +1 @@
+By4JKxzzvz{{xv~~r|{zq|yzsz|}zs~zwuy}~z{z}
\ No newline at end of file
@@ -0,0 +1 @@
+By5J{{~z|q}|~v{
\ No newline at end of file
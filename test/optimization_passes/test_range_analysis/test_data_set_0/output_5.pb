@@ -0,0 +1 @@
+By6Jl{ntz
\ No newline at end of file
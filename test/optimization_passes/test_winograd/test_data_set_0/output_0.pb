@@ -0,0 +1 @@
+ByJx-1H(> I뿜È=b?icz>?s0>˳?Ƿ>.zn? ?m?}4? VӼ$>P>B{h=6>?&ֿYrY"?}?3e>?g4=x<4,r??~?V?
\ No newline at end of file
@@ -0,0 +1,34 @@
+# Generate the regression tests for the winograd optimization pass.
+# Each function generates one test directory.
+
+import sclblonnx as so
+from passtest import save, rand
+
+
+# Small weights keep the outputs of the four layers near one
+def weights(*shape):
+	return rand(*shape) * 0.3
+
+
+# A padded Conv with bias, and a Conv with asymmetric pads and odd
+# output sizes, are lowered. The strided Conv and the Conv with too
+# few output channels are not.
+def winograd():
+	x = rand(2, 3, 8, 9)
+	g = so.empty_graph()
+	for name, value in [('w1', weights(8, 3, 3, 3)), ('b1', rand(8)), ('w2', weights(6, 8, 3, 3)),
+	                    ('w3', weights(4, 6, 3, 3)), ('b3', rand(4)), ('w4', weights(2, 4, 3, 3))]:
+		g = so.add_constant(g, name, value, "FLOAT")
+	for op, inputs, outputs, attrs in [
+		('Conv', ['x', 'w1', 'b1'], ['c1'], {'kernel_shape': [3, 3], 'pads': [1, 1, 1, 1]}),
+		('Conv', ['c1', 'w2'], ['c2'], {'pads': [2, 0, 1, 1]}),
+		('Conv', ['c2', 'w3', 'b3'], ['c3'], {'strides': [2, 2]}),
+		('Conv', ['c3', 'w4'], ['y'], {'pads': [1, 1, 1, 1]}),
+	]:
+		g = so.add_node(g, so.node(op, inputs=inputs, outputs=outputs, **attrs))
+	g = so.add_input(g, 'x', "FLOAT", x.shape)
+	g = so.add_output(g, 'y', "FLOAT", (2, 2, 4, 4))
+	save(g, "test_winograd", {"x": x}, ["y"])
+
+
+winograd()
@@ -0,0 +1,50 @@
+/* Test runner for runtime_batch.onnx, compiled with
+ * the batch size as a runtime parameter of at most 4.
+ * The reference values are from the same model compiled
+ * with a fixed batch size of 4 ('-d N:4').
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#define MAX_BATCH 4
+
+float reference[MAX_BATCH][5] = {
+	{0.1936643f, 0.1270303f, 0.4248374f, 0.0567677f, 0.1977003f},
+	{0.1903768f, 0.1073863f, 0.4081200f, 0.0621574f, 0.2319594f},
+	{0.1572044f, 0.1118571f, 0.3858234f, 0.0568379f, 0.2882771f},
+	{0.2443217f, 0.1278977f, 0.4116771f, 0.0546808f, 0.1614227f},
+};
+
+float input[MAX_BATCH][3][8][8];
+float output[MAX_BATCH][5];
+
+void entry(uint32_t N, const float x[MAX_BATCH][3][8][8], float y[MAX_BATCH][5]);
+
+int main() {
+	float *in = &input[0][0][0][0];
+	for (unsigned i = 0; i < sizeof(input) / sizeof(float); i++)
+		in[i] = sinf(i * 0.37f);
+
+	int rv = 0;
+	for (uint32_t n = 0; n <= MAX_BATCH; n++) {
+		for (unsigned b = 0; b < MAX_BATCH; b++)
+			for (unsigned i = 0; i < 5; i++)
+				output[b][i] = -1;
+
+		entry(n, input, output);
+
+		// The first n outputs are calculated, the rest are not touched
+		for (unsigned b = 0; b < MAX_BATCH; b++) {
+			for (unsigned i = 0; i < 5; i++) {
+				float expected = b < n ? reference[b][i] : -1;
+				if (fabsf(output[b][i] - expected) > 1e-5) {
+					printf("Wrong result: N=%u, y[%u][%u]=%f, expected %f\n",
+					       n, b, i, output[b][i], expected);
+					rv = 1;
+				}
+			}
+		}
+	}
+	return rv;
+}
@@ -0,0 +1,39 @@
+# A small CNN with a symbolic batch size 'N', for testing
+# the batch size as a runtime parameter (onnx2c -r N:4)
+import numpy as np
+import onnx
+from onnx import numpy_helper
+from onnx.helper import make_model, make_node, make_graph, make_tensor_value_info
+from onnx.checker import check_model
+
+rng = np.random.default_rng()
+
+def weights(name, *shape):
+    return numpy_helper.from_array(rng.uniform(-1, 1, shape).astype(np.float32), name)
+
+x = make_tensor_value_info("x", onnx.TensorProto.FLOAT, ["N", 3, 8, 8])
+y = make_tensor_value_info("y", onnx.TensorProto.FLOAT, ["N", 5])
+
+nodes = [
+    make_node("Conv", ["x", "w", "b"], ["c"], pads=[1, 1, 1, 1]),
+    make_node("Relu", ["c"], ["r"]),
+    make_node("Mul", ["r", "s"], ["m"]),
+    make_node("MaxPool", ["m"], ["p"], kernel_shape=[2, 2], strides=[2, 2]),
+    make_node("Flatten", ["p"], ["f"]),
+    make_node("Gemm", ["f", "g", "gb"], ["l"], alpha=0.3),
+    make_node("Softmax", ["l"], ["y"], axis=-1),
+]
+initializers = [
+    weights("w", 4, 3, 3, 3),
+    weights("b", 4),
+    weights("s", 4, 1, 1),
+    weights("g", 64, 5),
+    weights("gb", 5),
+]
+
+graph = make_graph(nodes, "runtime_batch", [x], [y], initializers)
+model = make_model(graph, producer_name="runtime_batch.py", opset_imports=[onnx.helper.make_opsetid("", 13)])
+
+check_model(model)
+
+onnx.save(model, "runtime_batch.onnx")